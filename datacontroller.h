@@ -0,0 +1,151 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DATACONTROLLER_H_
+#define DATACONTROLLER_H_
+
+namespace SerialDV
+{
+
+const unsigned char DV3000_START_BYTE   = 0x61U;
+
+const unsigned char DV3000_TYPE_CONTROL = 0x00U;
+const unsigned char DV3000_TYPE_AMBE    = 0x01U;
+const unsigned char DV3000_TYPE_AUDIO   = 0x02U;
+
+const unsigned char DV3000_CONTROL_RATEP  = 0x0AU;
+const unsigned char DV3000_CONTROL_GAIN   = 0x4BU;
+const unsigned char DV3000_CONTROL_PRODID = 0x30U;
+const unsigned char DV3000_CONTROL_READY  = 0x39U;
+const unsigned char DV3000_CONTROL_RESET  = 0x33U;
+
+const unsigned char DV3000_CONTROL_CHANNEL0 = 0x40U; //!< AMBE3003 channel field for channel 0 then 0x41 and 0x42 for channels 1 and 2
+const unsigned int  DV3000_MAX_CHANNELS     = 3U;
+
+const unsigned char DV3000_FIELD_SPEECHD = 0x00U;
+const unsigned char DV3000_FIELD_CHAND   = 0x01U;
+
+const unsigned char DV3000_REQ_PRODID[] = {DV3000_START_BYTE, 0x00U, 0x01U, DV3000_TYPE_CONTROL, DV3000_CONTROL_PRODID};
+const unsigned int DV3000_REQ_PRODID_LEN = 5U;
+
+const unsigned char DV3000_REQ_RESET[] = {DV3000_START_BYTE, 0x00U, 0x01U, DV3000_TYPE_CONTROL, DV3000_CONTROL_RESET}; // answered by READY
+const unsigned int DV3000_REQ_RESET_LEN = 5U;
+
+const unsigned char DV3000_REQ_3600X2400_RATEP[]   = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x01U, 0x30U, 0x07U, 0x63U, 0x40U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x48U};
+const unsigned char DV3000_REQ_3600X2450_RATEP[]   = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x31U, 0x07U, 0x54U, 0x24U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x6FU, 0x48U};
+
+const unsigned char DV3000_REQ_7200X4400_1_RATEP[] = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x00U, 0x58U, 0x08U, 0x87U, 0x30U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x44U, 0x90U};
+const unsigned char DV3000_REQ_7200X4400_2_RATEP[] = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x02U, 0x58U, 0x07U, 0x65U, 0x00U, 0x09U, 0x1EU, 0x0CU, 0x41U, 0x27U, 0x73U, 0x90U};
+const unsigned char DV3000_REQ_7200X4400_3_RATEP[] = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x58U, 0x09U, 0x86U, 0x80U, 0x20U, 0x00U, 0x00U, 0x00U, 0x00U, 0x73U, 0x90U};
+
+const unsigned char DV3000_REQ_2450_RATEP[]        = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x31U, 0x07U, 0x54U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x70U, 0x31U};
+const unsigned char DV3000_REQ_4400_RATEP[]        = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x58U, 0x09U, 0x86U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x44U, 0x58U};
+const unsigned int DV3000_REQ_RATEP_LEN = 17U;
+
+const unsigned char DV3000_REQ_GAIN[] = {DV3000_START_BYTE, 0x00U, 0x03U, DV3000_TYPE_CONTROL, DV3000_CONTROL_GAIN}; // followed by 1 byte input gain and 1 byte output gain
+const unsigned int DV3000_REQ_GAIN_LEN = 5U;
+
+const unsigned char DV3000_AUDIO_HEADER[] = {DV3000_START_BYTE, 0x01U, 0x42U, DV3000_TYPE_AUDIO, 0x00U, 0xA0U};
+const unsigned char DV3000_AUDIO_HEADER_LEN = 6U;
+
+const unsigned char DV3000_AMBE_HEADER[] = {DV3000_START_BYTE, 0x00U, 0x0BU, DV3000_TYPE_AMBE, 0x01U, 0x48U};
+const unsigned char DV3000_AMBE_HEADER_LEN  = 6U;
+
+// AMBE3003 packets carry the channel field first. Channel is to be set at index 4.
+const unsigned char DV3003_AUDIO_HEADER[] = {DV3000_START_BYTE, 0x01U, 0x43U, DV3000_TYPE_AUDIO, DV3000_CONTROL_CHANNEL0, 0x00U, 0xA0U};
+const unsigned char DV3003_AUDIO_HEADER_LEN = 7U;
+
+const unsigned char DV3003_AMBE_HEADER[] = {DV3000_START_BYTE, 0x00U, 0x0CU, DV3000_TYPE_AMBE, DV3000_CONTROL_CHANNEL0, 0x01U, 0x48U};
+const unsigned char DV3003_AMBE_HEADER_LEN  = 7U;
+
+const unsigned int DV3000_HEADER_LEN = 4U;
+
+#ifdef __WINDOWS__
+const unsigned int BUFFER_LENGTH = 1000U;
+#else
+const unsigned int BUFFER_LENGTH = 400U;
+#endif
+
+const unsigned int MBE_AUDIO_BLOCK_SIZE  = 160U;
+const unsigned int MBE_AUDIO_BLOCK_BYTES = MBE_AUDIO_BLOCK_SIZE * 2U;
+
+const unsigned int MBE_FRAME_MAX_LENGTH_BYTES = 18U;
+
+/** One part of a gather write */
+struct DataBuffer
+{
+    const unsigned char *data;
+    unsigned int length;
+};
+
+const unsigned int DATA_MAX_BUFFERS = 8U; //!< Maximum number of parts in a gather write
+
+/** Link to a DV device over which AMBE3000 packets are exchanged
+ */
+class DataController {
+public:
+    virtual ~DataController() {}
+
+    /** Reads exactly lengthInBytes bytes unless nothing is available in which case 0 is returned.
+     * Returns -1 on error.
+     */
+    virtual int  read(unsigned char* buffer, unsigned int lengthInBytes) = 0;
+
+    /** Waits at most timeoutUs microseconds for incoming data then reads in one go whatever is
+     * available up to lengthInBytes. Returns the number of bytes read, 0 on timeout or -1 on error.
+     */
+    virtual int  readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs) = 0;
+
+    /** Writes one or several complete packets. Returns the number of bytes written or -1 on error */
+    virtual int  write(const unsigned char* buffer, unsigned int lengthInBytes) = 0;
+
+    /** Writes the parts one after the other as one contiguous buffer. Each part holds complete
+     * packets. Links that can gather the parts in one system call override it.
+     * Returns the number of bytes written or -1 on error.
+     */
+    virtual int  writeGather(const DataBuffer* buffers, unsigned int nbBuffers)
+    {
+        int total = 0;
+
+        for (unsigned int i = 0; i < nbBuffers; i++)
+        {
+            int result = write(buffers[i].data, buffers[i].length);
+
+            if (result < 0) {
+                return -1;
+            }
+
+            total += result;
+        }
+
+        return total;
+    }
+
+    /** Changes the link speed in bauds. Returns false if the link has no speed setting */
+    virtual bool setSpeed(unsigned int speed __attribute__((unused))) { return false; }
+
+    /** Link speed in bauds or 0 if not applicable */
+    virtual unsigned int getSpeed() const { return 0; }
+
+    /** File descriptor that becomes readable when data comes in or -1 if there is none */
+    virtual int getFd() const { return -1; }
+
+    virtual void close() = 0;
+};
+
+} // namespace SerialDV
+
+#endif /* DATACONTROLLER_H_ */
@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "dvambefile.h"
+
+namespace SerialDV
+{
+
+static const unsigned char DV_AMBE_FILE_MAGIC[4] = {'S', 'D', 'V', 'A'};
+
+bool DVAmbeFile::buildHeader(unsigned char *header, DVRate rate)
+{
+    const DVRateInfo& rateInfo = getRateInfo(rate);
+
+    if (rateInfo.nbMbeBits == 0)
+    {
+        fprintf(stderr, "DVAmbeFile::buildHeader: unsupported rate %d\n", (int) rate);
+        return false;
+    }
+
+    ::memcpy(header, DV_AMBE_FILE_MAGIC, sizeof(DV_AMBE_FILE_MAGIC));
+    header[4] = VERSION;
+    header[5] = (unsigned char) rate;
+    header[6] = rateInfo.nbMbeBits;
+    header[7] = rateInfo.nbMbeBytes;
+    return true;
+}
+
+bool DVAmbeFile::parseHeader(const unsigned char *header, DVRate& rate)
+{
+    if (::memcmp(header, DV_AMBE_FILE_MAGIC, sizeof(DV_AMBE_FILE_MAGIC)) != 0)
+    {
+        fprintf(stderr, "DVAmbeFile::parseHeader: not an AMBE file\n");
+        return false;
+    }
+
+    if (header[4] != VERSION)
+    {
+        fprintf(stderr, "DVAmbeFile::parseHeader: unsupported version %u\n", header[4]);
+        return false;
+    }
+
+    const DVRateInfo& rateInfo = getRateInfo((DVRate) header[5]);
+
+    if ((rateInfo.nbMbeBits == 0) || (header[6] != rateInfo.nbMbeBits) || (header[7] != rateInfo.nbMbeBytes))
+    {
+        fprintf(stderr, "DVAmbeFile::parseHeader: unsupported rate %u with %u bits in %u bytes\n", header[5], header[6], header[7]);
+        return false;
+    }
+
+    rate = (DVRate) header[5];
+    return true;
+}
+
+bool DVAmbeFile::writeHeader(int fd, DVRate rate)
+{
+    unsigned char header[HEADER_LENGTH];
+
+    if (!buildHeader(header, rate)) {
+        return false;
+    }
+
+    if (write(fd, header, HEADER_LENGTH) != (ssize_t) HEADER_LENGTH)
+    {
+        fprintf(stderr, "DVAmbeFile::writeHeader: write error\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool DVAmbeFile::readHeader(int fd, DVRate& rate)
+{
+    unsigned char header[HEADER_LENGTH];
+    unsigned int length = 0;
+
+    // the header may come in pieces from a pipe
+    while (length < HEADER_LENGTH)
+    {
+        ssize_t result = read(fd, &header[length], HEADER_LENGTH - length);
+
+        if (result <= 0)
+        {
+            fprintf(stderr, "DVAmbeFile::readHeader: no header\n");
+            return false;
+        }
+
+        length += result;
+    }
+
+    return parseHeader(header, rate);
+}
+
+} // namespace SerialDV
@@ -0,0 +1,55 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVAMBEFILE_H_
+#define DVAMBEFILE_H_
+
+#include "dvrate.h"
+
+namespace SerialDV
+{
+
+/** AMBE frame stream file format. An 8 bytes header:
+ * - 4 bytes magic "SDVA"
+ * - 1 byte format version (1)
+ * - 1 byte DVRate index
+ * - 1 byte number of bits per frame
+ * - 1 byte number of bytes per frame
+ * followed by the frames of getNbMbeBytes(rate) bytes each as given by the device.
+ * At 20 ms per frame the position of a frame is a plain multiplication.
+ */
+class DVAmbeFile
+{
+public:
+    static const unsigned int HEADER_LENGTH = 8U;
+    static const unsigned char VERSION = 1U;
+
+    /** Fills in the header for the rate. Returns false if the rate is not supported */
+    static bool buildHeader(unsigned char *header, DVRate rate);
+
+    /** Checks the header and returns the rate of the frames that follow */
+    static bool parseHeader(const unsigned char *header, DVRate& rate);
+
+    /** Writes the header to the file descriptor */
+    static bool writeHeader(int fd, DVRate rate);
+
+    /** Reads and checks the header from the file descriptor */
+    static bool readHeader(int fd, DVRate& rate);
+};
+
+} // namespace SerialDV
+
+#endif /* DVAMBEFILE_H_ */
@@ -0,0 +1,592 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <glob.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <new>
+
+#include "dvdevicepool.h"
+
+enum BenchMode
+{
+    BenchSync,      //!< encode() then decode() for each frame
+    BenchPipelined, //!< submitEncode() / submitDecode() spread on all channels
+    BenchBatch,     //!< encodeBatch() then decodeBatch()
+    BenchStreaming, //!< pushEncode() / pushDecode() with the writer and reader threads
+    BenchModeCount
+};
+
+static const char *modeNames[BenchModeCount] = {"sync", "pipelined", "batch", "streaming"};
+
+static std::atomic<uint64_t> nbAllocations(0); //!< Heap allocations made by the whole process
+static std::atomic<unsigned int> nbReady(0);   //!< Device threads set up and waiting for the start
+static std::atomic<unsigned int> nbDone(0);    //!< Device threads that have processed all their frames
+static std::atomic<bool> go(false);            //!< Starts the timed part of the run
+static std::atomic<bool> finish(false);        //!< Lets the device threads tear down
+
+/** Count the heap allocations so that the runs can check the hot path does not allocate.
+ * The delete operators are kept out of line so that GCC does not match the inlined free() with the new expression.
+ */
+void *operator new(size_t size)
+{
+    nbAllocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    nbAllocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+/** One device with its thread results for a run */
+struct BenchDevice
+{
+    SerialDV::DVController controller;
+    std::vector<uint32_t> latencies; //!< Encode and decode transactions latencies (us)
+    unsigned int nbFrames;           //!< Encode and decode transactions attempted
+    unsigned int nbFailures;
+};
+
+static void usage();
+static uint64_t nowUs();
+static void onTransaction(const SerialDV::DVTransaction& transaction, void *context);
+static void runDevice(BenchDevice *device, BenchMode mode, SerialDV::DVRate rate, int gain, unsigned int depth, const std::vector<short> *audio);
+static void runSync(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out);
+static void runPipelined(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out);
+static void runBatch(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out);
+static void runStreaming(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out);
+static bool parseList(const char *arg, std::vector<int>& list);
+static bool readSamples(const char *fileName, std::vector<short>& audio);
+
+void usage()
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  dvbench [options] [files...] Benchmark encode/decode round trips on 8 kS/s S16LE audio files\n");
+    fprintf(stderr, "                               (default is samples/*.raw)\n");
+    fprintf(stderr, "  dvbench -h                   Show help\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -D <device>   DVSI AMBE3000 based device. Repeat for several devices. Runs are made\n");
+    fprintf(stderr, "                with the first 1 to N devices each processing all the frames in its own thread\n");
+    fprintf(stderr, "  -s <speed>    Serial link speed in bauds (default 460800)\n");
+    fprintf(stderr, "  -f <list>     Comma separated format indexes (see dvtest - default all supported)\n");
+    fprintf(stderr, "  -g <list>     Comma separated decoder gains in dB (default 0,6)\n");
+    fprintf(stderr, "  -m <list>     Comma separated modes 0: sync 1: pipelined 2: batch 3: streaming (default all)\n");
+    fprintf(stderr, "  -d <depth>    Pipeline depth for the pipelined, batch and streaming modes (default 8)\n");
+    fprintf(stderr, "  -n <frames>   Maximum number of audio frames per run (default all)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Results are printed on stdout as CSV with one line per run. A frame is one encode or decode\n");
+    fprintf(stderr, "transaction. The real time factor is the number of 20 ms frames processed per 20 ms.\n");
+    fprintf(stderr, "The allocs column counts the heap allocations made while the frames are processed. It\n");
+    fprintf(stderr, "should be 0 and dvbench exits with status 2 otherwise.\n");
+    fprintf(stderr, "\n");
+}
+
+uint64_t nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void onTransaction(const SerialDV::DVTransaction& transaction, void *context)
+{
+    if (transaction.operation != SerialDV::DVOperationControl) {
+        ((BenchDevice *) context)->latencies.push_back(transaction.latencyUs);
+    }
+}
+
+void runSync(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out)
+{
+    unsigned int nbFrames = audio.size() / SerialDV::MBE_AUDIO_BLOCK_SIZE;
+    unsigned int nbMbeBytes = SerialDV::DVController::getNbMbeBytes(rate);
+
+    for (unsigned int i = 0; i < nbFrames; i++)
+    {
+        if (!device->controller.encode(&audio[i * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbe[i * nbMbeBytes], rate)) {
+            device->nbFailures++;
+        }
+
+        if (!device->controller.decode(&out[i * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbe[i * nbMbeBytes], rate, gain)) {
+            device->nbFailures++;
+        }
+    }
+
+    device->nbFrames += 2 * nbFrames;
+}
+
+void runPipelined(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out)
+{
+    SerialDV::DVController& controller = device->controller;
+    unsigned int nbFrames = audio.size() / SerialDV::MBE_AUDIO_BLOCK_SIZE;
+    unsigned int nbMbeBytes = SerialDV::DVController::getNbMbeBytes(rate);
+    unsigned int nbChannels = controller.getNbChannels();
+    SerialDV::DVCompletion completion;
+
+    for (int pass = 0; pass < 2; pass++) // encode then decode
+    {
+        unsigned int submitted = 0;
+
+        while ((submitted < nbFrames) || (controller.getNbInFlight() != 0))
+        {
+            bool full = false;
+
+            while ((submitted < nbFrames) && !full)
+            {
+                unsigned int channel = submitted % nbChannels;
+
+                if (pass == 0) {
+                    full = !controller.submitEncode(&audio[submitted * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbe[submitted * nbMbeBytes], rate, 0, submitted, channel);
+                } else {
+                    full = !controller.submitDecode(&out[submitted * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbe[submitted * nbMbeBytes], rate, gain, submitted, channel);
+                }
+
+                if (!full) {
+                    submitted++;
+                }
+            }
+
+            if (!controller.pollCompletion(completion)) {
+                break;
+            }
+
+            if (!completion.ok) {
+                device->nbFailures++;
+            }
+        }
+    }
+
+    device->nbFrames += 2 * nbFrames;
+}
+
+void runBatch(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out)
+{
+    unsigned int nbFrames = audio.size() / SerialDV::MBE_AUDIO_BLOCK_SIZE;
+    unsigned int nbOk = device->controller.encodeBatch(audio.data(), nbFrames, mbe.data(), rate);
+    nbOk += device->controller.decodeBatch(out.data(), nbFrames, mbe.data(), rate, gain);
+    device->nbFrames += 2 * nbFrames;
+    device->nbFailures += 2 * nbFrames - nbOk;
+}
+
+void runStreaming(BenchDevice *device, SerialDV::DVRate rate, int gain, const std::vector<short>& audio, std::vector<unsigned char>& mbe, std::vector<short>& out)
+{
+    SerialDV::DVController& controller = device->controller;
+    unsigned int nbFrames = audio.size() / SerialDV::MBE_AUDIO_BLOCK_SIZE;
+    unsigned int nbMbeBytes = SerialDV::DVController::getNbMbeBytes(rate);
+    unsigned int nbChannels = controller.getNbChannels();
+    SerialDV::DVCompletion completion;
+
+    for (int pass = 0; pass < 2; pass++) // encode then decode
+    {
+        unsigned int submitted = 0, completed = 0;
+
+        while (completed < nbFrames)
+        {
+            while (submitted < nbFrames)
+            {
+                unsigned int channel = submitted % nbChannels;
+                bool pushed;
+
+                if (pass == 0) {
+                    pushed = controller.pushEncode(&audio[submitted * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbe[submitted * nbMbeBytes], rate, 0, submitted, channel);
+                } else {
+                    pushed = controller.pushDecode(&out[submitted * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbe[submitted * nbMbeBytes], rate, gain, submitted, channel);
+                }
+
+                if (!pushed) {
+                    break;
+                }
+
+                submitted++;
+            }
+
+            if (!controller.popCompletion(completion, 1000000)) {
+                break;
+            }
+
+            completed++;
+
+            if (!completion.ok) {
+                device->nbFailures++;
+            }
+        }
+
+        device->nbFailures += nbFrames - completed;
+    }
+
+    device->nbFrames += 2 * nbFrames;
+}
+
+void runDevice(BenchDevice *device, BenchMode mode, SerialDV::DVRate rate, int gain, unsigned int depth, const std::vector<short> *audio)
+{
+    std::vector<unsigned char> mbe((audio->size() / SerialDV::MBE_AUDIO_BLOCK_SIZE) * SerialDV::MBE_FRAME_MAX_LENGTH_BYTES);
+    std::vector<short> out(audio->size());
+
+    device->latencies.clear();
+    device->latencies.reserve(2 * (audio->size() / SerialDV::MBE_AUDIO_BLOCK_SIZE));
+    device->nbFrames = 0;
+    device->nbFailures = 0;
+    device->controller.setPipelineDepth(mode == BenchSync ? 1 : depth);
+    bool started = (mode != BenchStreaming) || device->controller.startStreaming();
+
+    // everything that allocates is done: wait for all the devices to be ready
+    nbReady++;
+
+    while (!go) {
+        std::this_thread::yield();
+    }
+
+    if (!started) {
+        device->nbFailures += 2 * (audio->size() / SerialDV::MBE_AUDIO_BLOCK_SIZE);
+    } else if (mode == BenchSync) {
+        runSync(device, rate, gain, *audio, mbe, out);
+    } else if (mode == BenchPipelined) {
+        runPipelined(device, rate, gain, *audio, mbe, out);
+    } else if (mode == BenchStreaming) {
+        runStreaming(device, rate, gain, *audio, mbe, out);
+    } else {
+        runBatch(device, rate, gain, *audio, mbe, out);
+    }
+
+    nbDone++;
+
+    while (!finish) {
+        std::this_thread::yield();
+    }
+
+    if (started && (mode == BenchStreaming)) {
+        device->controller.stopStreaming();
+    }
+}
+
+bool parseList(const char *arg, std::vector<int>& list)
+{
+    list.clear();
+    const char *p = arg;
+
+    while (*p)
+    {
+        char *end;
+        long value = strtol(p, &end, 10);
+
+        if (end == p) {
+            return false;
+        }
+
+        list.push_back((int) value);
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return !list.empty();
+}
+
+bool readSamples(const char *fileName, std::vector<short>& audio)
+{
+    FILE *file = fopen(fileName, "rb");
+
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open %s for input\n", fileName);
+        return false;
+    }
+
+    short frame[SerialDV::MBE_AUDIO_BLOCK_SIZE];
+
+    while (fread(frame, SerialDV::MBE_AUDIO_BLOCK_BYTES, 1, file) == 1) {
+        audio.insert(audio.end(), frame, frame + SerialDV::MBE_AUDIO_BLOCK_SIZE);
+    }
+
+    fclose(file);
+    fprintf(stderr, "Read %s\n", fileName);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    std::vector<std::string> deviceNames;
+    std::vector<int> rates, gains, modes;
+    int serialSpeed = SerialDV::SERIAL_460800;
+    unsigned int depth = 8;
+    unsigned int maxFrames = 0;
+    bool allocFailure = false;
+
+    for (int rate = SerialDV::DVRate3600x2400; rate <= SerialDV::DVRate4400; rate++)
+    {
+        if (SerialDV::DVController::getNbMbeBytes((SerialDV::DVRate) rate) != 0) {
+            rates.push_back(rate);
+        }
+    }
+
+    gains.push_back(0);
+    gains.push_back(6);
+
+    for (int mode = 0; mode < BenchModeCount; mode++) {
+        modes.push_back(mode);
+    }
+
+    while ((c = getopt(argc, argv, "hD:s:f:g:m:d:n:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h':
+            usage();
+            exit(0);
+        case 'D':
+            deviceNames.push_back(std::string(optarg));
+            break;
+        case 's':
+            sscanf(optarg, "%d", &serialSpeed);
+            break;
+        case 'f':
+            if (!parseList(optarg, rates)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'g':
+            if (!parseList(optarg, gains)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'm':
+            if (!parseList(optarg, modes)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'd':
+            sscanf(optarg, "%u", &depth);
+            break;
+        case 'n':
+            sscanf(optarg, "%u", &maxFrames);
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (deviceNames.empty())
+    {
+        fprintf(stderr, "No DV serial device specified. Aborting\n");
+        return 1;
+    }
+
+    std::vector<short> audio;
+
+    if (optind < argc)
+    {
+        for (int i = optind; i < argc; i++)
+        {
+            if (!readSamples(argv[i], audio)) {
+                return 1;
+            }
+        }
+    }
+    else
+    {
+        glob_t files;
+
+        if (glob("samples/*.raw", 0, 0, &files) == 0)
+        {
+            for (size_t i = 0; i < files.gl_pathc; i++) {
+                readSamples(files.gl_pathv[i], audio);
+            }
+        }
+
+        globfree(&files);
+    }
+
+    if ((maxFrames != 0) && (audio.size() > maxFrames * SerialDV::MBE_AUDIO_BLOCK_SIZE)) {
+        audio.resize(maxFrames * SerialDV::MBE_AUDIO_BLOCK_SIZE);
+    }
+
+    if (audio.empty())
+    {
+        fprintf(stderr, "No input audio frames. Aborting\n");
+        return 1;
+    }
+
+    std::vector<BenchDevice *> devices;
+
+    for (unsigned int i = 0; i < deviceNames.size(); i++)
+    {
+        BenchDevice *device = new BenchDevice();
+
+        if (!device->controller.open(deviceNames[i], (SerialDV::SERIAL_SPEED) serialSpeed))
+        {
+            fprintf(stderr, "Failed to open DV serial device %s. Aborting\n", deviceNames[i].c_str());
+            delete device;
+            break;
+        }
+
+        device->controller.setTransactionCallback(onTransaction, device);
+        devices.push_back(device);
+    }
+
+    if (devices.size() != deviceNames.size())
+    {
+        for (unsigned int i = 0; i < devices.size(); i++) {
+            delete devices[i];
+        }
+
+        return 1;
+    }
+
+    printf("mode,devices,rate,gain,frames,failures,seconds,fps,rtf,lat_p50_us,lat_p99_us,lat_max_us,allocs\n");
+
+    for (unsigned int m = 0; m < modes.size(); m++)
+    {
+        if ((modes[m] < 0) || (modes[m] >= BenchModeCount)) {
+            continue;
+        }
+
+        for (unsigned int r = 0; r < rates.size(); r++)
+        {
+            SerialDV::DVRate rate = (SerialDV::DVRate) rates[r];
+
+            if (SerialDV::DVController::getNbMbeBytes(rate) == 0)
+            {
+                fprintf(stderr, "Format %d is not supported. Skipping\n", rates[r]);
+                continue;
+            }
+
+            for (unsigned int g = 0; g < gains.size(); g++)
+            {
+                for (unsigned int nbDevices = 1; nbDevices <= devices.size(); nbDevices++)
+                {
+                    std::vector<std::thread> threads;
+                    nbReady = 0;
+                    nbDone = 0;
+                    go = false;
+                    finish = false;
+
+                    for (unsigned int i = 0; i < nbDevices; i++) {
+                        threads.push_back(std::thread(runDevice, devices[i], (BenchMode) modes[m], rate, gains[g], depth, &audio));
+                    }
+
+                    while (nbReady != nbDevices) {
+                        std::this_thread::yield();
+                    }
+
+                    uint64_t allocStart = nbAllocations;
+                    uint64_t start = nowUs();
+                    go = true;
+
+                    while (nbDone != nbDevices) {
+                        std::this_thread::yield();
+                    }
+
+                    double seconds = (nowUs() - start) / 1e6;
+                    uint64_t allocs = nbAllocations - allocStart;
+                    finish = true;
+
+                    for (unsigned int i = 0; i < nbDevices; i++) {
+                        threads[i].join();
+                    }
+
+                    if (allocs != 0)
+                    {
+                        fprintf(stderr, "%s mode made %llu heap allocations while processing frames\n",
+                                modeNames[modes[m]], (unsigned long long) allocs);
+                        allocFailure = true;
+                    }
+
+                    std::vector<uint32_t> latencies;
+                    unsigned int nbFrames = 0, nbFailures = 0;
+
+                    for (unsigned int i = 0; i < nbDevices; i++)
+                    {
+                        latencies.insert(latencies.end(), devices[i]->latencies.begin(), devices[i]->latencies.end());
+                        nbFrames += devices[i]->nbFrames;
+                        nbFailures += devices[i]->nbFailures;
+                    }
+
+                    std::sort(latencies.begin(), latencies.end());
+                    uint32_t p50 = latencies.empty() ? 0 : latencies[(latencies.size() - 1) / 2];
+                    uint32_t p99 = latencies.empty() ? 0 : latencies[((latencies.size() - 1) * 99) / 100];
+                    uint32_t max = latencies.empty() ? 0 : latencies.back();
+                    double fps = seconds > 0 ? nbFrames / seconds : 0;
+
+                    printf("%s,%u,%d,%d,%u,%u,%.6f,%.1f,%.2f,%u,%u,%u,%llu\n",
+                            modeNames[modes[m]], nbDevices, rates[r], gains[g], nbFrames, nbFailures,
+                            seconds, fps, fps / SerialDV::DV_STREAM_FRAMES_PER_SECOND, p50, p99, max,
+                            (unsigned long long) allocs);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < devices.size(); i++)
+    {
+        devices[i]->controller.close();
+        delete devices[i];
+    }
+
+    return allocFailure ? 2 : 0;
+}
@@ -17,168 +17,1321 @@
 #include <cassert>
 #include <cstdio>
 #include <cstring>
-#include <unistd.h>
+#include <ctime>
+#include <chrono>
 #include <stdint.h>
 
 #include "dvcontroller.h"
+#include "serialdatacontroller.h"
+#include "udpdatacontroller.h"
+#include "mockdatacontroller.h"
+#include "samplesconverter.h"
+#include "dvdecodecache.h"
 
 namespace SerialDV
 {
 
 DVController::DVController() :
+        m_dataController(0),
         m_open(false),
-        m_currentRate(DVRateNone),
-        m_currentGainIn(0),
-        m_currentGainOut(0),
-        m_currentNbMbeBits(72),
-        m_currentNbMbeBytes(9)
+        m_nbChannels(1),
+        m_sequence(0),
+        m_nbFramesInFlight(0),
+        m_pipelineDepth(DV_PIPELINE_DEFAULT_DEPTH),
+        m_rxStart(0),
+        m_rxEnd(0),
+        m_responseTimeoutMs(DV_DEFAULT_RESPONSE_TIMEOUT_MS),
+        m_identifyTimeoutMs(DV_DEFAULT_IDENTIFY_TIMEOUT_MS),
+        m_desync(false),
+        m_resetOnResync(false),
+        m_viewHeld(false),
+        m_transactionCallback(0),
+        m_transactionContext(0),
+        m_nbUnwritten(0),
+        m_lastReadUs(0),
+        m_rxFirstByteUs(0),
+        m_packetFirstByteUs(0),
+        m_packetLastByteUs(0),
+        m_completionCallback(0),
+        m_completionContext(0),
+        m_decodeCache(0),
+        m_streaming(false),
+        m_streamStop(false),
+        m_readerStop(false)
 {
-    m_littleEndian = isLittleEndian();
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+    {
+        ChannelState& state = m_channels[channel];
+        state.currentRate = DVRateNone;
+        state.currentGainIn = 0;
+        state.currentGainOut = 0;
+        state.resendGain = false;
+        state.configDirty = false;
+        state.hostGain = 1.0f;
+        state.currentNbMbeBits = 72;
+        state.currentNbMbeBytes = 9;
+        state.audioPacket = state.audioStorage;
+        state.controlFieldsLength = 0;
+    }
+
+    clearPending();
+}
+
+DVController::~DVController()
+{
+    stopStreaming();
+    closeDataController();
+}
+
+bool DVController::open(const std::string& device, bool halfSpeed)
+{
+    return open(device, halfSpeed ? SERIAL_230400 : SERIAL_460800);
+}
+
+bool DVController::open(const std::string& device, SERIAL_SPEED speed)
+{
+    close(); // streaming threads and requests of a previous session go with the previous link
+    m_nbChannels = 1;
+    m_rxStart = 0;
+    m_rxEnd = 0;
+    m_rxFirstByteUs = 0;
+    m_viewHeld = false;
+    m_desync = false;
+    m_productId.clear();
+
+    std::string host;
+    unsigned int port;
+    MockDeviceConfig mockConfig;
+    bool res;
+
+    if (MockDataController::parseDeviceName(device, mockConfig))
+    {
+        MockDataController *mockDataController = new MockDataController();
+        res = mockDataController->open(mockConfig);
+        m_dataController = mockDataController;
+    }
+    else if (UDPDataController::parseDeviceName(device, host, port))
+    {
+        UDPDataController *udpDataController = new UDPDataController();
+        res = udpDataController->open(host, port);
+        m_dataController = udpDataController;
+    }
+    else
+    {
+        SerialDataController *serialDataController = new SerialDataController();
+        res = serialDataController->open(device, speed);
+        m_dataController = serialDataController;
+    }
+
+    if (!res)
+    {
+        delete m_dataController;
+        m_dataController = 0;
+        return false;
+    }
+
+    writePacket(DV3000_REQ_PRODID, DV3000_REQ_PRODID_LEN);
+
+    unsigned char buffer[BUFFER_LENGTH];
+    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH, m_identifyTimeoutMs);
+
+    if (type == RESP_ERROR)
+    {
+        fprintf(stderr, "DVController::open: serial device error\n");
+        closeDataController();
+        return false;
+    }
+    else if (type == RESP_NAME)
+    {
+        std::string name((char *) &buffer[5]);
+        fprintf(stderr, "DVController::open: DV3000 chip identified as: %s\n", name.c_str());
+
+        if (name.compare(0, 8, "AMBE3003") == 0) {
+            m_nbChannels = 3;
+        }
+
+        m_productId = name;
+
+        for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+        {
+            m_channels[channel].currentRate = DVRateNone;
+            m_channels[channel].currentGainIn = 0;
+            m_channels[channel].currentGainOut = 0;
+            m_channels[channel].resendGain = false;
+            m_channels[channel].configDirty = false;
+            m_channels[channel].controlFieldsLength = 0;
+            initPackets(channel);
+        }
+
+        m_open = true;
+        return true;
+    }
+    else
+    {
+        fprintf(stderr, "DVController::open: response mismatch\n");
+        closeDataController();
+        return false;
+    }
+}
+
+bool DVController::setLinkSpeed(unsigned int speed)
+{
+    if (!m_open) {
+        return false;
+    }
+
+    return m_dataController->setSpeed(speed);
+}
+
+void DVController::close()
+{
+    stopStreaming();
+    closeDataController();
+    m_open = false;
+    clearPending();
+}
+
+bool DVController::encode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int channel)
+{
+    if (m_nbFramesInFlight != 0)
+    {
+        fprintf(stderr, "DVController::encode: pipelined requests are in flight\n");
+        return false;
+    }
+
+    if (!submitEncode(audioFrame, mbeFrame, rate, gain, 0, channel)) {
+        return false;
+    }
+
+    DVCompletion completion;
+    return pollCompletion(completion) && completion.ok;
+}
+
+bool DVController::decode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int channel)
+{
+    if (m_nbFramesInFlight != 0)
+    {
+        fprintf(stderr, "DVController::decode: pipelined requests are in flight\n");
+        return false;
+    }
+
+    if (!m_decodeCache)
+    {
+        if (!submitDecode(audioFrame, mbeFrame, rate, gain, 0, channel)) {
+            return false;
+        }
+
+        DVCompletion completion;
+        return pollCompletion(completion) && completion.ok;
+    }
+
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    unsigned char cached[MBE_AUDIO_BLOCK_BYTES];
+
+    if (m_decodeCache->lookup(rate, gain, mbeFrame, cached))
+    {
+        decodeOut(cached, audioFrame, MBE_AUDIO_BLOCK_SIZE, m_channels[channel].hostGain);
+        return true;
+    }
+
+    if (!submitDecode(audioFrame, mbeFrame, rate, gain, 0, channel)) {
+        return false;
+    }
+
+    // the samples are taken in packet order for the cache before the host gain is applied
+    DVCompletion completion;
+    unsigned char *payload;
+    PendingRequest *pending;
+
+    if (!nextCompletion(completion, payload, pending) || !completion.ok) {
+        return false;
+    }
+
+    m_decodeCache->insert(rate, gain, mbeFrame, payload);
+    decodeOut(payload, audioFrame, MBE_AUDIO_BLOCK_SIZE, pending->hostGain);
+    return true;
+}
+
+bool DVController::submitEncode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    ChannelState& state = m_channels[channel];
+
+    if (state.nbFramesInFlight >= m_pipelineDepth) {
+        return false;
+    }
+
+    setEncodeConfig(channel, rate, gain);
+
+    // the packet is built in place after the channel header initialized once
+    unsigned int length = encodeIn(channel, audioFrame, MBE_AUDIO_BLOCK_SIZE, state.audioPacket);
+    submitPacket(channel, RESP_AMBE, tag, 0, mbeFrame, state.audioPacket, length);
+    return true;
+}
+
+bool DVController::submitDecode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    ChannelState& state = m_channels[channel];
+
+    if (state.nbFramesInFlight >= m_pipelineDepth) {
+        return false;
+    }
+
+    setDecodeConfig(channel, rate, gain);
+
+    // the packet is built in place after the channel header set at rate change
+    unsigned int length = decodeIn(channel, mbeFrame, state.currentNbMbeBytes, state.ambePacket);
+    submitPacket(channel, RESP_AUDIO, tag, audioFrame, 0, state.ambePacket, length);
+    return true;
+}
+
+unsigned int DVController::encodeBatch(const short *audioFrames, unsigned int nbFrames, unsigned char *mbeFrames, DVRate rate, int gain, unsigned int channel)
+{
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return 0;
+    }
+
+    if (m_nbFramesInFlight != 0)
+    {
+        fprintf(stderr, "DVController::encodeBatch: pipelined requests are in flight\n");
+        return 0;
+    }
+
+    setEncodeConfig(channel, rate, gain);
+
+    ChannelState& state = m_channels[channel];
+    const unsigned int packetLength = (m_nbChannels > 1 ? DV3003_AUDIO_HEADER_LEN : DV3000_AUDIO_HEADER_LEN) + MBE_AUDIO_BLOCK_BYTES;
+    unsigned char buffer[DV_CONTROL_PACKET_MAX_LENGTH + DV_PIPELINE_MAX_DEPTH * (DV3003_AUDIO_HEADER_LEN + MBE_AUDIO_BLOCK_BYTES)];
+    unsigned int submitted = 0, nbOk = 0;
+    bool failed = false;
+
+    while (true)
+    {
+        // refill the pipeline when half empty with all the packets written in one go
+        if (!failed && (submitted < nbFrames) && (state.nbFramesInFlight <= m_pipelineDepth / 2))
+        {
+            unsigned int length = takeControlPacket(channel, buffer);
+
+            while ((submitted < nbFrames) && (state.nbFramesInFlight < m_pipelineDepth))
+            {
+                length += encodeIn(channel, &audioFrames[submitted * MBE_AUDIO_BLOCK_SIZE], MBE_AUDIO_BLOCK_SIZE, &buffer[length]);
+                pushPending(channel, RESP_AMBE, submitted, 0, &mbeFrames[submitted * state.currentNbMbeBytes]);
+                submitted++;
+            }
+
+            assert(length <= DV_CONTROL_PACKET_MAX_LENGTH + m_pipelineDepth * packetLength);
+            (void) packetLength;
+
+            if (writePacket(buffer, length) < 0) {
+                failed = true;
+            }
+        }
+
+        DVCompletion completion;
+
+        if (!pollCompletion(completion)) {
+            break;
+        }
+
+        if (completion.ok && (completion.tag == nbOk)) {
+            nbOk++;
+        } else {
+            failed = true; // stop submitting and drain what is in flight
+        }
+    }
+
+    return nbOk;
+}
+
+unsigned int DVController::decodeBatch(short *audioFrames, unsigned int nbFrames, const unsigned char *mbeFrames, DVRate rate, int gain, unsigned int channel)
+{
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return 0;
+    }
+
+    if (m_nbFramesInFlight != 0)
+    {
+        fprintf(stderr, "DVController::decodeBatch: pipelined requests are in flight\n");
+        return 0;
+    }
+
+    setDecodeConfig(channel, rate, gain);
+
+    ChannelState& state = m_channels[channel];
+    unsigned char buffer[DV_CONTROL_PACKET_MAX_LENGTH + DV_PIPELINE_MAX_DEPTH * (DV3003_AMBE_HEADER_LEN + MBE_FRAME_MAX_LENGTH_BYTES)];
+    unsigned int submitted = 0, nbOk = 0;
+    bool failed = false;
+
+    while (true)
+    {
+        // refill the pipeline when half empty with all the packets written in one go
+        if (!failed && (submitted < nbFrames) && (state.nbFramesInFlight <= m_pipelineDepth / 2))
+        {
+            unsigned int length = takeControlPacket(channel, buffer);
+
+            while ((submitted < nbFrames) && (state.nbFramesInFlight < m_pipelineDepth))
+            {
+                length += decodeIn(channel, &mbeFrames[submitted * state.currentNbMbeBytes], state.currentNbMbeBytes, &buffer[length]);
+                pushPending(channel, RESP_AUDIO, submitted, &audioFrames[submitted * MBE_AUDIO_BLOCK_SIZE], 0);
+                submitted++;
+            }
+
+            if (writePacket(buffer, length) < 0) {
+                failed = true;
+            }
+        }
+
+        DVCompletion completion;
+
+        if (!pollCompletion(completion)) {
+            break;
+        }
+
+        if (completion.ok && (completion.tag == nbOk)) {
+            nbOk++;
+        } else {
+            failed = true; // stop submitting and drain what is in flight
+        }
+    }
+
+    return nbOk;
+}
+
+void DVController::setEncodeConfig(unsigned int channel, DVRate rate, int gain)
+{
+    ChannelState& state = m_channels[channel];
+    takeInvalidation(state);
+
+    if (rate != state.currentRate)
+    {
+        setRate(channel, rate);
+        state.currentRate = rate;
+    }
+
+    if ((gain != state.currentGainIn) || state.resendGain)
+    {
+        setGain(channel, gain, state.currentGainOut);
+        state.currentGainIn = gain;
+        state.resendGain = false;
+    }
+}
+
+void DVController::setDecodeConfig(unsigned int channel, DVRate rate, int gain)
+{
+    ChannelState& state = m_channels[channel];
+    takeInvalidation(state);
+
+    if (rate != state.currentRate)
+    {
+        setRate(channel, rate);
+        state.currentRate = rate;
+    }
+
+    if ((gain != state.currentGainOut) || state.resendGain)
+    {
+        setGain(channel, state.currentGainIn, gain);
+        state.currentGainOut = gain;
+        state.resendGain = false;
+    }
+}
+
+bool DVController::pollCompletion(DVCompletion& completion)
+{
+    unsigned char *payload;
+    PendingRequest *pending;
+
+    if (m_streaming || !nextCompletion(completion, payload, pending)) {
+        return false;
+    }
+
+    if (completion.ok)
+    {
+        if (completion.encode) {
+            encodeOut(payload, pending->mbeFrame, pending->nbMbeBytes);
+        } else {
+            decodeOut(payload, pending->audioFrame, MBE_AUDIO_BLOCK_SIZE, pending->hostGain);
+        }
+    }
+
+    return true;
+}
+
+bool DVController::pollCompletionView(DVCompletionView& view)
+{
+    if (m_viewHeld)
+    {
+        fprintf(stderr, "DVController::pollCompletionView: previous completion not released\n");
+        return false;
+    }
+
+    if (m_streaming) {
+        return false;
+    }
+
+    DVCompletion completion;
+    unsigned char *payload;
+    PendingRequest *pending;
+
+    if (!nextCompletion(completion, payload, pending)) {
+        return false;
+    }
+
+    view.tag = completion.tag;
+    view.channel = completion.channel;
+    view.encode = completion.encode;
+    view.ok = completion.ok;
+    view.mbeFrame = 0;
+    view.nbMbeBytes = 0;
+    view.audioFrame = 0;
+
+    if (completion.ok)
+    {
+        if (completion.encode)
+        {
+            view.mbeFrame = payload;
+            view.nbMbeBytes = pending->nbMbeBytes;
+        }
+        else
+        {
+            if (((uintptr_t) payload & 1U) != 0) // move samples over the already parsed samples count byte
+            {
+                ::memmove(payload - 1, payload, MBE_AUDIO_BLOCK_BYTES);
+                payload--;
+            }
+
+            decodeOut(payload, (short *) payload, MBE_AUDIO_BLOCK_SIZE, pending->hostGain);
+            view.audioFrame = (const short *) payload;
+        }
+
+        m_viewHeld = true;
+    }
+
+    return true;
+}
+
+void DVController::releaseCompletion()
+{
+    m_viewHeld = false;
+}
+
+short *DVController::acquireEncodeSlot(unsigned int channel)
+{
+    if (!m_open || m_streaming || m_viewHeld || (channel >= m_nbChannels) || (m_channels[channel].nbFramesInFlight >= m_pipelineDepth)) {
+        return 0;
+    }
+
+    const ChannelState& state = m_channels[channel];
+    return (short *) (state.audioPacket + state.audioHeaderLength);
+}
+
+bool DVController::commitEncode(unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    ChannelState& state = m_channels[channel];
+    setEncodeConfig(channel, rate, gain);
+
+    unsigned char *payload = state.audioPacket + state.audioHeaderLength;
+    SamplesConverter::toBigEndian(payload, (const short *) payload, MBE_AUDIO_BLOCK_SIZE);
+    submitPacket(channel, RESP_AMBE, tag, 0, mbeFrame, state.audioPacket, state.audioHeaderLength + MBE_AUDIO_BLOCK_BYTES);
+    return true;
+}
+
+unsigned char *DVController::acquireDecodeSlot(DVRate rate, int gain, unsigned int channel)
+{
+    if (!m_open || m_streaming || m_viewHeld || (channel >= m_nbChannels) || (m_channels[channel].nbFramesInFlight >= m_pipelineDepth)) {
+        return 0;
+    }
+
+    ChannelState& state = m_channels[channel];
+    setDecodeConfig(channel, rate, gain); // sets the AMBE header for the rate
+    return state.ambePacket + state.ambeHeaderLength;
+}
+
+bool DVController::commitDecode(short *audioFrame, unsigned int tag, unsigned int channel)
+{
+    if (!m_open || m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    ChannelState& state = m_channels[channel];
+    submitPacket(channel, RESP_AUDIO, tag, audioFrame, 0, state.ambePacket, state.ambeHeaderLength + state.currentNbMbeBytes);
+    return true;
+}
+
+bool DVController::nextCompletion(DVCompletion& completion, unsigned char*& payload, PendingRequest*& pending)
+{
+    if (m_viewHeld)
+    {
+        fprintf(stderr, "DVController::nextCompletion: completion view not released\n");
+        return false;
+    }
+
+    while (m_streaming ? hasStreamPending() : m_nbFramesInFlight != 0)
+    {
+        // once out of step the requests left are failed without waiting for their replies
+        bool matched = matchReply(m_desync ? 0 : receivePacket(m_responseTimeoutMs), completion, payload, pending);
+
+        if (m_desync && (m_nbFramesInFlight == 0)) {
+            resync(m_resetOnResync);
+        }
+
+        if (matched) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool DVController::matchReply(unsigned char *packet, DVCompletion& completion, unsigned char*& payload, PendingRequest*& pending)
+{
+    RESP_TYPE type = RESP_ERROR;
+    unsigned int channel = 0;
+    unsigned int fieldOffset = DV3000_HEADER_LEN;
+
+    if (!packet)
+    {
+        // nothing came back: give up on the oldest request
+        channel = getOldestPendingChannel();
+    }
+    else
+    {
+        type = getResponseType(packet, channel, fieldOffset);
+
+        if ((channel >= m_nbChannels) || !hasPending(channel))
+        {
+            m_stats.nbUnexpected.add(1);
+            m_desync = !m_streaming;
+            fprintf(stderr, "DVController::matchReply: unexpected packet on channel %u\n", channel);
+            return false;
+        }
+    }
+
+    pending = &popPending(channel);
+
+    if (!packet || (type != pending->expected)) {
+        m_desync = !m_streaming; // late replies would be taken for the next requests
+    }
+
+    bool control = (pending->expected == RESP_RATEP) || (pending->expected == RESP_GAIN);
+    bool ok = (type == pending->expected) && (!control || checkControlReply(packet, fieldOffset));
+
+    if (packet && !ok) {
+        m_stats.nbMismatches.add(1);
+    }
+
+    completeTransaction(channel, *pending, packet != 0, ok);
+
+    if (control)
+    {
+        if (type == RESP_ERROR) {
+            fprintf(stderr, "DVController::matchReply: channel %u: no reply to configuration\n", channel);
+        } else if (!ok) {
+            fprintf(stderr, "DVController::matchReply: channel %u: configuration rejected\n", channel);
+        }
+
+        if (!ok) {
+            invalidateConfig(channel);
+        }
+
+        return false;
+    }
+
+    completion.tag = pending->tag;
+    completion.channel = channel;
+    completion.encode = pending->expected == RESP_AMBE;
+    completion.ok = ok;
+
+    if (!completion.ok) {
+        fprintf(stderr, "DVController::%s: error\n", completion.encode ? "encodeOut" : "decodeOut");
+    }
+
+    // skip CHAND or SPEECHD field identifier and number of bits or samples
+    payload = packet ? packet + fieldOffset + 2 : 0;
+    return true;
+}
+
+bool DVController::submitEncodeAsync(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+        DVCompletionCallback callback, void *context, unsigned int channel)
+{
+    if (!submitEncode(audioFrame, mbeFrame, rate, gain, tag, channel)) {
+        return false;
+    }
+
+    setLastCallback(channel, callback, context);
+    return true;
+}
+
+bool DVController::submitDecodeAsync(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+        DVCompletionCallback callback, void *context, unsigned int channel)
+{
+    if (!submitDecode(audioFrame, mbeFrame, rate, gain, tag, channel)) {
+        return false;
+    }
+
+    setLastCallback(channel, callback, context);
+    return true;
+}
+
+void DVController::setCompletionCallback(DVCompletionCallback callback, void *context)
+{
+    m_completionCallback = callback;
+    m_completionContext = context;
+}
+
+unsigned int DVController::processEvents(unsigned int timeoutUs)
+{
+    if (!m_open || m_streaming || m_viewHeld) {
+        return 0;
+    }
+
+    unsigned int nbCompleted = 0;
+    uint64_t deadline = nowUs() + timeoutUs;
+    DVCompletion completion;
+    unsigned char *payload;
+    PendingRequest *pending;
+
+    while (m_nbFramesInFlight != 0)
+    {
+        bool failed = false;
+        unsigned char *packet = m_desync ? 0 : readPacket(deadline, failed);
+
+        if (!packet && !m_desync)
+        {
+            int channel = getOldestPendingChannel();
+            const ChannelState& state = m_channels[channel];
+
+            if (failed || (nowUs() < state.pending[state.pendingHead].writeEndUs + m_responseTimeoutMs * 1000ULL)) {
+                break; // the oldest request is not overdue yet
+            }
+
+            m_stats.nbTimeouts.add(1);
+            fprintf(stderr, "DVController::processEvents: Timeout on channel %d\n", channel);
+        }
+
+        bool matched = matchReply(packet, completion, payload, pending);
+
+        if (m_desync && (m_nbFramesInFlight == 0)) {
+            resync(m_resetOnResync);
+        }
+
+        if (matched)
+        {
+            if (completion.ok)
+            {
+                if (completion.encode && pending->mbeFrame) {
+                    encodeOut(payload, pending->mbeFrame, pending->nbMbeBytes);
+                } else if (!completion.encode && pending->audioFrame) {
+                    decodeOut(payload, pending->audioFrame, MBE_AUDIO_BLOCK_SIZE, pending->hostGain);
+                }
+            }
+
+            if (pending->callback) {
+                pending->callback(completion, pending->context);
+            } else if (m_completionCallback) {
+                m_completionCallback(completion, m_completionContext);
+            }
+
+            nbCompleted++;
+        }
+
+        deadline = 0; // wait for the first event only then take what has arrived
+    }
+
+    return nbCompleted;
+}
+
+bool DVController::resync(bool resetChip)
+{
+    if (!m_open || m_streaming || m_viewHeld || (m_nbFramesInFlight != 0))
+    {
+        fprintf(stderr, "DVController::resync: requests are in flight\n");
+        return false;
+    }
+
+    m_stats.nbResyncs.add(1);
+
+    // drop what was received then wait for the link to go quiet
+    unsigned int nbFlushed = m_rxEnd - m_rxStart;
+    uint64_t deadline = nowUs() + m_responseTimeoutMs * 1000ULL;
+    int len;
+
+    do
+    {
+        len = m_dataController->readAvailable(m_rxBuffer, DV_RX_BUFFER_LENGTH, DV_RESYNC_QUIET_MS * 1000U);
+
+        if (len > 0)
+        {
+            m_stats.nbReads.add(1);
+            m_stats.nbBytesRead.add(len);
+            nbFlushed += len;
+        }
+    }
+    while ((len > 0) && (nowUs() < deadline));
+
+    m_stats.nbBytesFlushed.add(nbFlushed);
+    m_rxStart = 0;
+    m_rxEnd = 0;
+    m_rxFirstByteUs = 0;
+    m_desync = false;
+    clearPending();
+
+    for (unsigned int channel = 0; channel < m_nbChannels; channel++)
+    {
+        m_channels[channel].controlFieldsLength = 0;
+        invalidateConfig(channel);
+    }
+
+    fprintf(stderr, "DVController::resync: %u stale bytes flushed\n", nbFlushed);
+
+    if (!resetChip) {
+        return true;
+    }
+
+    m_stats.nbResets.add(1);
+    writePacket(DV3000_REQ_RESET, DV3000_REQ_RESET_LEN);
+
+    unsigned char buffer[BUFFER_LENGTH];
+    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH, m_identifyTimeoutMs);
+
+    if (type != RESP_READY)
+    {
+        fprintf(stderr, "DVController::resync: no ready reply after reset\n");
+        return false;
+    }
+
+    return true;
+}
+
+int DVController::getNextTimeoutMs() const
+{
+    int channel = m_streaming ? -1 : getOldestPendingChannel();
+
+    if (channel < 0) {
+        return -1;
+    }
+
+    const ChannelState& state = m_channels[channel];
+    uint64_t overdue = state.pending[state.pendingHead].writeEndUs + m_responseTimeoutMs * 1000ULL;
+    uint64_t now = nowUs();
+
+    return now >= overdue ? 0 : (int) ((overdue - now + 999) / 1000);
+}
+
+void DVController::setLastCallback(unsigned int channel, DVCompletionCallback callback, void *context)
+{
+    ChannelState& state = m_channels[channel];
+    PendingRequest& pending = state.pending[(state.pendingHead + state.pendingCount - 1) % DV_PIPELINE_SLOTS];
+    pending.callback = callback;
+    pending.context = context;
+}
+
+bool DVController::startStreaming()
+{
+    if (!m_open || m_streaming || m_viewHeld) {
+        return false;
+    }
+
+    if (getOldestPendingChannel() >= 0)
+    {
+        fprintf(stderr, "DVController::startStreaming: pipelined requests are in flight\n");
+        return false;
+    }
+
+    m_streamRequests.clear();
+    m_streamCompletions.clear();
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+    {
+        m_streamInFlight[channel].clear();
+        m_streamNbFrames[channel] = 0;
+    }
+
+    m_nbUnwritten = 0;
+    m_streamStop = false;
+    m_readerStop = false;
+    m_streaming = true;
+    m_writerThread = std::thread(&DVController::streamWriter, this);
+    m_readerThread = std::thread(&DVController::streamReader, this);
+    return true;
+}
+
+unsigned int DVController::stopStreaming()
+{
+    if (!m_streaming) {
+        return 0;
+    }
+
+    m_streamStop = true;
+    wakeUp(m_writerWakeup);
+    m_writerThread.join();
+
+    // nothing more is written: the reader drains what is in flight
+    m_readerStop = true;
+    wakeUp(m_readerWakeup);
+    m_readerThread.join();
+
+    unsigned int nbDiscarded = 0;
+    StreamRequest request;
+
+    while (m_streamRequests.pop(request)) {
+        nbDiscarded++;
+    }
+
+    m_streaming = false;
+    return nbDiscarded;
+}
+
+bool DVController::pushEncode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    if (!m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    StreamRequest request;
+    request.encode = true;
+    request.rate = rate;
+    request.gain = gain;
+    request.tag = tag;
+    request.channel = channel;
+    request.audioFrame = 0;
+    request.mbeFrame = mbeFrame;
+    ::memcpy(request.audio, audioFrame, MBE_AUDIO_BLOCK_BYTES);
+
+    if (!m_streamRequests.push(request)) {
+        return false;
+    }
+
+    wakeUp(m_writerWakeup);
+    return true;
+}
+
+bool DVController::pushDecode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    if (!m_streaming || (channel >= m_nbChannels)) {
+        return false;
+    }
+
+    StreamRequest request;
+    request.encode = false;
+    request.rate = rate;
+    request.gain = gain;
+    request.tag = tag;
+    request.channel = channel;
+    request.audioFrame = audioFrame;
+    request.mbeFrame = 0;
+    ::memcpy(request.mbe, mbeFrame, getNbMbeBytes(rate));
+
+    if (!m_streamRequests.push(request)) {
+        return false;
+    }
+
+    wakeUp(m_writerWakeup);
+    return true;
+}
+
+bool DVController::popCompletion(DVCompletion& completion, unsigned int timeoutUs)
+{
+    if (!m_streamCompletions.pop(completion))
+    {
+        if (timeoutUs == 0) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(m_streamMutex);
+        m_completionWakeup.wait_for(lock, std::chrono::microseconds(timeoutUs), [this] { return !m_streamCompletions.empty(); });
+        lock.unlock();
+
+        if (!m_streamCompletions.pop(completion)) {
+            return false;
+        }
+    }
+
+    m_streamNbFrames[completion.channel]--;
+    wakeUp(m_writerWakeup); // room for one more frame on the channel
+    return true;
+}
+
+void DVController::streamWriter()
+{
+    StreamRequest request;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_streamMutex);
+            m_writerWakeup.wait(lock, [this] { return m_streamStop || !m_streamRequests.empty(); });
+        }
+
+        if (m_streamStop) {
+            break;
+        }
+
+        unsigned int channel = m_streamRequests.front()->channel;
+
+        {
+            std::unique_lock<std::mutex> lock(m_streamMutex);
+            m_writerWakeup.wait(lock, [this, channel] { return m_streamStop || (m_streamNbFrames[channel] < m_pipelineDepth); });
+        }
+
+        if (m_streamStop) {
+            break;
+        }
+
+        m_streamRequests.pop(request);
+        ChannelState& state = m_channels[channel];
+
+        if (request.encode)
+        {
+            setEncodeConfig(channel, request.rate, request.gain);
+            unsigned int length = encodeIn(channel, request.audio, MBE_AUDIO_BLOCK_SIZE, state.audioPacket);
+            submitPacket(channel, RESP_AMBE, request.tag, 0, request.mbeFrame, state.audioPacket, length);
+        }
+        else
+        {
+            setDecodeConfig(channel, request.rate, request.gain);
+            unsigned int length = decodeIn(channel, request.mbe, state.currentNbMbeBytes, state.ambePacket);
+            submitPacket(channel, RESP_AUDIO, request.tag, request.audioFrame, 0, state.ambePacket, length);
+        }
+
+        wakeUp(m_readerWakeup);
+    }
 }
 
-DVController::~DVController()
+void DVController::streamReader()
 {
+    DVCompletion completion;
+    unsigned char *payload;
+    PendingRequest *pending;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_streamMutex);
+            m_readerWakeup.wait(lock, [this] { return m_readerStop || hasStreamPending(); });
+        }
+
+        if (!hasStreamPending()) {
+            break; // stopped with nothing in flight
+        }
+
+        if (!nextCompletion(completion, payload, pending)) {
+            continue; // only control replies were pending
+        }
+
+        if (completion.ok)
+        {
+            if (completion.encode) {
+                encodeOut(payload, pending->mbeFrame, pending->nbMbeBytes);
+            } else {
+                decodeOut(payload, pending->audioFrame, MBE_AUDIO_BLOCK_SIZE, pending->hostGain);
+            }
+        }
+
+        // cannot be full as frames cannot be written until their completion is popped
+        m_streamCompletions.push(completion);
+        wakeUp(m_completionWakeup);
+    }
 }
 
-bool DVController::open(const std::string& device, bool halfSpeed)
+void DVController::wakeUp(std::condition_variable& condition)
 {
-    m_open = false;
-    bool res = m_serial.open(device, halfSpeed ? SERIAL_230400 : SERIAL_460800);
+    {
+        std::lock_guard<std::mutex> lock(m_streamMutex); // the waiter is either before its check or waiting
+    }
 
-    if (!res) {
-        return false;
+    condition.notify_all();
+}
+
+void DVController::setPipelineDepth(unsigned int depth)
+{
+    if (depth < 1) {
+        m_pipelineDepth = 1;
+    } else if (depth > DV_PIPELINE_MAX_DEPTH) {
+        m_pipelineDepth = DV_PIPELINE_MAX_DEPTH;
+    } else {
+        m_pipelineDepth = depth;
     }
+}
 
-    m_serial.write(DV3000_REQ_PRODID, DV3000_REQ_PRODID_LEN);
+void DVController::pushPending(unsigned int channel, RESP_TYPE expected, unsigned int tag, short *audioFrame, unsigned char *mbeFrame)
+{
+    ChannelState& state = m_channels[channel];
 
-    unsigned char buffer[BUFFER_LENGTH];
-    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH);
+    if ((expected == RESP_AMBE) || (expected == RESP_AUDIO)) {
+        m_stats.channels[channel].nbSubmitted.add(1);
+    }
 
-    if (type == RESP_ERROR)
+    if (m_streaming) // handed over to the reader thread
     {
-        fprintf(stderr, "DVController::open: serial device error\n");
-        m_serial.close();
-        return false;
+        PendingRequest pending;
+        pending.expected = expected;
+        pending.tag = tag;
+        pending.sequence = m_sequence++;
+        pending.audioFrame = audioFrame;
+        pending.mbeFrame = mbeFrame;
+        pending.nbMbeBytes = state.currentNbMbeBytes;
+        pending.hostGain = state.hostGain;
+        pending.submitUs = nowUs();
+        pending.writeEndUs = pending.submitUs;
+        pending.writeUs = 0;
+        pending.callback = 0;
+        pending.context = 0;
+
+        if ((expected == RESP_AMBE) || (expected == RESP_AUDIO)) {
+            m_streamNbFrames[channel]++;
+        }
+
+        bool pushed = m_streamInFlight[channel].push(pending);
+        assert(pushed);
+        (void) pushed;
+        return;
     }
-    else if (type == RESP_NAME)
-    {
-        std::string name((char *) &buffer[5]);
-        fprintf(stderr, "DVController::open: DV3000 chip identified as: %s\n", name.c_str());
-        m_open = true;
-        return true;
+
+    assert(state.pendingCount < DV_PIPELINE_SLOTS);
+
+    PendingRequest& pending = state.pending[(state.pendingHead + state.pendingCount) % DV_PIPELINE_SLOTS];
+    pending.expected = expected;
+    pending.tag = tag;
+    pending.sequence = m_sequence++;
+    pending.audioFrame = audioFrame;
+    pending.mbeFrame = mbeFrame;
+    pending.nbMbeBytes = state.currentNbMbeBytes;
+    pending.hostGain = state.hostGain;
+    pending.submitUs = nowUs();
+    pending.writeEndUs = pending.submitUs;
+    pending.writeUs = 0;
+    pending.callback = 0;
+    pending.context = 0;
+    state.pendingCount++;
+
+    if (m_nbUnwritten < DV3000_MAX_CHANNELS * DV_PIPELINE_SLOTS) {
+        m_unwritten[m_nbUnwritten++] = &pending;
     }
-    else
+
+    if ((expected == RESP_AMBE) || (expected == RESP_AUDIO))
     {
-        fprintf(stderr, "DVController::open: response mismatch\n");
-        m_serial.close();
-        return false;
+        state.nbFramesInFlight++;
+        m_nbFramesInFlight++;
     }
 }
 
-void DVController::close()
+DVController::PendingRequest& DVController::popPending(unsigned int channel)
 {
-    m_serial.close();
-    m_open = false;
+    if (m_streaming)
+    {
+        m_streamInFlight[channel].pop(m_streamPopped);
+        return m_streamPopped;
+    }
+
+    ChannelState& state = m_channels[channel];
+    assert(state.pendingCount > 0);
+
+    PendingRequest& pending = state.pending[state.pendingHead];
+    state.pendingHead = (state.pendingHead + 1) % DV_PIPELINE_SLOTS;
+    state.pendingCount--;
+
+    if ((pending.expected == RESP_AMBE) || (pending.expected == RESP_AUDIO))
+    {
+        state.nbFramesInFlight--;
+        m_nbFramesInFlight--;
+    }
+
+    return pending; // slot is not reused before the next push
 }
 
-bool DVController::encode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain)
+bool DVController::hasPending(unsigned int channel) const
 {
-	if (!m_open) {
-		return false;
-	}
+    return m_streaming ? !m_streamInFlight[channel].empty() : m_channels[channel].pendingCount != 0;
+}
 
-	if (rate != m_currentRate)
-	{
-	    setRate(rate);
-	    m_currentRate = rate;
-	}
+bool DVController::hasStreamPending() const
+{
+    for (unsigned int channel = 0; channel < m_nbChannels; channel++)
+    {
+        if (!m_streamInFlight[channel].empty()) {
+            return true;
+        }
+    }
 
-	if (gain != m_currentGainIn)
-	{
-	    setGain(gain, m_currentGainOut);
-	    m_currentGainIn = gain;
-	}
+    return false;
+}
 
-	encodeIn(audioFrame, MBE_AUDIO_BLOCK_SIZE);
-	return encodeOut(mbeFrame, m_currentNbMbeBytes);
+int DVController::writePacket(const unsigned char *buffer, unsigned int length)
+{
+    DataBuffer part;
+    part.data = buffer;
+    part.length = length;
+    return writePackets(&part, 1);
 }
 
+int DVController::writePackets(const DataBuffer *buffers, unsigned int nbBuffers)
+{
+    uint64_t start = nowUs();
+    int result = m_dataController->writeGather(buffers, nbBuffers);
+    uint64_t end = nowUs();
+    uint32_t writeUs = (uint32_t) (end - start);
+
+    m_stats.writeTime.add(writeUs);
+    m_stats.nbWrites.add(1);
+
+    if (result > 0) {
+        m_stats.nbBytesWritten.add(result);
+    }
+
+    for (unsigned int i = 0; i < m_nbUnwritten; i++)
+    {
+        m_unwritten[i]->writeEndUs = end;
+        m_unwritten[i]->writeUs = writeUs;
+    }
+
+    m_nbUnwritten = 0;
+    return result;
+}
 
-bool DVController::decode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain)
+void DVController::completeTransaction(unsigned int channel, const PendingRequest& pending, bool received, bool ok)
 {
-	if (!m_open) {
-		return false;
-	}
+    DVTransaction transaction;
+    transaction.operation = pending.expected == RESP_AMBE ? DVOperationEncode : pending.expected == RESP_AUDIO ? DVOperationDecode : DVOperationControl;
+    transaction.channel = channel;
+    transaction.tag = pending.tag;
+    transaction.ok = ok;
+    transaction.writeUs = pending.writeUs;
+    transaction.firstByteUs = 0;
+    transaction.payloadUs = 0;
+    transaction.latencyUs = (uint32_t) (nowUs() - pending.submitUs);
+
+    DVOperationStats& stats = m_stats.operations[transaction.operation];
+
+    if (received)
+    {
+        // the first byte may come with the end of a previous reply read before the write returned
+        transaction.firstByteUs = m_packetFirstByteUs > pending.writeEndUs ? (uint32_t) (m_packetFirstByteUs - pending.writeEndUs) : 0;
+        transaction.payloadUs = (uint32_t) (m_packetLastByteUs - m_packetFirstByteUs);
+        stats.firstByteTime.add(transaction.firstByteUs);
+        stats.payloadTime.add(transaction.payloadUs);
+    }
+
+    if (ok) {
+        stats.nbCompleted.add(1);
+    } else {
+        stats.nbFailed.add(1);
+    }
 
-    if (rate != m_currentRate)
+    stats.latency.add(transaction.latencyUs);
+
+    if (transaction.operation != DVOperationControl)
     {
-        setRate(rate);
-        m_currentRate = rate;
+        DVChannelStats& channelStats = m_stats.channels[channel];
+
+        if (ok) {
+            channelStats.nbCompleted.add(1);
+        } else {
+            channelStats.nbFailed.add(1);
+        }
+
+        channelStats.latency.add(transaction.latencyUs);
     }
 
-    if (gain != m_currentGainOut)
+    if (m_transactionCallback) {
+        m_transactionCallback(transaction, m_transactionContext);
+    }
+}
+
+void DVController::setTransactionCallback(DVTransactionCallback callback, void *context)
+{
+    m_transactionCallback = callback;
+    m_transactionContext = context;
+}
+
+void DVController::clearPending()
+{
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
     {
-        setGain(m_currentGainIn, gain);
-        m_currentGainOut = gain;
+        m_stats.channels[channel].nbFailed.add(m_channels[channel].nbFramesInFlight);
+        m_channels[channel].pendingHead = 0;
+        m_channels[channel].pendingCount = 0;
+        m_channels[channel].nbFramesInFlight = 0;
     }
 
-	decodeIn(mbeFrame, m_currentNbMbeBits, m_currentNbMbeBytes);
-	return decodeOut(audioFrame, MBE_AUDIO_BLOCK_SIZE);
+    m_nbFramesInFlight = 0;
+    m_nbUnwritten = 0;
 }
 
-unsigned short DVController::getNbMbeBytes(DVRate mbeRate)
+void DVController::closeDataController()
 {
-    switch (mbeRate)
+    if (m_dataController)
     {
-    case DVRateNone:
-        return 0;
-    case DVRate3600x2400:
-        return 9;
-        break;
-    case DVRate3600x2450:
-        return 9;
-        break;
-    case DVRate7200x4400:
-        return 18;
-        break;
-    case DVRate2450:
-        return 7;
-        break;
-    case DVRate4400:
-        return 11;
-        break;
-    default:
-        return 0;
+        m_dataController->close();
+        delete m_dataController;
+        m_dataController = 0;
     }
 }
 
-unsigned char DVController::getNbMbeBits(DVRate mbeRate)
+int DVController::getOldestPendingChannel() const
 {
-    switch (mbeRate)
+    int oldest = -1;
+
+    if (m_streaming)
     {
-    case DVRateNone:
-        return 0;
-    case DVRate3600x2400:
-        return 72;
-        break;
-    case DVRate3600x2450:
-        return 72;
-        break;
-    case DVRate7200x4400:
-        return 144;
-        break;
-    case DVRate2450:
-        return 49;
-        break;
-    case DVRate4400:
-        return 88;
-        break;
-    default:
-        return 0;
+        for (unsigned int channel = 0; channel < m_nbChannels; channel++)
+        {
+            const PendingRequest *pending = m_streamInFlight[channel].front();
+
+            if (pending && ((oldest < 0) || (pending->sequence < m_streamInFlight[oldest].front()->sequence))) {
+                oldest = channel;
+            }
+        }
+
+        return oldest;
+    }
+
+    for (unsigned int channel = 0; channel < m_nbChannels; channel++)
+    {
+        const ChannelState& state = m_channels[channel];
+
+        if ((state.pendingCount != 0)
+         && ((oldest < 0) || (state.pending[state.pendingHead].sequence < m_channels[oldest].pending[m_channels[oldest].pendingHead].sequence))) {
+            oldest = channel;
+        }
+    }
+
+    return oldest;
+}
+
+unsigned int DVController::buildControlPacket(unsigned char* buffer, unsigned int channel, const unsigned char* field, unsigned int fieldLength)
+{
+    unsigned int offset = DV3000_HEADER_LEN;
+
+    if (m_nbChannels > 1) {
+        buffer[offset++] = DV3000_CONTROL_CHANNEL0 + channel;
     }
+
+    ::memcpy(&buffer[offset], field, fieldLength);
+    offset += fieldLength;
+
+    buffer[0] = DV3000_START_BYTE;
+    buffer[1] = ((offset - DV3000_HEADER_LEN) >> 8) & 0xFF;
+    buffer[2] = (offset - DV3000_HEADER_LEN) & 0xFF;
+    buffer[3] = DV3000_TYPE_CONTROL;
+
+    return offset;
 }
 
-bool DVController::setGain(char dBGainIn, char dBGainOut)
+bool DVController::setGain(unsigned int channel, char dBGainIn, char dBGainOut)
 {
     if (!m_open) {
         return false;
@@ -196,290 +1349,379 @@ bool DVController::setGain(char dBGainIn, char dBGainOut)
         dBGainOut = 90;
     }
 
-    unsigned char buffer[DV3000_REQ_GAIN_LEN + 2];
-    ::memcpy(buffer, DV3000_REQ_GAIN, DV3000_REQ_GAIN_LEN);
+    unsigned char field[3];
+    field[0] = DV3000_CONTROL_GAIN;
+    field[1] = dBGainIn;
+    field[2] = dBGainOut;
 
-    buffer[DV3000_REQ_GAIN_LEN]   = dBGainIn;
-    buffer[DV3000_REQ_GAIN_LEN+1] = dBGainOut;
+    stageControlField(channel, field, 3);
+    m_stats.channels[channel].nbGainChanges.add(1);
+    return true;
+}
 
-    m_serial.write(buffer, DV3000_REQ_GAIN_LEN + 2);
-    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH);
+void DVController::initPackets(unsigned int channel)
+{
+    ChannelState& state = m_channels[channel];
 
-    if (type == RESP_ERROR)
+    if (m_nbChannels > 1)
     {
-        fprintf(stderr, "DVController::setGain: serial device error\n");
-        return false;
+        state.audioPacket = state.audioStorage + (DV3003_AUDIO_HEADER_LEN & 1);
+        ::memcpy(state.audioPacket, DV3003_AUDIO_HEADER, DV3003_AUDIO_HEADER_LEN);
+        state.audioPacket[4] = DV3000_CONTROL_CHANNEL0 + channel;
+        state.audioHeaderLength = DV3003_AUDIO_HEADER_LEN;
+        state.ambeHeaderLength = DV3003_AMBE_HEADER_LEN;
     }
-    else if (type == RESP_GAIN)
+    else
     {
-        fprintf(stderr, "DVController::setGain: in: %d dB out: %d dB: OK\n", (int) dBGainIn, (int) dBGainOut);
-        return true;
+        state.audioPacket = state.audioStorage + (DV3000_AUDIO_HEADER_LEN & 1);
+        ::memcpy(state.audioPacket, DV3000_AUDIO_HEADER, DV3000_AUDIO_HEADER_LEN);
+        state.audioHeaderLength = DV3000_AUDIO_HEADER_LEN;
+        state.ambeHeaderLength = DV3000_AMBE_HEADER_LEN;
+    }
+
+    setAmbeHeader(channel, getRateInfo(DVRate3600x2400)); // until a rate is set
+}
+
+void DVController::setAmbeHeader(unsigned int channel, const DVRateInfo& rateInfo)
+{
+    ChannelState& state = m_channels[channel];
+    state.currentNbMbeBits = rateInfo.nbMbeBits;
+    state.currentNbMbeBytes = rateInfo.nbMbeBytes;
+
+    if (m_nbChannels > 1)
+    {
+        ::memcpy(state.ambePacket, rateInfo.dv3003AmbeHeader, DV3003_AMBE_HEADER_LEN);
+        state.ambePacket[4] = DV3000_CONTROL_CHANNEL0 + channel;
     }
     else
     {
-        fprintf(stderr, "DVController::setGain: response mismatch\n");
-        return false;
+        ::memcpy(state.ambePacket, rateInfo.dv3000AmbeHeader, DV3000_AMBE_HEADER_LEN);
     }
 }
 
-void DVController::encodeIn(const short* audio, unsigned int length __attribute__((unused)))
+unsigned int DVController::encodeIn(unsigned int channel, const short* audio, unsigned int length __attribute__((unused)), unsigned char* buffer)
 {
     assert(audio != 0);
     assert(length == MBE_AUDIO_BLOCK_SIZE);
 
-    // TODO: optimization with fixed initialization of the audio header
-    unsigned char buffer[DV3000_AUDIO_HEADER_LEN + MBE_AUDIO_BLOCK_BYTES];
-
-    ::memcpy(buffer, DV3000_AUDIO_HEADER, DV3000_AUDIO_HEADER_LEN);
+    const ChannelState& state = m_channels[channel];
 
-    uint8_t* q = (uint8_t*) (buffer + DV3000_AUDIO_HEADER_LEN);
-
-    for (unsigned int i = 0; i < MBE_AUDIO_BLOCK_SIZE; i++, q += 2U)
-    {
-        q[0U] = (audio[i] & 0xFF00) >> 8;
-        q[1U] = (audio[i] & 0x00FF) >> 0;
+    if (buffer != state.audioPacket) {
+        ::memcpy(buffer, state.audioPacket, state.audioHeaderLength);
     }
 
-    m_serial.write(buffer, DV3000_AUDIO_HEADER_LEN + MBE_AUDIO_BLOCK_BYTES);
+    SamplesConverter::toBigEndian(buffer + state.audioHeaderLength, audio, MBE_AUDIO_BLOCK_SIZE);
+
+    return state.audioHeaderLength + MBE_AUDIO_BLOCK_BYTES;
 }
 
-bool DVController::encodeOut(unsigned char* ambe, unsigned int length)
+void DVController::encodeOut(const unsigned char* payload, unsigned char* ambe, unsigned int length)
 {
     assert(ambe != 0);
-    assert(length == m_currentNbMbeBytes);
-
-    unsigned char buffer[BUFFER_LENGTH];
-    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH);
-
-    if (type != RESP_AMBE)
-    {
-        fprintf(stderr, "DVController::encodeOut: error\n");
-        return false;
-    }
-
-    ::memcpy(ambe, buffer + DV3000_AMBE_HEADER_LEN, length);
+    assert(length <= MBE_FRAME_MAX_LENGTH_BYTES);
 
-    return true;
+    ::memcpy(ambe, payload, length);
 }
 
-void DVController::decodeIn(const unsigned char* ambe, unsigned char nbBits, unsigned short nbBytes)
+unsigned int DVController::decodeIn(unsigned int channel, const unsigned char* ambe, unsigned short nbBytes, unsigned char* buffer)
 {
     assert(ambe != 0);
-    assert(nbBytes == m_currentNbMbeBytes);
-    unsigned short length = nbBytes + 2;
-    unsigned char *lengthPtr = (unsigned char *) &length;
+    assert(nbBytes == m_channels[channel].currentNbMbeBytes);
 
-    unsigned char buffer[DV3000_AMBE_HEADER_LEN + MBE_FRAME_MAX_LENGTH_BYTES];
-    ::memcpy(buffer, DV3000_AMBE_HEADER, DV3000_AMBE_HEADER_LEN);
-    ::memcpy(buffer + DV3000_AMBE_HEADER_LEN, ambe, nbBytes);
+    const ChannelState& state = m_channels[channel];
 
-    if (m_littleEndian)
-    {
-        ::memcpy(&buffer[1], &lengthPtr[1], 1); // set header length field with little endian byte order
-        ::memcpy(&buffer[2], &lengthPtr[0], 1); // set header length field with little endian byte order
-    }
-    else
-    {
-        ::memcpy(&buffer[1], &lengthPtr[0], 1); // set header length field with big endian byte order
-        ::memcpy(&buffer[2], &lengthPtr[1], 1); // set header length field with big endian byte order
+    if (buffer != state.ambePacket) {
+        ::memcpy(buffer, state.ambePacket, state.ambeHeaderLength);
     }
 
-    ::memcpy(&buffer[5], &nbBits, 1); // set CHAND number of bits
+    ::memcpy(buffer + state.ambeHeaderLength, ambe, nbBytes);
 
-    m_serial.write(buffer, DV3000_AMBE_HEADER_LEN + nbBytes);
+    return state.ambeHeaderLength + nbBytes;
 }
 
-bool DVController::decodeOut(short* audio, unsigned int length __attribute__((unused)))
+void DVController::decodeOut(const unsigned char* payload, short* audio, unsigned int length __attribute__((unused)), float hostGain)
 {
     assert(audio != 0);
     assert(length == MBE_AUDIO_BLOCK_SIZE);
 
-    unsigned char buffer[BUFFER_LENGTH];
-    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH);
+    if (hostGain == 1.0f) {
+        SamplesConverter::fromBigEndian(audio, payload, MBE_AUDIO_BLOCK_SIZE);
+    } else {
+        SamplesConverter::fromBigEndian(audio, payload, MBE_AUDIO_BLOCK_SIZE, hostGain);
+    }
+}
 
-    if (type != RESP_AUDIO)
+void DVController::invalidateConfig(unsigned int channel)
+{
+    // in streaming mode this comes from the reader thread: the writer thread applies it
+    m_channels[channel].configDirty.store(true, std::memory_order_release);
+}
+
+void DVController::takeInvalidation(ChannelState& state)
+{
+    if (state.configDirty.load(std::memory_order_relaxed) && state.configDirty.exchange(false, std::memory_order_acquire))
     {
-        fprintf(stderr, "DVController::decodeOut: error\n");
+        state.currentRate = DVRateNone;
+        state.resendGain = true;
+    }
+}
+
+bool DVController::setRate(unsigned int channel, DVRate rate)
+{
+    if (!m_open) {
         return false;
     }
 
-    uint8_t* q = (uint8_t*) (buffer + DV3000_AUDIO_HEADER_LEN);
+    const DVRateInfo& rateInfo = getRateInfo(rate);
 
-    for (unsigned int i = 0U; i < MBE_AUDIO_BLOCK_SIZE; i++, q += 2U)
-    {
-        short word = (q[0] << 8) | (q[1U] << 0);
-        audio[i] = word;
+    if (rateInfo.nbMbeBits == 0) {
+        return true; // DVRateNone or not supported
     }
 
+    setAmbeHeader(channel, rateInfo);
+
+    // RATEP table entries are complete packets: keep the control field and its data
+    stageControlField(channel, &rateInfo.ratep[DV3000_HEADER_LEN], DV3000_REQ_RATEP_LEN - DV3000_HEADER_LEN);
+    m_stats.channels[channel].nbRateChanges.add(1);
     return true;
 }
 
-bool DVController::setRate(DVRate rate)
+void DVController::stageControlField(unsigned int channel, const unsigned char *field, unsigned int fieldLength)
 {
-    if (!m_open) {
-        return false;
-    }
+    ChannelState& state = m_channels[channel];
+    unsigned int offset = 0;
 
-    if (rate == DVRateNone) {
-        return true;
+    // a field already staged is updated in place
+    while ((offset < state.controlFieldsLength) && (state.controlFields[offset] != field[0])) {
+        offset += getControlFieldLength(state.controlFields[offset]);
     }
 
-    const unsigned char *ratepStr;
+    assert(offset + fieldLength <= DV_CONTROL_FIELDS_LENGTH);
+    ::memcpy(&state.controlFields[offset], field, fieldLength);
 
-    switch(rate)
-    {
-    case DVRateNone:
-        return true;
-    case DVRate3600x2400:
-        ratepStr = DV3000_REQ_3600X2400_RATEP;
-        m_currentNbMbeBits = 72;
-        m_currentNbMbeBytes = 9;
-        break;
-    case DVRate3600x2450:
-        ratepStr = DV3000_REQ_3600X2450_RATEP;
-        m_currentNbMbeBits = 72;
-        m_currentNbMbeBytes = 9;
-        break;
-    case DVRate7200x4400:
-        ratepStr = DV3000_REQ_7200X4400_3_RATEP; // AMBE 3000 version
-        m_currentNbMbeBits = 144;
-        m_currentNbMbeBytes = 18;
-        break;
-    case DVRate2450:
-        ratepStr = DV3000_REQ_2450_RATEP;
-        m_currentNbMbeBits = 49;
-        m_currentNbMbeBytes = 7;
-        break;
-    case DVRate4400:
-        ratepStr = DV3000_REQ_4400_RATEP;
-        m_currentNbMbeBits = 88;
-        m_currentNbMbeBytes = 11;
-        break;
-    default:
-        return true;
+    if (offset == state.controlFieldsLength) {
+        state.controlFieldsLength += fieldLength;
     }
+}
 
-    m_serial.write(ratepStr, DV3000_REQ_RATEP_LEN);
+unsigned int DVController::takeControlPacket(unsigned int channel, unsigned char *buffer)
+{
+    ChannelState& state = m_channels[channel];
 
-    unsigned char buffer[BUFFER_LENGTH];
-    RESP_TYPE type = getResponse(buffer, BUFFER_LENGTH);
+    if (state.controlFieldsLength == 0) {
+        return 0;
+    }
 
-    if (type == RESP_ERROR)
+    unsigned int length = buildControlPacket(buffer, channel, state.controlFields, state.controlFieldsLength);
+    pushPending(channel, state.controlFields[0] == DV3000_CONTROL_RATEP ? RESP_RATEP : RESP_GAIN, 0, 0, 0);
+    state.controlFieldsLength = 0;
+    return length;
+}
+
+int DVController::submitPacket(unsigned int channel, RESP_TYPE expected, unsigned int tag, short *audioFrame, unsigned char *mbeFrame,
+        const unsigned char *packet, unsigned int length)
+{
+    if (m_channels[channel].controlFieldsLength == 0)
     {
-        fprintf(stderr, "DVController::setRate: serial device error\n");
-        return false;
+        pushPending(channel, expected, tag, audioFrame, mbeFrame);
+        return writePacket(packet, length);
     }
-    else if (type == RESP_RATEP)
-    {
-        fprintf(stderr, "DVController::setRate (%d): OK\n", (int) rate);
-        return true;
+
+    // configuration changes go in the same write just before the packet
+    unsigned char controlPacket[DV_CONTROL_PACKET_MAX_LENGTH];
+    DataBuffer parts[2];
+    parts[0].data = controlPacket;
+    parts[0].length = takeControlPacket(channel, controlPacket);
+    parts[1].data = packet;
+    parts[1].length = length;
+    pushPending(channel, expected, tag, audioFrame, mbeFrame);
+    return writePackets(parts, 2);
+}
+
+unsigned int DVController::getControlFieldLength(unsigned char field)
+{
+    if (field == DV3000_CONTROL_RATEP) {
+        return DV3000_REQ_RATEP_LEN - DV3000_HEADER_LEN;
+    } else if (field == DV3000_CONTROL_GAIN) {
+        return 3;
+    } else {
+        return 1;
     }
-    else
+}
+
+bool DVController::checkControlReply(const unsigned char *packet, unsigned int fieldOffset)
+{
+    unsigned int packetLength = DV3000_HEADER_LEN + packet[1] * 256 + packet[2];
+
+    // each RATEP or GAIN field is answered with its identifier and a status byte
+    while ((fieldOffset + 1 < packetLength)
+        && ((packet[fieldOffset] == DV3000_CONTROL_RATEP) || (packet[fieldOffset] == DV3000_CONTROL_GAIN)))
     {
-        fprintf(stderr, "DVController::setRate: response mismatch\n");
-        return false;
+        if (packet[fieldOffset + 1] != 0x00U) {
+            return false;
+        }
+
+        fieldOffset += 2;
     }
 
+    return true;
 }
 
-DVController::RESP_TYPE DVController::getResponse(unsigned char* buffer, unsigned int length __attribute__((unused)))
+DVController::RESP_TYPE DVController::getResponse(unsigned char* buffer, unsigned int length __attribute__((unused)), unsigned int timeoutMs)
 {
     assert(buffer != 0);
     assert(length >= BUFFER_LENGTH);
 
-    bool found = false;
-    int packetLength, offset;
-    unsigned char packetType;
+    unsigned char *packet = receivePacket(timeoutMs);
 
-    for (int i = 0; i < 2000; i++)
-    {
-        int len1 = m_serial.read(buffer, 1U);
+    if (!packet) {
+        return RESP_ERROR;
+    }
 
-        if (len1 < 0)
-        {
-            fprintf(stderr, "DVController::getResponse: Error (start byte)\n");
-            return RESP_ERROR;
-        }
-        else if ((len1 == 1) && (buffer[0U] == DV3000_START_BYTE))
-        {
-            found = true;
-            break;
-        }
+    ::memcpy(buffer, packet, DV3000_HEADER_LEN + packet[1] * 256 + packet[2]);
 
-        usleep(100UL);
-    }
+    unsigned int channel, fieldOffset;
+    return getResponseType(buffer, channel, fieldOffset);
+}
+
+unsigned char *DVController::receivePacket(unsigned int timeoutMs)
+{
+    bool failed;
+    unsigned char *packet = readPacket(nowUs() + timeoutMs * 1000ULL, failed);
 
-    if (!found)
+    if (!packet && !failed)
     {
-        fprintf(stderr, "DVController::getResponse: Timeout (start byte)\n");
-        return RESP_ERROR;
+        m_stats.nbTimeouts.add(1);
+
+        if (m_rxStart == m_rxEnd) {
+            fprintf(stderr, "DVController::receivePacket: Timeout (start byte)\n");
+        } else {
+            fprintf(stderr, "DVController::receivePacket: Timeout (packet payload after %u bytes)\n", m_rxEnd - m_rxStart);
+        }
     }
 
-    packetLength = 3;
-    offset = 0;
-    found = false;
+    return packet;
+}
+
+unsigned char *DVController::readPacket(uint64_t deadlineUs, bool& failed)
+{
+    bool read = false;
+    failed = false;
 
-    for (int i = 0; i < 2000; i++)
+    while (true)
     {
-        int len1 = m_serial.read(&buffer[1 + offset], packetLength - offset);
+        unsigned char *packet = extractPacket();
 
-        if (len1 < 0)
+        if (packet)
         {
-            fprintf(stderr, "DVController::getResponse: Error (packet header at %d)\n", offset);
-            return RESP_ERROR;
+            m_stats.nbPackets.add(1);
+            m_packetFirstByteUs = m_rxFirstByteUs ? m_rxFirstByteUs : m_lastReadUs;
+            m_packetLastByteUs = m_lastReadUs;
+            m_rxFirstByteUs = m_rxStart < m_rxEnd ? m_lastReadUs : 0; // next packet started in the same read
+            return packet;
+        }
+
+        uint64_t now = nowUs();
+
+        if (read && (now >= deadlineUs)) {
+            return 0;
         }
-        else if (offset + len1 == packetLength)
+
+        if (m_rxStart == m_rxEnd)
         {
-            found = true;
-            break;
+            m_rxStart = 0;
+            m_rxEnd = 0;
         }
-        else
+        else if (DV_RX_BUFFER_LENGTH - m_rxEnd < BUFFER_LENGTH) // make room for at least one more packet
         {
-            offset += len1;
+            ::memmove(m_rxBuffer, &m_rxBuffer[m_rxStart], m_rxEnd - m_rxStart);
+            m_rxEnd -= m_rxStart;
+            m_rxStart = 0;
         }
 
-        usleep(100UL);
-    }
-
-    if (!found)
-    {
-        fprintf(stderr, "DVController::getResponse: Timeout (packet header)\n");
-        return RESP_ERROR;
-    }
+        int len = m_dataController->readAvailable(&m_rxBuffer[m_rxEnd], DV_RX_BUFFER_LENGTH - m_rxEnd, now < deadlineUs ? (unsigned int) (deadlineUs - now) : 0);
+        read = true;
 
-    packetLength = buffer[1] * 256 + buffer[2];
-    packetType = buffer[3];
-    offset = 0;
-    found = false;
+        if (len < 0)
+        {
+            fprintf(stderr, "DVController::readPacket: Error reading from device\n");
+            failed = true;
+            return 0;
+        }
 
-    for (int i = 0; i < 2000; i++)
-    {
-        int len1 = m_serial.read(&buffer[4 + offset], packetLength - offset);
+        m_stats.nbReads.add(1);
 
-        if (len1 < 0)
+        if (len > 0)
         {
-            fprintf(stderr, "DVController::getResponse: Error (packet payload at %d)\n", offset);
-            return RESP_ERROR;
+            m_lastReadUs = nowUs();
+            m_stats.nbBytesRead.add(len);
+
+            if (m_rxFirstByteUs == 0) {
+                m_rxFirstByteUs = m_lastReadUs;
+            }
         }
-        else if (offset + len1 == packetLength)
+
+        m_rxEnd += len;
+    }
+}
+
+unsigned char *DVController::extractPacket()
+{
+    while (m_rxStart < m_rxEnd)
+    {
+        if (m_rxBuffer[m_rxStart] != DV3000_START_BYTE)
         {
-            found = true;
-            break;
+            m_rxStart++; // skip garbage until next start byte
+            continue;
         }
-        else
+
+        if (m_rxEnd - m_rxStart < DV3000_HEADER_LEN) {
+            return 0;
+        }
+
+        unsigned int packetLength = DV3000_HEADER_LEN + m_rxBuffer[m_rxStart + 1] * 256 + m_rxBuffer[m_rxStart + 2];
+
+        if (packetLength > BUFFER_LENGTH)
         {
-            offset += len1;
+            fprintf(stderr, "DVController::extractPacket: invalid packet length %u\n", packetLength);
+            m_rxStart++; // not a real start byte
+            continue;
         }
 
-        usleep(100UL);
-    }
+        if (m_rxEnd - m_rxStart < packetLength) {
+            return 0;
+        }
 
-    if (!found) {
-        fprintf(stderr, "DVController::getResponse: Timeout (packet payload)\n");
-        return RESP_ERROR;
+        unsigned char *packet = &m_rxBuffer[m_rxStart];
+        m_rxStart += packetLength;
+        return packet;
     }
 
-    //fprintf(stderr, "DVController::getResponse: packet type %02x\n", packetType);
+    return 0;
+}
+
+DVController::RESP_TYPE DVController::getResponseType(const unsigned char* buffer, unsigned int& channel, unsigned int& fieldOffset) const
+{
+    unsigned char packetType = buffer[3];
+    unsigned int packetLength = DV3000_HEADER_LEN + buffer[1] * 256 + buffer[2];
+    channel = 0;
+    fieldOffset = DV3000_HEADER_LEN;
+
+    //fprintf(stderr, "DVController::getResponseType: packet type %02x\n", packetType);
+
+    if ((m_nbChannels > 1)
+     && (fieldOffset < packetLength)
+     && (buffer[fieldOffset] >= DV3000_CONTROL_CHANNEL0)
+     && (buffer[fieldOffset] < DV3000_CONTROL_CHANNEL0 + DV3000_MAX_CHANNELS))
+    {
+        channel = buffer[fieldOffset] - DV3000_CONTROL_CHANNEL0;
+        fieldOffset++;
+
+        // the reply to the channel field of a control packet carries a status byte
+        if ((packetType == DV3000_TYPE_CONTROL) && (fieldOffset < packetLength) && (buffer[fieldOffset] == 0x00U)) {
+            fieldOffset++;
+        }
+    }
 
     if (packetType == DV3000_TYPE_AUDIO)
     {
@@ -489,25 +1731,25 @@ DVController::RESP_TYPE DVController::getResponse(unsigned char* buffer, unsigne
     {
         return RESP_AMBE;
     }
-    else if (packetType == DV3000_TYPE_CONTROL) // check the field type buffer[4]
+    else if (packetType == DV3000_TYPE_CONTROL) // check the field type
     {
-        //fprintf(stderr, "DVController::getResponse: field type %02x\n", buffer[4]);
+        //fprintf(stderr, "DVController::getResponseType: field type %02x\n", buffer[fieldOffset]);
 
-        if (buffer[4] == DV3000_CONTROL_PRODID)
+        if (buffer[fieldOffset] == DV3000_CONTROL_PRODID)
         {
             return RESP_NAME;
         }
-        else if (buffer[4] == DV3000_CONTROL_RATEP)
+        else if (buffer[fieldOffset] == DV3000_CONTROL_RATEP)
         {
             return RESP_RATEP;
         }
-        else if (buffer[4] == DV3000_CONTROL_GAIN)
+        else if (buffer[fieldOffset] == DV3000_CONTROL_GAIN)
         {
             return RESP_GAIN;
         }
-        else if (buffer[4] == DV3000_CONTROL_READY)
+        else if (buffer[fieldOffset] == DV3000_CONTROL_READY)
         {
-            return RESP_UNKNOWN;
+            return RESP_READY;
         }
         else
         {
@@ -520,5 +1762,12 @@ DVController::RESP_TYPE DVController::getResponse(unsigned char* buffer, unsigne
     }
 }
 
+uint64_t DVController::nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 } // namespace SerialDV
 
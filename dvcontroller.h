@@ -18,23 +18,60 @@
 #define DVCONTROLLER_H_
 
 #include <string>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
+#include "datacontroller.h"
 #include "serialdatacontroller.h"
+#include "dvstats.h"
+#include "dvspscqueue.h"
+#include "dvrate.h"
 
 namespace SerialDV
 {
 
-typedef enum
+const unsigned int DV_PIPELINE_MAX_DEPTH = 16U; //!< Maximum number of audio or AMBE frames in flight
+const unsigned int DV_PIPELINE_DEFAULT_DEPTH = 2U;
+const unsigned int DV_PIPELINE_SLOTS = 3U * DV_PIPELINE_MAX_DEPTH; //!< Frames plus a possible RATEP and GAIN reply for each
+
+const unsigned int DV_CONTROL_FIELDS_LENGTH = DV3000_REQ_RATEP_LEN - DV3000_HEADER_LEN + 3U; //!< RATEP and GAIN fields
+const unsigned int DV_CONTROL_PACKET_MAX_LENGTH = DV3000_HEADER_LEN + 1U + DV_CONTROL_FIELDS_LENGTH; //!< With channel field
+const unsigned int DV_RX_BUFFER_LENGTH = 8192U;           //!< Receive buffer holding several replies
+const unsigned int DV_STREAM_QUEUE_LENGTH = 64U;           //!< Frames queued for the streaming writer thread plus one
+const unsigned int DV_DEFAULT_RESPONSE_TIMEOUT_MS = 200U; //!< Default time to wait for a complete reply
+const unsigned int DV_DEFAULT_IDENTIFY_TIMEOUT_MS = 200U; //!< Default time to wait for the product identification at opening
+const unsigned int DV_RESYNC_QUIET_MS = 10U;              //!< Silence on the link after which stale replies are considered flushed
+
+/** Completion of a request submitted with DVController::submitEncode() or DVController::submitDecode()
+ */
+struct DVCompletion
 {
-    DVRateNone,
-    DVRate3600x2400, //!< D-Star
-    DVRate3600x2450, //!< DMR, dPMR, YSF V/D type 1
-    DVRate7200x4400,
-    DVRate7100x4400,
-    DVRate2400,
-    DVRate2450,      //!< YSF V/D type 2 (does not use FEC in AMBE codec)
-    DVRate4400
-} DVRate;
+    unsigned int tag;     //!< Tag given by the caller at submission
+    unsigned int channel; //!< Vocoder channel the request was submitted to
+    bool encode;          //!< True if this completes an encode request false for a decode request
+    bool ok;              //!< True if the reply has been received and copied to the caller's buffer
+};
+
+/** Completion handed back by DVController::pollCompletionView(). The data points into the
+ * controller receive buffer and remains valid until DVController::releaseCompletion() is called.
+ */
+struct DVCompletionView
+{
+    unsigned int tag;          //!< Tag given by the caller at submission
+    unsigned int channel;      //!< Vocoder channel the request was submitted to
+    bool encode;               //!< True if this completes an encode request false for a decode request
+    bool ok;                   //!< True if the reply has been received
+    const unsigned char *mbeFrame; //!< AMBE frame of an encode request
+    unsigned int nbMbeBytes;       //!< Number of bytes of the AMBE frame
+    const short *audioFrame;       //!< MBE_AUDIO_BLOCK_SIZE host order samples of a decode request
+};
+
+typedef void (*DVCompletionCallback)(const DVCompletion& completion, void *context);
+
+class DVDecodeCache;
 
 class DVController
 {
@@ -42,10 +79,47 @@ public:
 	DVController();
 	~DVController();
 
+    /** Opens the device. This is either a serial device e.g. /dev/ttyUSB0 or an AMBEserver
+     * network device in the form udp://host:port
+     * The packets and the requests in flight live in fixed pools of the controller (DV_PIPELINE_SLOTS
+     * per channel) so that once the device is open encoding and decoding never allocate memory.
+     * Only startStreaming() does to create its threads.
+     */
     bool open(const std::string& device, bool halfSpeed=false);
+
+    /** Opens the device at the given serial speed. It can also be a custom speed in bauds
+     * cast to SERIAL_SPEED. The speed is ignored for network devices.
+     */
+    bool open(const std::string& device, SERIAL_SPEED speed);
+
+    /** Changes the serial link speed after the device has been identified. The device UART must
+     * follow: the AMBE3000 packet protocol has no command to change it so this is for adapters
+     * whose UART speed is set independently of the host side (e.g. by straps or firmware).
+     */
+    bool setLinkSpeed(unsigned int speed);
+
+    /** Serial link speed in bauds or 0 for network devices */
+    unsigned int getLinkSpeed() const { return m_dataController ? m_dataController->getSpeed() : 0; }
     void close();
     bool isOpen() const { return m_open; }
 
+    /** Number of vocoder channels of the device: 3 for an AMBE3003 (DV3003) else 1 */
+    unsigned int getNbChannels() const { return m_nbChannels; }
+
+    /** Configuration of a channel as of the last request submitted on it */
+    DVRate getChannelRate(unsigned int channel) const { return channel < m_nbChannels ? m_channels[channel].currentRate : DVRateNone; }
+    int getChannelGainIn(unsigned int channel) const { return channel < m_nbChannels ? m_channels[channel].currentGainIn : 0; }
+    int getChannelGainOut(unsigned int channel) const { return channel < m_nbChannels ? m_channels[channel].currentGainOut : 0; }
+
+    /** Linear gain applied by the host to the decoded samples of the channel while converting them
+     * from the packet byte order (1.0 by default). Unlike the decoder gain of the chip it is fractional,
+     * costs no GAIN packet when it changes and applies to the requests submitted after it is set so that
+     * it can change with every frame e.g. for per stream volume on a shared channel. In streaming mode
+     * it is set before starting. Samples are saturated.
+     */
+    void setHostGain(unsigned int channel, float gain) { if (channel < DV3000_MAX_CHANNELS) { m_channels[channel].hostGain = gain; } }
+    float getHostGain(unsigned int channel) const { return channel < DV3000_MAX_CHANNELS ? m_channels[channel].hostGain : 1.0f; }
+
 	/** Encoding process of one audio frame to one AMBE frame
 	 * Buffers are supposed to be allocated with the correct size. That is
 	 * - 320 bytes (160 short samples) for the audio frame.
@@ -53,8 +127,9 @@ public:
 	 *   - SerialDV::MBE_AUDIO_BLOCK_SIZE constant is the number of short samples (160)
 	 * - 9 or 18 bytes (72 or 144 bits) for the AMBE frame.
 	 *   - SerialDV::VOICE_FRAME_MAX_LENGTH_BYTES constant is the maximum number of bytes (18)
+	 * The channel is the vocoder channel to use from 0 to getNbChannels() - 1
 	 */
-	bool encode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain = 0);
+	bool encode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain = 0, unsigned int channel = 0);
 
 	/** Encoding process of one AMBE frame to one audio frame
 	 * Buffers are supposed to be allocated with the correct size. That is
@@ -63,16 +138,174 @@ public:
 	 *   - SerialDV::MBE_AUDIO_BLOCK_SIZE constant is the number of short samples (160)
 	 * - 9 or 18 bytes (72 or 144 bits) for the AMBE frame.
      *   - SerialDV::VOICE_FRAME_MAX_LENGTH_BYTES constant is the maximum number of bytes (18)
+	 * The channel is the vocoder channel to use from 0 to getNbChannels() - 1
+	 * With a decode cache set frames already decoded are answered from it without a device round trip.
 	 */
-	bool decode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain = 0);
+	bool decode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain = 0, unsigned int channel = 0);
+
+    /** Cache of decoded frames used by decode() or 0 for none (default). It is not owned */
+    void setDecodeCache(DVDecodeCache *cache) { m_decodeCache = cache; }
+    DVDecodeCache *getDecodeCache() const { return m_decodeCache; }
+
+    /** Pipelined encoding: queues one audio frame for encoding without waiting for the reply.
+     * The output buffer must remain valid until the matching completion is returned by pollCompletion().
+     * Returns false if the device is not open or the pipeline of the channel is full in which case
+     * pollCompletion() must be called first.
+     * Each channel has its own rate, gain and pipeline so requests on the channels of an AMBE3003
+     * are interleaved on the serial link and processed at the same time.
+     */
+    bool submitEncode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+
+    /** Pipelined decoding: queues one AMBE frame for decoding without waiting for the reply.
+     * Same rules as submitEncode() apply.
+     */
+    bool submitDecode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+
+    /** Waits for the next pipelined request to complete. Replies come back in submission order
+     * within a channel but channels may complete in any order.
+     * Returns false if there is no request in flight.
+     */
+    bool pollCompletion(DVCompletion& completion);
+
+    /** Encodes nbFrames contiguous audio frames into nbFrames contiguous AMBE frames of
+     * getNbMbeBytes(rate) bytes each. Packets are built in one buffer and written to the device
+     * with one system call per pipeline refill. Replies are collected in order.
+     * No pipelined request must be in flight. Stops at the first failed frame.
+     * Returns the number of frames successfully encoded.
+     */
+    unsigned int encodeBatch(const short *audioFrames, unsigned int nbFrames, unsigned char *mbeFrames, DVRate rate, int gain = 0, unsigned int channel = 0);
+
+    /** Decodes nbFrames contiguous AMBE frames into nbFrames contiguous audio frames.
+     * Same rules as encodeBatch() apply.
+     * Returns the number of frames successfully decoded.
+     */
+    unsigned int decodeBatch(short *audioFrames, unsigned int nbFrames, const unsigned char *mbeFrames, DVRate rate, int gain = 0, unsigned int channel = 0);
+
+    /** Zero copy encoding: returns where to write the MBE_AUDIO_BLOCK_SIZE samples of the frame
+     * directly in the controller audio packet whose header is already filled in.
+     * Then commitEncode() sends it. Returns 0 if the pipeline of the channel is full.
+     */
+    short *acquireEncodeSlot(unsigned int channel = 0);
+    bool commitEncode(unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+
+    /** Zero copy decoding: returns where to write the getNbMbeBytes(rate) bytes of the AMBE frame
+     * directly in the controller AMBE packet. Then commitDecode() sends it.
+     * Returns 0 if the pipeline of the channel is full.
+     */
+    unsigned char *acquireDecodeSlot(DVRate rate, int gain, unsigned int channel = 0);
+    bool commitDecode(short *audioFrame, unsigned int tag, unsigned int channel = 0);
+
+    /** Same as pollCompletion() but the reply data is not copied to the buffers given at submission
+     * (these can be null). It is handed back as a view into the receive buffer instead until
+     * releaseCompletion() is called. No other completion can be polled in the meantime.
+     */
+    bool pollCompletionView(DVCompletionView& view);
+    void releaseCompletion();
+
+    /** Asynchronous pipelined requests for event loops. Same as submitEncode() and submitDecode()
+     * but the callback is called from processEvents() when the request completes after the reply
+     * has been copied to the output buffer. The completion callback set with setCompletionCallback()
+     * is called instead for requests submitted without a callback.
+     */
+    bool submitEncodeAsync(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+            DVCompletionCallback callback, void *context, unsigned int channel = 0);
+    bool submitDecodeAsync(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+            DVCompletionCallback callback, void *context, unsigned int channel = 0);
+    void setCompletionCallback(DVCompletionCallback callback, void *context);
+
+    /** File descriptor of the device link to add to a poll or epoll set of an event loop (-1 if there is none).
+     * When it is readable or when getNextTimeoutMs() expires call processEvents().
+     */
+    int getFd() const { return m_dataController ? m_dataController->getFd() : -1; }
+
+    /** Waits at most timeoutUs microseconds for a reply then processes all the replies already received
+     * calling the completion callbacks. Requests whose reply is overdue by the response timeout are
+     * completed as failed. Returns the number of completions.
+     */
+    unsigned int processEvents(unsigned int timeoutUs = 0);
+
+    /** Milliseconds before the oldest request in flight is overdue (0 if it is) or -1 if nothing is in flight.
+     * To be used as the timeout of the event loop.
+     */
+    int getNextTimeoutMs() const;
+
+    /** Streaming mode: a writer thread sends the frames pushed with pushEncode() and pushDecode()
+     * while a reader thread matches the replies and queues the completions for popCompletion().
+     * Input frames are copied so that the caller can reuse its buffers at once. Output buffers must
+     * remain valid until the completion is popped. Frames are pushed from one thread and completions
+     * are popped from one thread which can be another one. The other encoding and decoding methods
+     * fail while streaming. The transaction callback is called in the reader thread.
+     * Returns false if the device is not open or requests are in flight.
+     */
+    bool startStreaming();
+
+    /** Stops the streaming threads after the replies of the frames in flight are received.
+     * Their completions can still be popped. Returns the number of frames discarded before being written.
+     */
+    unsigned int stopStreaming();
+    bool isStreaming() const { return m_streaming; }
+
+    /** Queues a frame for the writer thread. Returns false if the queue is full or not streaming.
+     * The writer thread holds it back while getPipelineDepth() frames of the channel are waiting to be popped.
+     */
+    bool pushEncode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+    bool pushDecode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+
+    /** Pops the next completion waiting at most timeoutUs microseconds for it. Returns false if there is none */
+    bool popCompletion(DVCompletion& completion, unsigned int timeoutUs = 0);
+
+    /** Number of audio or AMBE frames submitted and not yet completed on all channels */
+    unsigned int getNbInFlight() const { return m_nbFramesInFlight; }
+
+    /** Number of audio or AMBE frames submitted and not yet completed on one channel */
+    unsigned int getNbInFlight(unsigned int channel) const { return channel < m_nbChannels ? m_channels[channel].nbFramesInFlight : 0; }
+
+    /** Set the maximum number of frames in flight per channel (1 to DV_PIPELINE_MAX_DEPTH) */
+    void setPipelineDepth(unsigned int depth);
+    unsigned int getPipelineDepth() const { return m_pipelineDepth; }
+
+    /** Set the maximum time in milliseconds to wait for a complete reply packet from the device */
+    void setResponseTimeout(unsigned int timeoutMs) { m_responseTimeoutMs = timeoutMs; }
+    unsigned int getResponseTimeout() const { return m_responseTimeoutMs; }
+
+    /** Set the maximum time in milliseconds to wait for the product identification when opening.
+     * A short timeout rules out ports that are not DVSI devices quickly.
+     */
+    void setIdentifyTimeout(unsigned int timeoutMs) { m_identifyTimeoutMs = timeoutMs; }
+    unsigned int getIdentifyTimeout() const { return m_identifyTimeoutMs; }
+
+    /** Recovery after a timeout, a mismatched or an unexpected reply. The controller cannot tell
+     * which request late bytes belong to so the requests still in flight are failed, then stale
+     * bytes are flushed until the link is quiet and RATEP and GAIN are sent again with the next
+     * frame of each channel. Optionally the chip is reset in between. This is done automatically
+     * when the last request is failed except in streaming mode. It can also be called when no
+     * request is in flight. Returns false if the chip did not come back from a reset.
+     */
+    bool resync(bool resetChip);
+    void setResetOnResync(bool resetOnResync) { m_resetOnResync = resetOnResync; }
+    bool getResetOnResync() const { return m_resetOnResync; }
+
+    /** Product identification returned by the device at opening e.g. AMBE3000R or AMBE3003 */
+    const std::string& getProductId() const { return m_productId; }
+
+    /** Statistics of the requests processed since opening or the last reset.
+     * They can be read from another thread while the controller runs.
+     */
+    const DVControllerStats& getStats() const { return m_stats; }
+    void resetStats() { m_stats.reset(); }
+
+    /** Callback called in the controller thread when a transaction completes (0 to remove it).
+     * It should return quickly as it delays the processing of the next replies.
+     */
+    void setTransactionCallback(DVTransactionCallback callback, void *context);
 
 	/** Returns the number of bytes in a MBE frame given the MBE rate
 	 */
-	static unsigned short getNbMbeBytes(DVRate mbeRate);
+	static unsigned short getNbMbeBytes(DVRate mbeRate) { return getRateInfo(mbeRate).nbMbeBytes; }
 
     /** Returns the number of bits in a MBE frame given the MBE rate
      */
-    static unsigned char getNbMbeBits(DVRate mbeRate);
+    static unsigned char getNbMbeBits(DVRate mbeRate) { return getRateInfo(mbeRate).nbMbeBits; }
 
 private:
 
@@ -84,42 +317,227 @@ private:
         RESP_AMBE,
         RESP_AUDIO,
         RESP_GAIN,
+        RESP_READY,
         RESP_UNKNOWN
     };
 
-    SerialDataController m_serial;
-    bool m_open; //!< True if the serial DV device has been correctly opened
-    DVRate m_currentRate;
-    int m_currentGainIn;
-    int m_currentGainOut;
-    unsigned char m_currentNbMbeBits;
-    unsigned short m_currentNbMbeBytes;
-    bool m_littleEndian;
-
-    bool isLittleEndian()
+    /** Reply expected from the device for a packet already written */
+    struct PendingRequest
+    {
+        RESP_TYPE expected;
+        unsigned int tag;
+        uint64_t sequence; //!< Submission order across channels
+        short *audioFrame;
+        unsigned char *mbeFrame;
+        unsigned short nbMbeBytes;
+        float hostGain;      //!< Applied to the decoded samples
+        uint64_t submitUs;   //!< Time of submission
+        uint64_t writeEndUs; //!< Time the write that carried the request returned
+        uint32_t writeUs;    //!< Duration of that write
+        DVCompletionCallback callback; //!< Called by processEvents() or 0 for the controller callback
+        void *context;
+    };
+
+    /** Frame queued for the streaming writer thread with a copy of its input */
+    struct StreamRequest
     {
-        short int number = 0x1;
-        char *numPtr = (char*)&number;
-        return (numPtr[0] == 1);
-    }
+        bool encode;
+        DVRate rate;
+        int gain;
+        unsigned int tag;
+        unsigned int channel;
+        short *audioFrame;       //!< Decoder output
+        unsigned char *mbeFrame; //!< Encoder output
+        short audio[MBE_AUDIO_BLOCK_SIZE];
+        unsigned char mbe[MBE_FRAME_MAX_LENGTH_BYTES];
+    };
+
+    /** Vocoder state and pipeline of one channel */
+    struct ChannelState
+    {
+        DVRate currentRate;
+        int currentGainIn;
+        int currentGainOut;
+        bool resendGain;         //!< Gains held by the chip are not known after a lost or rejected configuration
+        std::atomic<bool> configDirty; //!< Configuration to be sent again set by invalidateConfig() from the thread matching the replies
+        float hostGain;
+        unsigned char currentNbMbeBits;
+        unsigned short currentNbMbeBytes;
+        PendingRequest pending[DV_PIPELINE_SLOTS];
+        unsigned int pendingHead;
+        unsigned int pendingCount;
+        unsigned int nbFramesInFlight;
+        alignas(2) unsigned char audioStorage[1 + DV3003_AUDIO_HEADER_LEN + MBE_AUDIO_BLOCK_BYTES];
+        unsigned char *audioPacket; //!< Audio packet with header preset placed in audioStorage so that samples are aligned
+        unsigned int audioHeaderLength;
+        unsigned char ambePacket[DV3003_AMBE_HEADER_LEN + MBE_FRAME_MAX_LENGTH_BYTES]; //!< AMBE packet with header preset for the current rate
+        unsigned int ambeHeaderLength;
+        unsigned char controlFields[DV_CONTROL_FIELDS_LENGTH]; //!< Configuration changes sent with the next packet
+        unsigned int controlFieldsLength;
+    };
+
+    DataController *m_dataController;
+    bool m_open; //!< True if the serial DV device has been correctly opened
+    unsigned int m_nbChannels;
+    ChannelState m_channels[DV3000_MAX_CHANNELS];
+    uint64_t m_sequence;
+    unsigned int m_nbFramesInFlight;
+    unsigned int m_pipelineDepth;
+    alignas(16) unsigned char m_rxBuffer[DV_RX_BUFFER_LENGTH]; //!< Bytes received from the device and not parsed yet
+    unsigned int m_rxStart;                        //!< Index of the first byte not parsed yet
+    unsigned int m_rxEnd;                          //!< Index past the last byte received
+    unsigned int m_responseTimeoutMs;
+    unsigned int m_identifyTimeoutMs;
+    bool m_desync;        //!< Replies are not reliable until resync()
+    bool m_resetOnResync;
+    std::string m_productId;
+    bool m_viewHeld; //!< A completion view points into the receive buffer
+    DVControllerStats m_stats;
+    DVTransactionCallback m_transactionCallback;
+    void *m_transactionContext;
+    PendingRequest *m_unwritten[DV3000_MAX_CHANNELS * DV_PIPELINE_SLOTS]; //!< Requests pushed and not written yet
+    unsigned int m_nbUnwritten;
+    uint64_t m_lastReadUs;          //!< Time of the last read returning bytes
+    uint64_t m_rxFirstByteUs;       //!< Time the first byte not parsed yet was received or 0 if none
+    uint64_t m_packetFirstByteUs;   //!< Time the first byte of the last packet received was read
+    uint64_t m_packetLastByteUs;    //!< Time the last byte of the last packet received was read
+    DVCompletionCallback m_completionCallback;
+    void *m_completionContext;
+    DVDecodeCache *m_decodeCache;
+    bool m_streaming;
+    std::atomic<bool> m_streamStop;  //!< Tells the writer thread to stop
+    std::atomic<bool> m_readerStop;  //!< Tells the reader thread to stop when nothing is in flight
+    std::thread m_writerThread;
+    std::thread m_readerThread;
+    std::mutex m_streamMutex;        //!< Only taken to wait for or signal queue changes
+    std::condition_variable m_writerWakeup;
+    std::condition_variable m_readerWakeup;
+    std::condition_variable m_completionWakeup;
+    DVSPSCQueue<StreamRequest, DV_STREAM_QUEUE_LENGTH> m_streamRequests;   //!< Caller to writer thread
+    DVSPSCQueue<PendingRequest, DV_PIPELINE_SLOTS + 1> m_streamInFlight[DV3000_MAX_CHANNELS]; //!< Writer to reader thread
+    DVSPSCQueue<DVCompletion, DV_PIPELINE_SLOTS + 1> m_streamCompletions; //!< Reader thread to caller
+    std::atomic<unsigned int> m_streamNbFrames[DV3000_MAX_CHANNELS]; //!< Frames written and not popped
+    PendingRequest m_streamPopped;   //!< Last request popped by the reader thread
+
+    /** Fills the packet templates of the channel with its header */
+    void initPackets(unsigned int channel);
+
+    /** Copies the AMBE packet header of the rate to the packet template of the channel */
+    void setAmbeHeader(unsigned int channel, const DVRateInfo& rateInfo);
+
+    /** Builds the audio packet in the buffer and returns its length.
+     * The header is not copied if the buffer is the channel audio packet template.
+     */
+    unsigned int encodeIn(unsigned int channel, const short* audio, unsigned int length, unsigned char* buffer);
+    void encodeOut(const unsigned char* payload, unsigned char* ambe, unsigned int length);
+
+    /** Builds the AMBE packet in the buffer and returns its length.
+     * The header is not copied if the buffer is the channel AMBE packet template.
+     */
+    unsigned int decodeIn(unsigned int channel, const unsigned char* ambe, unsigned short nbBytes, unsigned char* buffer);
+    void decodeOut(const unsigned char* payload, short* audio, unsigned int length, float hostGain);
+
+    /** Sends RATEP and GAIN if the rate or the gain differs from the channel current settings */
+    void setEncodeConfig(unsigned int channel, DVRate rate, int gain);
+    void setDecodeConfig(unsigned int channel, DVRate rate, int gain);
+
+    void pushPending(unsigned int channel, RESP_TYPE expected, unsigned int tag, short *audioFrame, unsigned char *mbeFrame);
+    PendingRequest& popPending(unsigned int channel);
+    bool hasPending(unsigned int channel) const;
+    bool hasStreamPending() const;
+    void streamWriter();
+    void streamReader();
+    void wakeUp(std::condition_variable& condition);
+    void completeTransaction(unsigned int channel, const PendingRequest& pending, bool received, bool ok);
+
+    /** Writes to the device timing the write on behalf of the requests pushed since the last write */
+    int writePacket(const unsigned char *buffer, unsigned int length);
+    int writePackets(const DataBuffer *buffers, unsigned int nbBuffers);
+    void clearPending();
+    void closeDataController();
 
-    void encodeIn(const short* audio, unsigned int length);
-    bool encodeOut(unsigned char* ambe, unsigned int length);
+    /** Channel having the oldest pending reply or -1 if nothing is pending */
+    int getOldestPendingChannel() const;
 
-    void decodeIn(const unsigned char* ambe, unsigned char nbBits, unsigned short nbBytes);
-    bool decodeOut(short* audio, unsigned int length);
+    /** Builds a control packet in the buffer with the channel field for multi-channel devices.
+     * The field is the control field identifier followed by its data.
+     * Returns the packet length.
+     */
+    unsigned int buildControlPacket(unsigned char* buffer, unsigned int channel, const unsigned char* field, unsigned int fieldLength);
+
+    /** Forgets the rate and gains held by the chip so that they are sent again with the next frame.
+     * It may be called from the streaming reader thread. The thread sending the frames applies it with takeInvalidation().
+     */
+    void invalidateConfig(unsigned int channel);
+    void takeInvalidation(ChannelState& state);
 
-    bool setRate(DVRate rate);
+    /** Stages the RATEP field for the next packet. The reply is collected by pollCompletion() */
+    bool setRate(unsigned int channel, DVRate rate);
 
     /** Set input and output gain in dB (-90 to +90 dB)
      * If the input gain is < 0 dB then the input speech samples are attenuated prior to encoding.
      * If the input gain is > 0 dB then the input speech samples are amplified prior to encoding.
      * If the output gain is < 0 dB then the output speech samples are attenuated after decoding.
      * If the output gain is > 0 dB then the output speech samples are amplified after decoding.
+     * The GAIN field is staged for the next packet and the reply is collected by pollCompletion()
+     */
+    bool setGain(unsigned int channel, char dBGainIn, char dBGainOut);
+
+    /** Adds a control field to the configuration changes of the channel or updates it if already there */
+    void stageControlField(unsigned int channel, const unsigned char *field, unsigned int fieldLength);
+
+    /** Builds the control packet of the configuration changes of the channel in the buffer and queues
+     * its reply. Returns its length or 0 if there is no change.
+     */
+    unsigned int takeControlPacket(unsigned int channel, unsigned char *buffer);
+
+    /** Queues the reply of an audio or AMBE packet and writes it preceded by the configuration changes if any */
+    int submitPacket(unsigned int channel, RESP_TYPE expected, unsigned int tag, short *audioFrame, unsigned char *mbeFrame,
+            const unsigned char *packet, unsigned int length);
+
+    /** Length of a control field with its identifier */
+    static unsigned int getControlFieldLength(unsigned char field);
+
+    /** True if all the RATEP and GAIN fields of a control reply have a success status */
+    static bool checkControlReply(const unsigned char *packet, unsigned int fieldOffset);
+
+    /** Waits for the next complete packet and copies it to the buffer */
+    RESP_TYPE getResponse(unsigned char* buffer, unsigned int length, unsigned int timeoutMs);
+
+    /** Waits for the next complete packet and returns where it is in the receive buffer
+     * or 0 on timeout or error. It remains valid until the next read.
+     */
+    unsigned char *receivePacket(unsigned int timeoutMs);
+
+    /** Returns the next complete packet reading at least once and waiting until the deadline at most.
+     * Returns 0 without logging on timeout or on error with failed set.
+     */
+    unsigned char *readPacket(uint64_t deadlineUs, bool& failed);
+
+    /** Returns the next complete packet in the receive buffer skipping any garbage before it
+     * or 0 if more bytes are needed.
      */
-    bool setGain(char dBGainIn, char dBGainOut);
+    unsigned char *extractPacket();
 
-    RESP_TYPE getResponse(unsigned char* buffer, unsigned int length);
+    /** Waits for the next audio or AMBE reply consuming control replies on the way.
+     * The payload points to the reply data in the receive buffer.
+     */
+    bool nextCompletion(DVCompletion& completion, unsigned char*& payload, PendingRequest*& pending);
+
+    /** Matches a reply or a timeout when the packet is 0 with the oldest request of its channel.
+     * Returns true for an audio or AMBE request and false when a control reply has been consumed
+     * or the packet was not expected.
+     */
+    bool matchReply(unsigned char *packet, DVCompletion& completion, unsigned char*& payload, PendingRequest*& pending);
+
+    /** Sets the callback of the last request submitted on the channel */
+    void setLastCallback(unsigned int channel, DVCompletionCallback callback, void *context);
+
+    /** Returns the type of the packet in the buffer. For multi-channel devices the channel and
+     * the offset of the first field after the channel field are returned too.
+     */
+    RESP_TYPE getResponseType(const unsigned char* buffer, unsigned int& channel, unsigned int& fieldOffset) const;
+    static uint64_t nowUs();
 };
 
 } // namespace SerialDV
@@ -0,0 +1,320 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+
+#include "dvdecodecache.h"
+#include "samplesconverter.h"
+
+namespace SerialDV
+{
+
+bool DVDecodeCache::Key::operator==(const Key& other) const
+{
+    return (rate == other.rate) && (gain == other.gain) && (::memcmp(mbe, other.mbe, sizeof(mbe)) == 0);
+}
+
+DVDecodeCache::DVDecodeCache(size_t maxBytes) :
+        m_maxBytes(0),
+        m_mostRecent(-1),
+        m_leastRecent(-1),
+        m_free(-1),
+        m_nbEntries(0),
+        m_nbSeeded(0)
+{
+    setMaxBytes(maxBytes);
+}
+
+DVDecodeCache::~DVDecodeCache()
+{
+}
+
+void DVDecodeCache::setMaxBytes(size_t maxBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    unsigned int nbBuckets = 1;
+
+    m_maxBytes = maxBytes;
+    m_entries.clear();
+    m_entries.shrink_to_fit();
+    m_entries.resize(maxBytes / ENTRY_BYTES);
+
+    // a power of two about the number of entries
+    while (nbBuckets < m_entries.size()) {
+        nbBuckets *= 2;
+    }
+
+    m_buckets.assign(nbBuckets, -1);
+    m_buckets.shrink_to_fit();
+    reset();
+}
+
+size_t DVDecodeCache::getNbBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nbEntries * ENTRY_BYTES;
+}
+
+unsigned int DVDecodeCache::getNbEntries() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nbEntries;
+}
+
+bool DVDecodeCache::lookup(DVRate rate, int gain, const unsigned char *mbeFrame, unsigned char *payload)
+{
+    Key key;
+
+    if (!makeKey(rate, gain, mbeFrame, key)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int index = find(key);
+
+    if (index < 0)
+    {
+        m_stats.nbMisses.add(1);
+        return false;
+    }
+
+    unlink(index);
+    linkFirst(index); // most recently used
+    ::memcpy(payload, m_entries[index].payload, MBE_AUDIO_BLOCK_BYTES);
+    m_stats.nbHits.add(1);
+    return true;
+}
+
+void DVDecodeCache::insert(DVRate rate, int gain, const unsigned char *mbeFrame, const unsigned char *payload)
+{
+    Key key;
+
+    if (!makeKey(rate, gain, mbeFrame, key)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_nbSeeded < m_entries.size()) {
+        store(key, payload, false);
+    }
+}
+
+bool DVDecodeCache::seed(DVRate rate, int gain, const unsigned char *mbeFrame, const short *audioFrame)
+{
+    Key key;
+    unsigned char payload[MBE_AUDIO_BLOCK_BYTES];
+
+    if (!makeKey(rate, gain, mbeFrame, key)) {
+        return false;
+    }
+
+    if (audioFrame) {
+        SamplesConverter::toBigEndian(payload, audioFrame, MBE_AUDIO_BLOCK_SIZE);
+    } else {
+        ::memset(payload, 0, MBE_AUDIO_BLOCK_BYTES);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int index = find(key);
+
+    if ((m_nbSeeded == m_entries.size()) && ((index < 0) || !m_entries[index].seeded))
+    {
+        fprintf(stderr, "DVDecodeCache::seed: no room left\n");
+        return false;
+    }
+
+    store(key, payload, true);
+    return true;
+}
+
+void DVDecodeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buckets.assign(m_buckets.size(), -1);
+    reset();
+}
+
+bool DVDecodeCache::makeKey(DVRate rate, int gain, const unsigned char *mbeFrame, Key& key)
+{
+    unsigned int nbBytes = getRateInfo(rate).nbMbeBytes;
+
+    if (nbBytes == 0) {
+        return false;
+    }
+
+    // the chip takes the gain clamped to +/-90 dB
+    key.rate = rate;
+    key.gain = gain < -90 ? -90 : gain > 90 ? 90 : gain;
+    ::memset(key.mbe, 0, sizeof(key.mbe));
+    ::memcpy(key.mbe, mbeFrame, nbBytes);
+    return true;
+}
+
+uint32_t DVDecodeCache::hash(const Key& key)
+{
+    // FNV-1a
+    const unsigned char *p = (const unsigned char *) &key;
+    uint32_t hash = 2166136261U;
+
+    for (unsigned int i = 0; i < sizeof(Key); i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+void DVDecodeCache::reset()
+{
+    for (unsigned int i = 0; i < m_entries.size(); i++) {
+        m_entries[i].next = i + 1 < m_entries.size() ? (int) i + 1 : -1;
+    }
+
+    m_free = m_entries.empty() ? -1 : 0;
+    m_mostRecent = -1;
+    m_leastRecent = -1;
+    m_nbEntries = 0;
+    m_nbSeeded = 0;
+}
+
+int DVDecodeCache::find(const Key& key) const
+{
+    if (m_entries.empty()) {
+        return -1;
+    }
+
+    int index = m_buckets[hash(key) & (m_buckets.size() - 1)];
+
+    while ((index >= 0) && !(m_entries[index].key == key)) {
+        index = m_entries[index].hashNext;
+    }
+
+    return index;
+}
+
+void DVDecodeCache::unlink(int index)
+{
+    Entry& entry = m_entries[index];
+
+    if (entry.previous >= 0) {
+        m_entries[entry.previous].next = entry.next;
+    } else {
+        m_mostRecent = entry.next;
+    }
+
+    if (entry.next >= 0) {
+        m_entries[entry.next].previous = entry.previous;
+    } else {
+        m_leastRecent = entry.previous;
+    }
+}
+
+void DVDecodeCache::linkFirst(int index)
+{
+    Entry& entry = m_entries[index];
+    entry.previous = -1;
+    entry.next = m_mostRecent;
+
+    if (m_mostRecent >= 0) {
+        m_entries[m_mostRecent].previous = index;
+    } else {
+        m_leastRecent = index;
+    }
+
+    m_mostRecent = index;
+}
+
+void DVDecodeCache::store(const Key& key, const unsigned char *payload, bool seeded)
+{
+    int index = find(key);
+
+    if (index >= 0)
+    {
+        Entry& entry = m_entries[index];
+
+        if (entry.seeded && !seeded) {
+            return; // seeded samples take precedence
+        }
+
+        if (seeded && !entry.seeded) {
+            m_nbSeeded++;
+        }
+
+        entry.seeded = seeded;
+        ::memcpy(entry.payload, payload, MBE_AUDIO_BLOCK_BYTES);
+        unlink(index);
+        linkFirst(index);
+        return;
+    }
+
+    if (m_free < 0)
+    {
+        // evict the least recently used frame that is not seeded
+        int victim = m_leastRecent;
+
+        while (m_entries[victim].seeded) {
+            victim = m_entries[victim].previous;
+        }
+
+        remove(victim);
+        m_stats.nbEvictions.add(1);
+    }
+
+    index = m_free;
+    Entry& entry = m_entries[index];
+    m_free = entry.next;
+
+    uint32_t bucket = hash(key) & (m_buckets.size() - 1);
+    entry.key = key;
+    entry.seeded = seeded;
+    entry.hashNext = m_buckets[bucket];
+    ::memcpy(entry.payload, payload, MBE_AUDIO_BLOCK_BYTES);
+    m_buckets[bucket] = index;
+    linkFirst(index);
+    m_nbEntries++;
+
+    if (seeded) {
+        m_nbSeeded++;
+    } else {
+        m_stats.nbInsertions.add(1);
+    }
+}
+
+void DVDecodeCache::remove(int index)
+{
+    Entry& entry = m_entries[index];
+    int *link = &m_buckets[hash(entry.key) & (m_buckets.size() - 1)];
+
+    while (*link != index) {
+        link = &m_entries[*link].hashNext;
+    }
+
+    *link = entry.hashNext;
+    unlink(index);
+
+    if (entry.seeded) {
+        m_nbSeeded--;
+    }
+
+    entry.next = m_free;
+    m_free = index;
+    m_nbEntries--;
+}
+
+} // namespace SerialDV
@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVDECODECACHE_H_
+#define DVDECODECACHE_H_
+
+#include <vector>
+#include <mutex>
+#include <stddef.h>
+
+#include "dvrate.h"
+#include "dvstats.h"
+
+namespace SerialDV
+{
+
+const size_t DV_DECODE_CACHE_DEFAULT_BYTES = 1048576U; //!< Default memory limit i.e. about 3000 frames
+
+/** Bounded least recently used cache of decoded frames keyed on the rate, the decoder gain and
+ * the AMBE bytes so that repeated frames like silence or looped announcements skip the device.
+ * Samples are kept in packet byte order so that the host gain is applied on the way out as for
+ * frames decoded by the device. Frames can be seeded e.g. with silence. Seeded frames are never
+ * evicted. The storage for the memory limit is allocated when the limit is set so that lookups
+ * and insertions do not allocate.
+ *
+ * The vocoder is stateful so a frame decoded after different frames does not give exactly the same
+ * samples. A hit returns the samples of the first decoding and the decoder state of the channel is
+ * not updated by it. This is best for silence and prompts repeated as a whole.
+ *
+ * A cache can be shared by the controllers of several threads.
+ */
+class DVDecodeCache
+{
+public:
+    DVDecodeCache(size_t maxBytes = DV_DECODE_CACHE_DEFAULT_BYTES);
+    ~DVDecodeCache();
+
+    /** Memory limit including the bookkeeping of the entries. The cache is emptied and its storage reallocated */
+    void setMaxBytes(size_t maxBytes);
+    size_t getMaxBytes() const { return m_maxBytes; }
+    size_t getNbBytes() const;
+    unsigned int getNbEntries() const;
+
+    /** Copies the MBE_AUDIO_BLOCK_BYTES big endian samples of the frame if it is cached. Returns false on a miss */
+    bool lookup(DVRate rate, int gain, const unsigned char *mbeFrame, unsigned char *payload);
+
+    /** Stores the big endian samples decoded from the frame evicting the least recently used frame if needed */
+    void insert(DVRate rate, int gain, const unsigned char *mbeFrame, const unsigned char *payload);
+
+    /** Stores a frame that is never evicted with host order samples (0 for silence).
+     * Returns false if there is no room left besides the frames already seeded.
+     */
+    bool seed(DVRate rate, int gain, const unsigned char *mbeFrame, const short *audioFrame = 0);
+
+    /** Seeds the D-Star silence frame decoded as silence */
+    bool seedDStarSilence(int gain = 0) { return seed(DVRate3600x2400, gain, DV_DSTAR_SILENCE_FRAME); }
+
+    /** Removes all the frames including the seeded ones */
+    void clear();
+
+    const DVDecodeCacheStats& getStats() const { return m_stats; }
+    void resetStats() { m_stats.reset(); }
+
+private:
+    struct Key
+    {
+        unsigned char rate;
+        signed char gain;
+        unsigned char mbe[MBE_FRAME_MAX_LENGTH_BYTES]; //!< Unused bytes are zero
+
+        bool operator==(const Key& other) const;
+    };
+
+    /** Entry linked in its hash bucket and in the recency list or the free list by indexes */
+    struct Entry
+    {
+        Key key;
+        bool seeded;
+        int hashNext;
+        int previous;   //!< More recently used
+        int next;       //!< Less recently used or next free entry
+        unsigned char payload[MBE_AUDIO_BLOCK_BYTES];
+    };
+
+    static const size_t ENTRY_BYTES = sizeof(Entry) + sizeof(int); //!< Entry with its hash bucket
+
+    size_t m_maxBytes;
+    std::vector<Entry> m_entries;
+    std::vector<int> m_buckets; //!< First entry of each bucket or -1
+    int m_mostRecent;           //!< Head of the recency list of the stored entries or -1
+    int m_leastRecent;          //!< Tail of the recency list or -1
+    int m_free;                 //!< Head of the free list or -1
+    unsigned int m_nbEntries;
+    unsigned int m_nbSeeded;
+    mutable std::mutex m_mutex;
+    DVDecodeCacheStats m_stats;
+
+    static bool makeKey(DVRate rate, int gain, const unsigned char *mbeFrame, Key& key);
+    static uint32_t hash(const Key& key);
+    void reset();
+    int find(const Key& key) const;
+    void unlink(int index);
+    void linkFirst(int index);
+    void store(const Key& key, const unsigned char *payload, bool seeded);
+    void remove(int index);
+};
+
+} // namespace SerialDV
+
+#endif /* DVDECODECACHE_H_ */
@@ -0,0 +1,285 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+
+#include "dvdevicepool.h"
+#include "serialdatacontroller.h"
+
+namespace SerialDV
+{
+
+DVDevicePool::DVDevicePool()
+{
+}
+
+DVDevicePool::~DVDevicePool()
+{
+    close();
+}
+
+unsigned int DVDevicePool::open(const std::vector<std::string>& devices, bool halfSpeed)
+{
+    return open(devices, halfSpeed ? SERIAL_230400 : SERIAL_460800);
+}
+
+unsigned int DVDevicePool::open(const std::vector<std::string>& devices, SERIAL_SPEED speed)
+{
+    close();
+
+    for (std::vector<std::string>::const_iterator it = devices.begin(); it != devices.end(); ++it)
+    {
+        Device *device = new Device();
+
+        if (!device->controller.open(*it, speed))
+        {
+            fprintf(stderr, "DVDevicePool::open: cannot open %s: skipped\n", it->c_str());
+            delete device;
+            continue;
+        }
+
+        // The link is the bottleneck: one audio packet per frame in each direction at most
+        unsigned int baudRate = device->controller.getLinkSpeed();
+
+        if (baudRate == 0) { // network device
+            baudRate = SERIAL_460800;
+        }
+
+        device->name = *it;
+        device->capacity = (baudRate / 10U) / (DV3000_AUDIO_HEADER_LEN + MBE_AUDIO_BLOCK_BYTES);
+        device->load = 0;
+
+        for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+            device->channelLoad[channel] = 0;
+        }
+
+        fprintf(stderr, "DVDevicePool::open: %s: %u channel(s) capacity %u frames/s\n",
+                it->c_str(), device->controller.getNbChannels(), device->capacity);
+        m_devices.push_back(device);
+    }
+
+    return m_devices.size();
+}
+
+void DVDevicePool::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (std::vector<Device*>::iterator it = m_devices.begin(); it != m_devices.end(); ++it)
+    {
+        (*it)->controller.close();
+        delete *it;
+    }
+
+    m_devices.clear();
+    m_streams.clear();
+}
+
+void DVDevicePool::setDeviceCapacity(unsigned int deviceIndex, unsigned int framesPerSecond)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (deviceIndex < m_devices.size()) {
+        m_devices[deviceIndex]->capacity = framesPerSecond;
+    }
+}
+
+unsigned int DVDevicePool::getDeviceCapacity(unsigned int deviceIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return deviceIndex < m_devices.size() ? m_devices[deviceIndex]->capacity : 0;
+}
+
+unsigned int DVDevicePool::getDeviceLoad(unsigned int deviceIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return deviceIndex < m_devices.size() ? m_devices[deviceIndex]->load : 0;
+}
+
+std::string DVDevicePool::getDeviceName(unsigned int deviceIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return deviceIndex < m_devices.size() ? m_devices[deviceIndex]->name : std::string();
+}
+
+const DVControllerStats *DVDevicePool::getDeviceStats(unsigned int deviceIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return deviceIndex < m_devices.size() ? &m_devices[deviceIndex]->controller.getStats() : 0;
+}
+
+DVController *DVDevicePool::acquireController(unsigned int deviceIndex)
+{
+    Device *device;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (deviceIndex >= m_devices.size()) {
+            return 0;
+        }
+
+        device = m_devices[deviceIndex];
+    }
+
+    device->mutex.lock();
+    return &device->controller;
+}
+
+void DVDevicePool::releaseController(unsigned int deviceIndex)
+{
+    Device *device;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (deviceIndex >= m_devices.size()) {
+            return;
+        }
+
+        device = m_devices[deviceIndex];
+    }
+
+    device->mutex.unlock();
+}
+
+int DVDevicePool::openStream(unsigned int framesPerSecond)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int best = -1;
+    unsigned int bestLeft = 0;
+
+    for (unsigned int i = 0; i < m_devices.size(); i++)
+    {
+        const Device *device = m_devices[i];
+
+        if (device->load + framesPerSecond > device->capacity) {
+            continue;
+        }
+
+        unsigned int left = device->capacity - device->load;
+
+        if ((best < 0) || (left > bestLeft))
+        {
+            best = i;
+            bestLeft = left;
+        }
+    }
+
+    if (best < 0)
+    {
+        fprintf(stderr, "DVDevicePool::openStream: no device left with %u frames/s capacity\n", framesPerSecond);
+        return -1;
+    }
+
+    Device *device = m_devices[best];
+    unsigned int channel = 0;
+
+    for (unsigned int c = 1; c < device->controller.getNbChannels(); c++)
+    {
+        if (device->channelLoad[c] < device->channelLoad[channel]) {
+            channel = c;
+        }
+    }
+
+    device->load += framesPerSecond;
+    device->channelLoad[channel] += framesPerSecond;
+
+    Stream stream;
+    stream.used = true;
+    stream.deviceIndex = best;
+    stream.channel = channel;
+    stream.framesPerSecond = framesPerSecond;
+
+    for (unsigned int i = 0; i < m_streams.size(); i++)
+    {
+        if (!m_streams[i].used)
+        {
+            m_streams[i] = stream;
+            return i;
+        }
+    }
+
+    m_streams.push_back(stream);
+    return m_streams.size() - 1;
+}
+
+void DVDevicePool::closeStream(int streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if ((streamId < 0) || ((unsigned int) streamId >= m_streams.size()) || !m_streams[streamId].used) {
+        return;
+    }
+
+    Stream& stream = m_streams[streamId];
+    Device *device = m_devices[stream.deviceIndex];
+    device->load -= stream.framesPerSecond;
+    device->channelLoad[stream.channel] -= stream.framesPerSecond;
+    stream.used = false;
+}
+
+bool DVDevicePool::getStreamBinding(int streamId, unsigned int& deviceIndex, unsigned int& channel) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if ((streamId < 0) || ((unsigned int) streamId >= m_streams.size()) || !m_streams[streamId].used) {
+        return false;
+    }
+
+    deviceIndex = m_streams[streamId].deviceIndex;
+    channel = m_streams[streamId].channel;
+    return true;
+}
+
+bool DVDevicePool::encode(int streamId, const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain)
+{
+    unsigned int channel;
+    Device *device = getStreamDevice(streamId, channel);
+
+    if (!device) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(device->mutex);
+    return device->controller.encode(audioFrame, mbeFrame, rate, gain, channel);
+}
+
+bool DVDevicePool::decode(int streamId, short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain)
+{
+    unsigned int channel;
+    Device *device = getStreamDevice(streamId, channel);
+
+    if (!device) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(device->mutex);
+    return device->controller.decode(audioFrame, mbeFrame, rate, gain, channel);
+}
+
+DVDevicePool::Device *DVDevicePool::getStreamDevice(int streamId, unsigned int& channel)
+{
+    unsigned int deviceIndex;
+
+    if (!getStreamBinding(streamId, deviceIndex, channel)) {
+        return 0;
+    }
+
+    return m_devices[deviceIndex];
+}
+
+} // namespace SerialDV
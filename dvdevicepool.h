@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVDEVICEPOOL_H_
+#define DVDEVICEPOOL_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "dvcontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int DV_STREAM_FRAMES_PER_SECOND = 50U; //!< One way 20 ms frames stream
+
+/** Pool of DV devices. Streams are bound to the least loaded device at opening and stick to it
+ * so that the vocoder state is preserved. On multi-channel devices a stream is also bound to
+ * the least loaded channel.
+ *
+ * Each device is protected by its own lock so that streams on different devices can be processed
+ * at the same time from different threads.
+ */
+class DVDevicePool
+{
+public:
+    DVDevicePool();
+    ~DVDevicePool();
+
+    /** Opens the given serial devices. Devices that cannot be opened are skipped.
+     * Returns the number of devices opened.
+     */
+    unsigned int open(const std::vector<std::string>& devices, bool halfSpeed=false);
+    unsigned int open(const std::vector<std::string>& devices, SERIAL_SPEED speed);
+    void close();
+    unsigned int getNbDevices() const { return m_devices.size(); }
+
+    /** Capacity of a device in frames per second. By default it is estimated from the serial link speed */
+    void setDeviceCapacity(unsigned int deviceIndex, unsigned int framesPerSecond);
+    unsigned int getDeviceCapacity(unsigned int deviceIndex) const;
+
+    /** Sum of the frame rates of the streams bound to the device */
+    unsigned int getDeviceLoad(unsigned int deviceIndex) const;
+
+    /** Name the device was opened with or an empty string if there is no such device */
+    std::string getDeviceName(unsigned int deviceIndex) const;
+
+    /** Statistics of a device controller or 0 if there is no such device. Readable without holding the device lock. */
+    const DVControllerStats *getDeviceStats(unsigned int deviceIndex) const;
+
+    /** Exclusive access to the controller of a device e.g. to run bulk jobs with the batch or
+     * pipelined methods. The device lock is held until releaseController() is called so that
+     * streams bound to the device wait meanwhile. Returns 0 if there is no such device.
+     */
+    DVController *acquireController(unsigned int deviceIndex);
+    void releaseController(unsigned int deviceIndex);
+
+    /** Binds a new stream to the device with the most capacity left. The frame rate is the load
+     * the stream puts on the device e.g. twice DV_STREAM_FRAMES_PER_SECOND for a transcoding stream.
+     * Returns the stream identifier or -1 if no device has enough capacity left.
+     */
+    int openStream(unsigned int framesPerSecond = DV_STREAM_FRAMES_PER_SECOND);
+    void closeStream(int streamId);
+
+    /** Device index and channel the stream is bound to */
+    bool getStreamBinding(int streamId, unsigned int& deviceIndex, unsigned int& channel) const;
+
+    /** Same as DVController::encode() on the device and channel the stream is bound to */
+    bool encode(int streamId, const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain = 0);
+
+    /** Same as DVController::decode() on the device and channel the stream is bound to */
+    bool decode(int streamId, short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain = 0);
+
+private:
+    struct Device
+    {
+        std::string name;
+        DVController controller;
+        std::mutex mutex;
+        unsigned int capacity;
+        unsigned int load;
+        unsigned int channelLoad[DV3000_MAX_CHANNELS];
+    };
+
+    struct Stream
+    {
+        bool used;
+        unsigned int deviceIndex;
+        unsigned int channel;
+        unsigned int framesPerSecond;
+    };
+
+    std::vector<Device*> m_devices;
+    std::vector<Stream> m_streams;
+    mutable std::mutex m_mutex; //!< Protects stream allocation and load accounting
+
+    Device *getStreamDevice(int streamId, unsigned int& channel);
+};
+
+} // namespace SerialDV
+
+#endif /* DVDEVICEPOOL_H_ */
@@ -0,0 +1,227 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+
+#if !defined(__WINDOWS__)
+#include <dirent.h>
+#endif
+
+#include "dvdiscovery.h"
+
+namespace SerialDV
+{
+
+DVDiscovery::DVDiscovery()
+{
+}
+
+DVDiscovery::~DVDiscovery()
+{
+    for (unsigned int i = 0; i < m_found.size(); i++)
+    {
+        if (m_found[i].controller)
+        {
+            m_found[i].controller->close();
+            delete m_found[i].controller;
+        }
+    }
+}
+
+void DVDiscovery::listCandidates(std::vector<std::string>& candidates)
+{
+    candidates.clear();
+
+#if defined(__WINDOWS__)
+    for (unsigned int port = 1; port <= 32; port++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "\\\\.\\COM%u", port);
+        candidates.push_back(std::string(name));
+    }
+#else
+    DIR *dir = opendir("/dev");
+
+    if (!dir)
+    {
+        fprintf(stderr, "DVDiscovery::listCandidates: cannot list /dev\n");
+        return;
+    }
+
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != 0)
+    {
+        std::string name(entry->d_name);
+
+        // FTDI based dongles (ThumbDV, DV3000U) and CDC ACM boards
+        if ((name.compare(0, 6, "ttyUSB") == 0) || (name.compare(0, 6, "ttyACM") == 0)) {
+            candidates.push_back("/dev/" + name);
+        }
+    }
+
+    closedir(dir);
+    std::sort(candidates.begin(), candidates.end());
+#endif
+}
+
+void DVDiscovery::probeOne(const std::string *name, SERIAL_SPEED speed, unsigned int timeoutMs, DVController **controller)
+{
+    DVController *candidate = new DVController();
+    candidate->setIdentifyTimeout(timeoutMs);
+
+    if (candidate->open(*name, speed))
+    {
+        *controller = candidate;
+    }
+    else
+    {
+        delete candidate;
+        *controller = 0;
+    }
+}
+
+unsigned int DVDiscovery::probe(const std::vector<std::string>& candidates, SERIAL_SPEED speed, unsigned int timeoutMs)
+{
+    std::vector<std::string> names;
+
+    for (unsigned int i = 0; i < candidates.size(); i++)
+    {
+        if (!isFound(candidates[i]) && (std::find(names.begin(), names.end(), candidates[i]) == names.end())) {
+            names.push_back(candidates[i]);
+        }
+    }
+
+    std::vector<DVController*> controllers(names.size(), (DVController *) 0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int i = 0; i < names.size(); i++) {
+        threads.push_back(std::thread(probeOne, &names[i], speed, timeoutMs, &controllers[i]));
+    }
+
+    unsigned int nbFound = 0;
+
+    for (unsigned int i = 0; i < names.size(); i++)
+    {
+        threads[i].join();
+
+        if (!controllers[i]) {
+            continue;
+        }
+
+        Found found;
+        found.device.name = names[i];
+        found.device.productId = controllers[i]->getProductId();
+        found.device.nbChannels = controllers[i]->getNbChannels();
+        found.controller = controllers[i];
+        m_found.push_back(found);
+        nbFound++;
+
+        fprintf(stderr, "DVDiscovery::probe: %s: %s\n", names[i].c_str(), found.device.productId.c_str());
+    }
+
+    return nbFound;
+}
+
+unsigned int DVDiscovery::discover(const std::string& cachePath, SERIAL_SPEED speed, unsigned int timeoutMs)
+{
+    std::vector<std::string> cached;
+    bool complete = false;
+
+    if (loadCache(cachePath, cached) && !cached.empty()) {
+        complete = probe(cached, speed, timeoutMs) == cached.size();
+    }
+
+    if (!complete)
+    {
+        std::vector<std::string> candidates;
+        listCandidates(candidates);
+        probe(candidates, speed, timeoutMs);
+    }
+
+    saveCache(cachePath);
+    return m_found.size();
+}
+
+DVController *DVDiscovery::releaseController(unsigned int index)
+{
+    if (index >= m_found.size()) {
+        return 0;
+    }
+
+    DVController *controller = m_found[index].controller;
+    m_found[index].controller = 0;
+    return controller;
+}
+
+bool DVDiscovery::saveCache(const std::string& cachePath) const
+{
+    FILE *file = fopen(cachePath.c_str(), "w");
+
+    if (!file)
+    {
+        fprintf(stderr, "DVDiscovery::saveCache: cannot write %s\n", cachePath.c_str());
+        return false;
+    }
+
+    for (unsigned int i = 0; i < m_found.size(); i++) {
+        fprintf(file, "%s %s\n", m_found[i].device.name.c_str(), m_found[i].device.productId.c_str());
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool DVDiscovery::loadCache(const std::string& cachePath, std::vector<std::string>& devices)
+{
+    devices.clear();
+    FILE *file = fopen(cachePath.c_str(), "r");
+
+    if (!file) {
+        return false;
+    }
+
+    char line[1024];
+
+    while (fgets(line, sizeof(line), file))
+    {
+        std::string device(line);
+        size_t end = device.find_first_of(" \r\n");
+
+        if (end != 0) {
+            devices.push_back(device.substr(0, end));
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool DVDiscovery::isFound(const std::string& name) const
+{
+    for (unsigned int i = 0; i < m_found.size(); i++)
+    {
+        if (m_found[i].device.name == name) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace SerialDV
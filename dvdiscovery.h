@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVDISCOVERY_H_
+#define DVDISCOVERY_H_
+
+#include <string>
+#include <vector>
+
+#include "dvcontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int DV_DISCOVERY_IDENTIFY_TIMEOUT_MS = 50U; //!< Default identification timeout when probing ports
+
+/** Device found by DVDiscovery */
+struct DVDiscoveredDevice
+{
+    std::string name;       //!< Device name as given to DVController::open()
+    std::string productId;  //!< Product identification e.g. AMBE3000R or AMBE3003
+    unsigned int nbChannels;
+};
+
+/** Finds the DVSI devices of a host. Candidate ports are probed in parallel, one thread each,
+ * with a short identification timeout so that ports of other devices are ruled out quickly.
+ * The devices found are left open and ready. Their list can be saved to a cache file so that
+ * a restart, e.g. after a USB reset, opens the known devices first without probing every port.
+ */
+class DVDiscovery
+{
+public:
+    DVDiscovery();
+    ~DVDiscovery(); //!< Closes the controllers that have not been released
+
+    /** Serial ports that may be DVSI devices (USB serial adapters), sorted by name */
+    static void listCandidates(std::vector<std::string>& candidates);
+
+    /** Opens the candidates in parallel and keeps those identified as DVSI devices in the
+     * order of the candidates. Candidates already found are skipped.
+     * Returns the number of devices found by this call.
+     */
+    unsigned int probe(const std::vector<std::string>& candidates, SERIAL_SPEED speed = SERIAL_460800,
+            unsigned int timeoutMs = DV_DISCOVERY_IDENTIFY_TIMEOUT_MS);
+
+    /** Opens the devices of the cache file if any. If the cache does not exist or some of its
+     * devices fail all candidate ports are probed. The cache is then rewritten with the devices found.
+     * Returns the number of devices found.
+     */
+    unsigned int discover(const std::string& cachePath, SERIAL_SPEED speed = SERIAL_460800,
+            unsigned int timeoutMs = DV_DISCOVERY_IDENTIFY_TIMEOUT_MS);
+
+    unsigned int getNbDevices() const { return m_found.size(); }
+    const DVDiscoveredDevice& getDevice(unsigned int index) const { return m_found[index].device; }
+
+    /** Controller of a device found. It remains owned by the discovery object */
+    DVController *getController(unsigned int index) const { return m_found[index].controller; }
+
+    /** Hands the controller of a device over to the caller who deletes it when done */
+    DVController *releaseController(unsigned int index);
+
+    /** Cache file holds one device per line: name then product identification separated by a space */
+    bool saveCache(const std::string& cachePath) const;
+    static bool loadCache(const std::string& cachePath, std::vector<std::string>& devices);
+
+private:
+    struct Found
+    {
+        DVDiscoveredDevice device;
+        DVController *controller;
+    };
+
+    std::vector<Found> m_found;
+
+    bool isFound(const std::string& name) const;
+    static void probeOne(const std::string *name, SERIAL_SPEED speed, unsigned int timeoutMs, DVController **controller);
+};
+
+} // namespace SerialDV
+
+#endif /* DVDISCOVERY_H_ */
@@ -0,0 +1,328 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <time.h>
+
+#include "dvframescheduler.h"
+
+namespace SerialDV
+{
+
+DVFrameScheduler::DVFrameScheduler(DVController& controller, DVDropPolicy policy) :
+        m_controller(controller),
+        m_policy(policy),
+        m_callback(0),
+        m_callbackContext(0),
+        m_nbNotified(0)
+{
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+    {
+        m_serviceUs[channel] = DV_SCHEDULER_DEFAULT_SERVICE_US;
+        m_lastCompletionUs[channel] = 0;
+    }
+
+    m_inFlight.reserve(DV3000_MAX_CHANNELS * DV_PIPELINE_MAX_DEPTH);
+    m_freeSlots.reserve(DV3000_MAX_CHANNELS * DV_PIPELINE_MAX_DEPTH);
+}
+
+DVFrameScheduler::~DVFrameScheduler()
+{
+}
+
+void DVFrameScheduler::setCallback(DVScheduledCallback callback, void *context)
+{
+    m_callback = callback;
+    m_callbackContext = context;
+}
+
+bool DVFrameScheduler::SendsAfter::operator()(const Frame& a, const Frame& b) const
+{
+    if (a.priority != b.priority) {
+        return a.priority < b.priority;
+    }
+
+    return a.deadlineUs > b.deadlineUs;
+}
+
+bool DVFrameScheduler::scheduleEncode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+        uint64_t deadlineUs, int priority, unsigned int channel)
+{
+    Frame frame;
+    frame.encode = true;
+    frame.rate = rate;
+    frame.gain = gain;
+    frame.tag = tag;
+    frame.channel = channel;
+    frame.priority = priority;
+    frame.deadlineUs = deadlineUs;
+    frame.dispatchUs = 0;
+    frame.audioIn = audioFrame;
+    frame.audioOut = 0;
+    frame.mbeIn = 0;
+    frame.mbeOut = mbeFrame;
+    return schedule(frame);
+}
+
+bool DVFrameScheduler::scheduleDecode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+        uint64_t deadlineUs, int priority, unsigned int channel)
+{
+    Frame frame;
+    frame.encode = false;
+    frame.rate = rate;
+    frame.gain = gain;
+    frame.tag = tag;
+    frame.channel = channel;
+    frame.priority = priority;
+    frame.deadlineUs = deadlineUs;
+    frame.dispatchUs = 0;
+    frame.audioIn = 0;
+    frame.audioOut = audioFrame;
+    frame.mbeIn = mbeFrame;
+    frame.mbeOut = 0;
+    return schedule(frame);
+}
+
+bool DVFrameScheduler::schedule(const Frame& frame)
+{
+    m_stats.nbScheduled.add(1);
+
+    if (frame.channel >= m_controller.getNbChannels())
+    {
+        fprintf(stderr, "DVFrameScheduler::schedule: invalid channel %u\n", frame.channel);
+        m_stats.nbFailed.add(1);
+        notify(frame, false, false, false, false);
+        return false;
+    }
+
+    // frames in flight and queued frames that will be sent before this one
+    std::vector<Frame>& queue = m_queues[frame.channel];
+    unsigned int nbAhead = m_controller.getNbInFlight(frame.channel);
+    SendsAfter sendsAfter;
+
+    for (unsigned int i = 0; i < queue.size(); i++)
+    {
+        if (!sendsAfter(queue[i], frame)) {
+            nbAhead++;
+        }
+    }
+
+    if (estimateCompletion(frame.channel, nbAhead, nowUs()) > frame.deadlineUs)
+    {
+        drop(frame, true);
+        return false;
+    }
+
+    queue.push_back(frame);
+    std::push_heap(queue.begin(), queue.end(), sendsAfter);
+    return true;
+}
+
+uint64_t DVFrameScheduler::estimateCompletion(unsigned int channel, unsigned int nbAhead, uint64_t now) const
+{
+    return now + (uint64_t) (nbAhead + 1) * m_serviceUs[channel];
+}
+
+bool DVFrameScheduler::dispatch(unsigned int channel)
+{
+    std::vector<Frame>& queue = m_queues[channel];
+    bool sent = false;
+
+    while (!queue.empty() && (m_controller.getNbInFlight(channel) < m_controller.getPipelineDepth()))
+    {
+        std::pop_heap(queue.begin(), queue.end(), SendsAfter());
+        Frame frame = queue.back();
+        queue.pop_back();
+
+        uint64_t now = nowUs();
+
+        if (estimateCompletion(channel, m_controller.getNbInFlight(channel), now) > frame.deadlineUs)
+        {
+            drop(frame, false);
+            continue;
+        }
+
+        unsigned int slot;
+
+        if (m_freeSlots.empty())
+        {
+            slot = m_inFlight.size();
+            m_inFlight.push_back(frame);
+        }
+        else
+        {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+            m_inFlight[slot] = frame;
+        }
+
+        m_inFlight[slot].dispatchUs = now;
+
+        bool ok = frame.encode ?
+                m_controller.submitEncode(frame.audioIn, frame.mbeOut, frame.rate, frame.gain, slot, channel) :
+                m_controller.submitDecode(frame.audioOut, frame.mbeIn, frame.rate, frame.gain, slot, channel);
+
+        if (!ok)
+        {
+            m_freeSlots.push_back(slot);
+            m_stats.nbFailed.add(1);
+            notify(frame, false, false, false, false);
+            continue;
+        }
+
+        sent = true;
+    }
+
+    return sent;
+}
+
+void DVFrameScheduler::drop(const Frame& frame, bool admission)
+{
+    bool silence = false;
+
+    if (m_policy == DVDropPolicySilence)
+    {
+        if (!frame.encode)
+        {
+            memset(frame.audioOut, 0, MBE_AUDIO_BLOCK_BYTES);
+            silence = true;
+        }
+        else if (frame.rate == DVRate3600x2400)
+        {
+            memcpy(frame.mbeOut, DV_DSTAR_SILENCE_FRAME, sizeof(DV_DSTAR_SILENCE_FRAME));
+            silence = true;
+        }
+    }
+
+    if (admission) {
+        m_stats.nbDroppedAdmission.add(1);
+    } else {
+        m_stats.nbDroppedDispatch.add(1);
+    }
+
+    if (silence) {
+        m_stats.nbSilenced.add(1);
+    }
+
+    notify(frame, false, true, silence, false);
+}
+
+void DVFrameScheduler::complete(const Frame& frame, bool ok, uint64_t now)
+{
+    unsigned int channel = frame.channel;
+
+    // time per frame: from the previous completion while the channel was busy else from the dispatch
+    uint64_t start = std::max(m_lastCompletionUs[channel], frame.dispatchUs);
+    int64_t sample = now - start;
+    int64_t service = m_serviceUs[channel];
+    m_serviceUs[channel] = (uint32_t) (service + (sample - service) / 8);
+    m_lastCompletionUs[channel] = now;
+
+    bool late = now > frame.deadlineUs;
+
+    if (!ok) {
+        m_stats.nbFailed.add(1);
+    } else {
+        m_stats.nbCompleted.add(1);
+    }
+
+    if (late) {
+        m_stats.nbLate.add(1);
+    } else {
+        m_stats.slack.add(frame.deadlineUs - now);
+    }
+
+    notify(frame, ok, false, false, late);
+}
+
+void DVFrameScheduler::notify(const Frame& frame, bool ok, bool dropped, bool silence, bool late)
+{
+    m_nbNotified++;
+
+    if (m_callback)
+    {
+        DVScheduledCompletion completion;
+        completion.tag = frame.tag;
+        completion.channel = frame.channel;
+        completion.encode = frame.encode;
+        completion.ok = ok;
+        completion.dropped = dropped;
+        completion.silence = silence;
+        completion.late = late;
+        m_callback(completion, m_callbackContext);
+    }
+}
+
+unsigned int DVFrameScheduler::process()
+{
+    unsigned int nbChannels = m_controller.getNbChannels();
+    uint64_t nbNotified = m_nbNotified;
+
+    while (true)
+    {
+        for (unsigned int channel = 0; channel < nbChannels; channel++) {
+            dispatch(channel);
+        }
+
+        DVCompletion completion;
+
+        if (!m_controller.pollCompletion(completion)) {
+            break; // nothing in flight and every queue has been emptied by dispatch
+        }
+
+        if (completion.tag < m_inFlight.size())
+        {
+            complete(m_inFlight[completion.tag], completion.ok, nowUs());
+            m_freeSlots.push_back(completion.tag);
+        }
+    }
+
+    return m_nbNotified - nbNotified;
+}
+
+void DVFrameScheduler::reserve(unsigned int nbFramesPerChannel)
+{
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+        m_queues[channel].reserve(nbFramesPerChannel);
+    }
+}
+
+unsigned int DVFrameScheduler::getNbQueued() const
+{
+    unsigned int nbQueued = 0;
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+        nbQueued += m_queues[channel].size();
+    }
+
+    return nbQueued;
+}
+
+uint32_t DVFrameScheduler::getServiceTimeUs(unsigned int channel) const
+{
+    return channel < DV3000_MAX_CHANNELS ? m_serviceUs[channel] : 0;
+}
+
+uint64_t DVFrameScheduler::nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+} // namespace SerialDV
@@ -0,0 +1,149 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVFRAMESCHEDULER_H_
+#define DVFRAMESCHEDULER_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include "dvcontroller.h"
+#include "dvstats.h"
+
+namespace SerialDV
+{
+
+const uint32_t DV_SCHEDULER_DEFAULT_SERVICE_US = 8000U; //!< Initial estimate of the time the device takes per frame
+
+typedef enum
+{
+    DVDropPolicyDrop,    //!< Dropped frames are reported as failed with output left untouched
+    DVDropPolicySilence  //!< Dropped frames are reported as failed with silence written to the output
+} DVDropPolicy;
+
+/** Outcome of a frame given to the scheduler */
+struct DVScheduledCompletion
+{
+    unsigned int tag;     //!< Tag given by the caller when scheduled
+    unsigned int channel;
+    bool encode;
+    bool ok;              //!< Processed by the device
+    bool dropped;         //!< Not sent because it would have missed its deadline
+    bool silence;         //!< Dropped and silence written to the output
+    bool late;            //!< Processed but completed after its deadline
+};
+
+typedef void (*DVScheduledCallback)(const DVScheduledCompletion& completion, void *context);
+
+/** Deadline aware scheduler in front of a DVController. Each frame comes with a deadline
+ * (absolute time from nowUs()) and a priority. Frames are sent to the device highest priority
+ * first then earliest deadline first. The time the device takes per frame is measured on each
+ * channel and a frame that cannot complete before its deadline is dropped when scheduled or
+ * when it is about to be sent rather than queued behind the others. Depending on the policy
+ * dropped frames get silence in their output so that the audio stream keeps its pace.
+ * This bounds the latency of the frames that are processed when the device is oversubscribed.
+ *
+ * The device controller is not owned and must not be used directly meanwhile. All methods
+ * except getStats() are called from the same thread.
+ */
+class DVFrameScheduler
+{
+public:
+    DVFrameScheduler(DVController& controller, DVDropPolicy policy = DVDropPolicyDrop);
+    ~DVFrameScheduler();
+
+    void setDropPolicy(DVDropPolicy policy) { m_policy = policy; }
+    DVDropPolicy getDropPolicy() const { return m_policy; }
+
+    /** Callback called for each frame when it is processed or dropped */
+    void setCallback(DVScheduledCallback callback, void *context);
+
+    /** Schedules a frame. Buffers must remain valid until its completion.
+     * Returns false if the frame was dropped right away in which case the callback has already been called.
+     */
+    bool scheduleEncode(const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+            uint64_t deadlineUs, int priority = 0, unsigned int channel = 0);
+    bool scheduleDecode(short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag,
+            uint64_t deadlineUs, int priority = 0, unsigned int channel = 0);
+
+    /** Sends the scheduled frames to the device as its pipelines drain and waits for their replies.
+     * Returns when no frame is left. Returns the number of frames that completed or were dropped.
+     */
+    unsigned int process();
+
+    /** Number of frames waiting to be sent */
+    unsigned int getNbQueued() const;
+
+    /** Preallocates the queue of each channel so that scheduling up to this number of frames
+     * waiting per channel does not allocate. Frames in flight never allocate.
+     */
+    void reserve(unsigned int nbFramesPerChannel);
+
+    /** Current estimate of the time the device takes per frame on a channel */
+    uint32_t getServiceTimeUs(unsigned int channel) const;
+
+    const DVSchedulerStats& getStats() const { return m_stats; }
+    void resetStats() { m_stats.reset(); }
+
+    /** Current time in microseconds on the clock used for the deadlines */
+    static uint64_t nowUs();
+
+private:
+    struct Frame
+    {
+        bool encode;
+        DVRate rate;
+        int gain;
+        unsigned int tag;
+        unsigned int channel;
+        int priority;
+        uint64_t deadlineUs;
+        uint64_t dispatchUs;   //!< Time sent to the device
+        const short *audioIn;
+        short *audioOut;
+        const unsigned char *mbeIn;
+        unsigned char *mbeOut;
+    };
+
+    /** Heap order: true if a is to be sent after b */
+    struct SendsAfter
+    {
+        bool operator()(const Frame& a, const Frame& b) const;
+    };
+
+    DVController& m_controller;
+    DVDropPolicy m_policy;
+    DVScheduledCallback m_callback;
+    void *m_callbackContext;
+    std::vector<Frame> m_queues[DV3000_MAX_CHANNELS];   //!< Heaps of frames waiting per channel
+    std::vector<Frame> m_inFlight;                      //!< Frames sent indexed by the controller tag
+    std::vector<unsigned int> m_freeSlots;              //!< Free indexes of m_inFlight
+    uint32_t m_serviceUs[DV3000_MAX_CHANNELS];          //!< Moving average of the time per frame
+    uint64_t m_lastCompletionUs[DV3000_MAX_CHANNELS];
+    DVSchedulerStats m_stats;
+    uint64_t m_nbNotified;                              //!< Frames the callback has been called for
+
+    bool schedule(const Frame& frame);
+    bool dispatch(unsigned int channel);
+    void drop(const Frame& frame, bool admission);
+    void complete(const Frame& frame, bool ok, uint64_t now);
+    void notify(const Frame& frame, bool ok, bool dropped, bool silence, bool late);
+    uint64_t estimateCompletion(unsigned int channel, unsigned int nbAhead, uint64_t now) const;
+};
+
+} // namespace SerialDV
+
+#endif /* DVFRAMESCHEDULER_H_ */
@@ -0,0 +1,721 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#include <cstdio>
+#include <cstring>
+#include <cstdarg>
+#include <cctype>
+#include <chrono>
+#include <algorithm>
+
+#if !defined(__WINDOWS__)
+
+#include <cerrno>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#endif
+
+#include "dvmetricsexporter.h"
+
+namespace SerialDV
+{
+
+namespace
+{
+
+const unsigned int DV_METRICS_BUCKET_STRIDE = 4U;      //!< Histogram buckets merged in an exported one: 4 per power of two
+const uint32_t DV_METRICS_MAX_LE_US = 1U << 24;        //!< Exported latency buckets up to 2^24 us then +Inf
+const unsigned int DV_METRICS_REQUEST_MAX = 4096U;     //!< Longest HTTP request header read
+const int DV_METRICS_POLL_MS = 100;                    //!< Time between checks of the stop flag by the threads
+const int DV_METRICS_CLIENT_TIMEOUT_MS = 5000;         //!< Longest time a HTTP client may take to send its request and read the answer
+
+const char *operationNames[DVOperationCount] = {"encode", "decode", "control"};
+
+/** One value of a controller. Histograms are exported as such in Prometheus and as p50, p99
+ * and max gauges in statsd.
+ */
+struct Metric
+{
+    const char *name;
+    const char *help;
+    bool counter;
+    int channel;                          //!< -1 for a device metric
+    const char *operation;                //!< Operation label or 0
+    uint64_t value;
+    const DVLatencyHistogram *histogram;  //!< Non null for a latency histogram in microseconds
+};
+
+void addMetric(std::vector<Metric>& metrics, const char *name, const char *help, bool counter, int channel, const char *operation,
+    uint64_t value, const DVLatencyHistogram *histogram = 0)
+{
+    Metric metric;
+    metric.name = name;
+    metric.help = help;
+    metric.counter = counter;
+    metric.channel = channel;
+    metric.operation = operation;
+    metric.value = value;
+    metric.histogram = histogram;
+    metrics.push_back(metric);
+}
+
+/** Metrics of a controller always in the same order for a given number of channels */
+void collect(const DVController& controller, std::vector<Metric>& metrics)
+{
+    const DVControllerStats& stats = controller.getStats();
+
+    for (unsigned int channel = 0; channel < controller.getNbChannels(); channel++)
+    {
+        const DVChannelStats& channelStats = stats.channels[channel];
+        addMetric(metrics, "frames_submitted", "Encode and decode frames sent to the channel", true, channel, 0, channelStats.nbSubmitted.get());
+        addMetric(metrics, "frames_completed", "Frames answered successfully", true, channel, 0, channelStats.nbCompleted.get());
+        addMetric(metrics, "frames_failed", "Frames not answered or discarded", true, channel, 0, channelStats.nbFailed.get());
+        addMetric(metrics, "frames_in_flight", "Frames submitted and not completed yet", false, channel, 0, channelStats.getNbInFlight());
+        addMetric(metrics, "rate_changes", "Rate configurations sent", true, channel, 0, channelStats.nbRateChanges.get());
+        addMetric(metrics, "gain_changes", "Gain configurations sent", true, channel, 0, channelStats.nbGainChanges.get());
+        addMetric(metrics, "frame_latency", "Submission to completion of the frames", false, channel, 0, 0, &channelStats.latency);
+    }
+
+    for (unsigned int operation = 0; operation < DVOperationCount; operation++)
+    {
+        const DVOperationStats& operationStats = stats.operations[operation];
+        addMetric(metrics, "requests_completed", "Requests answered", true, -1, operationNames[operation], operationStats.nbCompleted.get());
+        addMetric(metrics, "requests_failed", "Requests timed out or mismatched", true, -1, operationNames[operation], operationStats.nbFailed.get());
+        addMetric(metrics, "first_byte", "End of the write to the first byte of the reply", false, -1, operationNames[operation], 0, &operationStats.firstByteTime);
+    }
+
+    addMetric(metrics, "timeouts", "Replies not received in time", true, -1, 0, stats.nbTimeouts.get());
+    addMetric(metrics, "mismatches", "Replies of another type than expected", true, -1, 0, stats.nbMismatches.get());
+    addMetric(metrics, "unexpected", "Replies with no pending request on their channel", true, -1, 0, stats.nbUnexpected.get());
+    addMetric(metrics, "resyncs", "Recoveries after losing track of the replies", true, -1, 0, stats.nbResyncs.get());
+    addMetric(metrics, "resets", "Chip resets done by the recoveries", true, -1, 0, stats.nbResets.get());
+    addMetric(metrics, "bytes_written", "Bytes written to the device", true, -1, 0, stats.nbBytesWritten.get());
+    addMetric(metrics, "bytes_read", "Bytes read from the device", true, -1, 0, stats.nbBytesRead.get());
+    addMetric(metrics, "bytes_flushed", "Stale bytes discarded by the recoveries", true, -1, 0, stats.nbBytesFlushed.get());
+}
+
+void appendFormat(std::string& text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+void appendFormat(std::string& text, const char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length > 0) {
+        text.append(buffer, std::min((size_t) length, sizeof(buffer) - 1));
+    }
+}
+
+/** Prometheus labels of a metric between braces with an optional extra label */
+std::string promLabels(const std::string& device, const Metric& metric, const char *extra = 0)
+{
+    std::string labels = "{device=\"";
+
+    for (std::string::const_iterator it = device.begin(); it != device.end(); ++it)
+    {
+        if (*it == '\\' || *it == '"') {
+            labels += '\\';
+        }
+
+        labels += *it == '\n' ? ' ' : *it;
+    }
+
+    labels += '"';
+
+    if (metric.channel >= 0) {
+        appendFormat(labels, ",channel=\"%d\"", metric.channel);
+    }
+
+    if (metric.operation) {
+        appendFormat(labels, ",operation=\"%s\"", metric.operation);
+    }
+
+    if (extra)
+    {
+        labels += ',';
+        labels += extra;
+    }
+
+    labels += '}';
+    return labels;
+}
+
+/** Device name usable in a statsd metric name */
+std::string statsdName(const std::string& device)
+{
+    std::string name = device;
+
+    for (std::string::iterator it = name.begin(); it != name.end(); ++it)
+    {
+        if (!isalnum((unsigned char) *it) && (*it != '-') && (*it != '_')) {
+            *it = '_';
+        }
+    }
+
+    return name;
+}
+
+} // namespace
+
+DVMetricsExporter::DVMetricsExporter() :
+        m_stop(false),
+        m_httpFd(-1),
+        m_statsdFd(-1),
+        m_statsdPeriodMs(DV_METRICS_DEFAULT_PERIOD_MS)
+{
+}
+
+DVMetricsExporter::~DVMetricsExporter()
+{
+    stop();
+}
+
+bool DVMetricsExporter::addController(const DVController *controller, const std::string& device)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_exported.size() >= DV_METRICS_MAX_CONTROLLERS)
+    {
+        fprintf(stderr, "DVMetricsExporter::addController: more than %u controllers\n", DV_METRICS_MAX_CONTROLLERS);
+        return false;
+    }
+
+    Exported exported;
+    exported.controller = controller;
+    exported.device = device;
+    m_exported.push_back(exported);
+    return true;
+}
+
+void DVMetricsExporter::removeController(const DVController *controller)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (std::vector<Exported>::iterator it = m_exported.begin(); it != m_exported.end(); ++it)
+    {
+        if (it->controller == controller)
+        {
+            m_exported.erase(it);
+            return;
+        }
+    }
+}
+
+void DVMetricsExporter::writePrometheus(std::string& text)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::vector<Metric> > metrics(m_exported.size());
+    std::vector<const char*> names; // metric families in order of first appearance
+
+    for (unsigned int i = 0; i < m_exported.size(); i++)
+    {
+        collect(*m_exported[i].controller, metrics[i]);
+
+        for (unsigned int j = 0; j < metrics[i].size(); j++)
+        {
+            if (std::find(names.begin(), names.end(), metrics[i][j].name) == names.end()) {
+                names.push_back(metrics[i][j].name);
+            }
+        }
+    }
+
+    // samples of a family are grouped under its HELP and TYPE lines
+    for (unsigned int n = 0; n < names.size(); n++)
+    {
+        bool header = false;
+
+        for (unsigned int i = 0; i < m_exported.size(); i++)
+        {
+            for (unsigned int j = 0; j < metrics[i].size(); j++)
+            {
+                const Metric& metric = metrics[i][j];
+
+                if (metric.name != names[n]) {
+                    continue;
+                }
+
+                const char *suffix = metric.histogram ? "_seconds" : metric.counter ? "_total" : "";
+
+                if (!header)
+                {
+                    appendFormat(text, "# HELP serialdv_%s%s %s\n", metric.name, suffix, metric.help);
+                    appendFormat(text, "# TYPE serialdv_%s%s %s\n", metric.name, suffix, metric.histogram ? "histogram" : metric.counter ? "counter" : "gauge");
+                    header = true;
+                }
+
+                if (!metric.histogram)
+                {
+                    appendFormat(text, "serialdv_%s%s%s %llu\n", metric.name, suffix, promLabels(m_exported[i].device, metric).c_str(),
+                        (unsigned long long) metric.value);
+                    continue;
+                }
+
+                uint64_t cumulated = 0;
+
+                for (unsigned int bucket = 0; bucket < DV_LATENCY_BUCKETS; bucket++)
+                {
+                    char le[32];
+                    uint32_t upper = DVLatencyHistogram::getBucketUpperBound(bucket);
+                    cumulated += metric.histogram->getBucketCount(bucket);
+
+                    if (upper >= DV_METRICS_MAX_LE_US) {
+                        break;
+                    }
+                    if ((bucket + 1) % DV_METRICS_BUCKET_STRIDE != 0) {
+                        continue;
+                    }
+
+                    snprintf(le, sizeof(le), "le=\"%.6f\"", upper / 1e6);
+                    appendFormat(text, "serialdv_%s_seconds_bucket%s %llu\n", metric.name, promLabels(m_exported[i].device, metric, le).c_str(),
+                        (unsigned long long) cumulated);
+                }
+
+                std::string labels = promLabels(m_exported[i].device, metric);
+                uint64_t count = metric.histogram->getCount();
+                appendFormat(text, "serialdv_%s_seconds_bucket%s %llu\n", metric.name, promLabels(m_exported[i].device, metric, "le=\"+Inf\"").c_str(),
+                    (unsigned long long) count);
+                appendFormat(text, "serialdv_%s_seconds_sum%s %.6f\n", metric.name, labels.c_str(), metric.histogram->getSum() / 1e6);
+                appendFormat(text, "serialdv_%s_seconds_count%s %llu\n", metric.name, labels.c_str(), (unsigned long long) count);
+            }
+        }
+    }
+}
+
+void DVMetricsExporter::writeStatsd(std::string& text, const std::string& prefix)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Metric> metrics;
+
+    for (unsigned int i = 0; i < m_exported.size(); i++)
+    {
+        Exported& exported = m_exported[i];
+        std::string device = prefix + "." + statsdName(exported.device);
+        unsigned int counter = 0;
+
+        metrics.clear();
+        collect(*exported.controller, metrics);
+
+        for (unsigned int j = 0; j < metrics.size(); j++)
+        {
+            const Metric& metric = metrics[j];
+            std::string name = device;
+
+            if (metric.channel >= 0) {
+                appendFormat(name, ".channel%d", metric.channel);
+            }
+
+            if (metric.operation)
+            {
+                name += '.';
+                name += metric.operation;
+            }
+
+            name += '.';
+            name += metric.name;
+
+            if (metric.histogram)
+            {
+                appendFormat(text, "%s.p50:%u|g\n", name.c_str(), metric.histogram->getP50());
+                appendFormat(text, "%s.p99:%u|g\n", name.c_str(), metric.histogram->getP99());
+                appendFormat(text, "%s.max:%u|g\n", name.c_str(), metric.histogram->getMax());
+            }
+            else if (metric.counter)
+            {
+                if (counter == exported.lastCounters.size()) {
+                    exported.lastCounters.push_back(0);
+                }
+
+                uint64_t last = exported.lastCounters[counter];
+                uint64_t delta = metric.value >= last ? metric.value - last : metric.value; // reset in between
+                exported.lastCounters[counter++] = metric.value;
+
+                if (delta != 0) {
+                    appendFormat(text, "%s:%llu|c\n", name.c_str(), (unsigned long long) delta);
+                }
+            }
+            else
+            {
+                appendFormat(text, "%s:%llu|g\n", name.c_str(), (unsigned long long) metric.value);
+            }
+        }
+    }
+}
+
+#if defined(__WINDOWS__)
+
+bool DVMetricsExporter::startHttp(unsigned int port, const std::string& address)
+{
+    fprintf(stderr, "DVMetricsExporter::startHttp: %s:%u: not supported on Windows\n", address.c_str(), port);
+    return false;
+}
+
+bool DVMetricsExporter::startStatsd(const std::string& host, unsigned int port, unsigned int periodMs __attribute__((unused)),
+    const std::string& prefix __attribute__((unused)))
+{
+    fprintf(stderr, "DVMetricsExporter::startStatsd: %s:%u: not supported on Windows\n", host.c_str(), port);
+    return false;
+}
+
+void DVMetricsExporter::stop()
+{
+}
+
+void DVMetricsExporter::serveHttp()
+{
+}
+
+void DVMetricsExporter::pushStatsd()
+{
+}
+
+void DVMetricsExporter::answerHttp(int fd __attribute__((unused)))
+{
+}
+
+#else
+
+bool DVMetricsExporter::startHttp(unsigned int port, const std::string& address)
+{
+    if (m_httpFd >= 0)
+    {
+        fprintf(stderr, "DVMetricsExporter::startHttp: already started\n");
+        return false;
+    }
+
+    struct addrinfo hints, *addresses;
+    char service[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    snprintf(service, sizeof(service), "%u", port);
+
+    int err = getaddrinfo(address.empty() ? 0 : address.c_str(), service, &hints, &addresses);
+
+    if (err != 0)
+    {
+        fprintf(stderr, "DVMetricsExporter::startHttp: %s:%u: %s\n", address.c_str(), port, gai_strerror(err));
+        return false;
+    }
+
+    for (struct addrinfo *ai = addresses; ai && (m_httpFd < 0); ai = ai->ai_next)
+    {
+        int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        int on = 1;
+
+        if (fd < 0) {
+            continue;
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if ((::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) && (::listen(fd, 8) == 0)) {
+            m_httpFd = fd;
+        } else {
+            ::close(fd);
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    if (m_httpFd < 0)
+    {
+        fprintf(stderr, "DVMetricsExporter::startHttp: cannot listen on %s:%u: %s\n", address.c_str(), port, strerror(errno));
+        return false;
+    }
+
+    m_stop = false;
+    m_httpThread = std::thread(&DVMetricsExporter::serveHttp, this);
+    return true;
+}
+
+bool DVMetricsExporter::startStatsd(const std::string& host, unsigned int port, unsigned int periodMs, const std::string& prefix)
+{
+    if (m_statsdFd >= 0)
+    {
+        fprintf(stderr, "DVMetricsExporter::startStatsd: already started\n");
+        return false;
+    }
+
+    struct addrinfo hints, *addresses;
+    char service[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%u", port);
+
+    int err = getaddrinfo(host.c_str(), service, &hints, &addresses);
+
+    if (err != 0)
+    {
+        fprintf(stderr, "DVMetricsExporter::startStatsd: %s:%u: %s\n", host.c_str(), port, gai_strerror(err));
+        return false;
+    }
+
+    for (struct addrinfo *ai = addresses; ai && (m_statsdFd < 0); ai = ai->ai_next)
+    {
+        int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            m_statsdFd = fd;
+        } else {
+            ::close(fd);
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    if (m_statsdFd < 0)
+    {
+        fprintf(stderr, "DVMetricsExporter::startStatsd: cannot reach %s:%u: %s\n", host.c_str(), port, strerror(errno));
+        return false;
+    }
+
+    m_statsdPeriodMs = periodMs == 0 ? DV_METRICS_DEFAULT_PERIOD_MS : periodMs;
+    m_statsdPrefix = prefix;
+    m_stop = false;
+    m_statsdThread = std::thread(&DVMetricsExporter::pushStatsd, this);
+    return true;
+}
+
+void DVMetricsExporter::stop()
+{
+    m_stop = true;
+
+    if (m_httpThread.joinable()) {
+        m_httpThread.join();
+    }
+
+    if (m_statsdThread.joinable()) {
+        m_statsdThread.join();
+    }
+
+    if (m_httpFd >= 0)
+    {
+        ::close(m_httpFd);
+        m_httpFd = -1;
+    }
+
+    if (m_statsdFd >= 0)
+    {
+        ::close(m_statsdFd);
+        m_statsdFd = -1;
+    }
+
+    m_stop = false;
+}
+
+namespace
+{
+
+/** Waits for the events on a client socket until the deadline. Returns false on timeout, error or stop */
+bool waitClient(int fd, short events, std::chrono::steady_clock::time_point deadline, const std::atomic<bool>& stop)
+{
+    while (!stop)
+    {
+        long long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+        if (remainingMs <= 0)
+        {
+            fprintf(stderr, "DVMetricsExporter::answerHttp: client too slow, connection dropped\n");
+            return false;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+
+        int ready = ::poll(&pfd, 1, remainingMs < DV_METRICS_POLL_MS ? (int) remainingMs : DV_METRICS_POLL_MS);
+
+        if (ready > 0) {
+            return (pfd.revents & (POLLERR | POLLNVAL)) == 0;
+        }
+
+        if ((ready < 0) && (errno != EINTR)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+void DVMetricsExporter::serveHttp()
+{
+    while (!m_stop)
+    {
+        struct pollfd pfd;
+        pfd.fd = m_httpFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (::poll(&pfd, 1, DV_METRICS_POLL_MS) <= 0) {
+            continue;
+        }
+
+        int fd = ::accept4(m_httpFd, 0, 0, SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        answerHttp(fd);
+        ::close(fd);
+    }
+}
+
+void DVMetricsExporter::answerHttp(int fd)
+{
+    char request[DV_METRICS_REQUEST_MAX + 1];
+    unsigned int length = 0;
+    // one deadline for the whole exchange so that a slow or stalled client cannot hold the thread
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DV_METRICS_CLIENT_TIMEOUT_MS);
+
+    // the request line is all that matters but the whole header is read before answering
+    while (length < DV_METRICS_REQUEST_MAX)
+    {
+        if (!waitClient(fd, POLLIN, deadline, m_stop)) {
+            return;
+        }
+
+        ssize_t len = ::recv(fd, request + length, DV_METRICS_REQUEST_MAX - length, MSG_DONTWAIT);
+
+        if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+            continue;
+        }
+
+        if (len <= 0) {
+            return;
+        }
+
+        length += len;
+        request[length] = '\0';
+
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+
+    request[length] = '\0';
+    bool metrics = (strncmp(request, "GET /metrics ", 13) == 0) || (strncmp(request, "GET /metrics?", 13) == 0);
+    std::string body;
+    std::string response;
+
+    if (metrics)
+    {
+        writePrometheus(body);
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n";
+    }
+    else
+    {
+        body = "Not found\n";
+        response = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\n";
+    }
+
+    appendFormat(response, "Content-Length: %u\r\nConnection: close\r\n\r\n", (unsigned int) body.size());
+    response += body;
+
+    const char *data = response.data();
+    size_t remaining = response.size();
+
+    while (remaining > 0)
+    {
+        if (!waitClient(fd, POLLOUT, deadline, m_stop)) {
+            return;
+        }
+
+        ssize_t len = ::send(fd, data, remaining, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+            continue;
+        }
+
+        if (len <= 0) {
+            return;
+        }
+
+        data += len;
+        remaining -= len;
+    }
+}
+
+void DVMetricsExporter::pushStatsd()
+{
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        bool stopping = m_stop; // the counters are pushed one last time when stopping
+
+        if (!stopping && (std::chrono::steady_clock::now() < next))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(DV_METRICS_POLL_MS));
+            continue;
+        }
+
+        next += std::chrono::milliseconds(m_statsdPeriodMs);
+        std::string text;
+        writeStatsd(text, m_statsdPrefix);
+
+        // datagrams end on a line boundary
+        size_t start = 0;
+
+        while (start < text.size())
+        {
+            size_t end = start;
+
+            while (end < text.size())
+            {
+                size_t line = text.find('\n', end);
+                line = line == std::string::npos ? text.size() : line + 1;
+
+                if ((line - start > DV_METRICS_MAX_DATAGRAM) && (end > start)) {
+                    break;
+                }
+
+                end = line;
+            }
+
+            if (::send(m_statsdFd, text.data() + start, end - start, 0) < 0) {
+                fprintf(stderr, "DVMetricsExporter::pushStatsd: send: %s\n", strerror(errno));
+            }
+
+            start = end;
+        }
+
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+#endif
+
+} // namespace SerialDV
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef DVMETRICSEXPORTER_H_
+#define DVMETRICSEXPORTER_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+#include "dvcontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int DV_METRICS_MAX_CONTROLLERS = 64U;       //!< Controllers of one exporter
+const unsigned int DV_METRICS_DEFAULT_PERIOD_MS = 10000U;  //!< Default statsd push period
+const unsigned int DV_METRICS_MAX_DATAGRAM = 1400U;        //!< statsd lines are sent in datagrams of at most this size
+
+/** Exports the statistics of controllers to Prometheus or statsd. The exporter only reads the
+ * counters and histograms the controllers update with relaxed atomic operations so that it
+ * adds nothing to their hot path and may run in its own thread.
+ *
+ * Per device and channel it reports the frames submitted, completed and failed from which the
+ * frame rates are derived, the frames in flight, the round trip latency histogram and the rate
+ * and gain changes. Per device it reports the requests and reply times per operation, the
+ * timeouts, mismatched and unexpected replies, the resyncs and resets and the link bytes.
+ *
+ * Metrics can either be pulled in the Prometheus text format from an HTTP endpoint started with
+ * startHttp() or pushed periodically to a statsd server over UDP with startStatsd(). Controllers
+ * are added once open and removed before being closed.
+ */
+class DVMetricsExporter
+{
+public:
+    DVMetricsExporter();
+    ~DVMetricsExporter();
+
+    /** Adds an open controller. The device name is the device label of its metrics.
+     * Returns false if the exporter has DV_METRICS_MAX_CONTROLLERS controllers already.
+     */
+    bool addController(const DVController *controller, const std::string& device);
+    void removeController(const DVController *controller);
+
+    /** Appends the metrics of all controllers in the Prometheus text exposition format */
+    void writePrometheus(std::string& text);
+
+    /** Appends the metrics of all controllers as statsd lines. Counters are given as the increment
+     * since the previous call, frames in flight as gauges and latencies as p50, p99 and max gauges
+     * in microseconds.
+     */
+    void writeStatsd(std::string& text, const std::string& prefix);
+
+    /** Serves the Prometheus metrics to GET /metrics requests on the given TCP port from a thread */
+    bool startHttp(unsigned int port, const std::string& address = "0.0.0.0");
+
+    /** Sends the statsd lines to host:port over UDP every periodMs milliseconds from a thread */
+    bool startStatsd(const std::string& host, unsigned int port, unsigned int periodMs = DV_METRICS_DEFAULT_PERIOD_MS,
+        const std::string& prefix = "serialdv");
+
+    /** Stops the HTTP and statsd threads */
+    void stop();
+
+private:
+    struct Exported
+    {
+        const DVController *controller;
+        std::string device;
+        std::vector<uint64_t> lastCounters; //!< Counter values at the previous statsd push
+    };
+
+    std::vector<Exported> m_exported;
+    std::mutex m_mutex;                     //!< Protects the controllers list
+    std::atomic<bool> m_stop;
+    std::thread m_httpThread;
+    std::thread m_statsdThread;
+    int m_httpFd;
+    int m_statsdFd;
+    unsigned int m_statsdPeriodMs;
+    std::string m_statsdPrefix;
+
+    void serveHttp();
+    void pushStatsd();
+    void answerHttp(int fd);
+};
+
+} // namespace SerialDV
+
+#endif /* DVMETRICSEXPORTER_H_ */
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVMPSCQUEUE_H_
+#define DVMPSCQUEUE_H_
+
+#include <atomic>
+
+#include "dvspscqueue.h"
+
+namespace SerialDV
+{
+
+/** Unbounded intrusive lock-free queue with any number of producer threads and a single
+ * consumer thread (D. Vyukov's algorithm). Items are linked through their mpscNext member
+ * so that pushing allocates nothing and takes one atomic exchange whatever the number of
+ * producers. An item must not be pushed again before it is popped. A push in progress makes
+ * the items pushed after it invisible to the consumer until it is complete.
+ */
+template<typename T>
+class DVMPSCQueue
+{
+public:
+    DVMPSCQueue() : m_head(&m_stub), m_tail(&m_stub)
+    {
+        m_stub.mpscNext.store(0, std::memory_order_relaxed);
+    }
+
+    /** Producer side. Any thread */
+    void push(T *item)
+    {
+        item->mpscNext.store(0, std::memory_order_relaxed);
+        T *previous = m_head.exchange(item, std::memory_order_acq_rel);
+        previous->mpscNext.store(item, std::memory_order_release);
+    }
+
+    /** Consumer side. Returns 0 if the queue is empty or the next push is in progress */
+    T *pop()
+    {
+        T *tail = m_tail;
+        T *next = tail->mpscNext.load(std::memory_order_acquire);
+
+        if (tail == &m_stub)
+        {
+            if (!next) {
+                return 0;
+            }
+
+            m_tail = next;
+            tail = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            return 0; // a producer has not linked its item yet
+        }
+
+        // the last item is only popped once the stub is behind it
+        push(&m_stub);
+        next = tail->mpscNext.load(std::memory_order_acquire);
+
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        return 0;
+    }
+
+    /** Consumer side */
+    bool empty() const
+    {
+        return (m_tail == &m_stub) && (m_stub.mpscNext.load(std::memory_order_acquire) == 0);
+    }
+
+private:
+    std::atomic<T*> m_head; //!< Last item pushed written by the producers
+    char m_headPadding[DV_CACHE_LINE_SIZE];
+    T *m_tail;              //!< Next item to pop owned by the consumer
+    T m_stub;
+};
+
+} // namespace SerialDV
+
+#endif /* DVMPSCQUEUE_H_ */
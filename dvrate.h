@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVRATE_H_
+#define DVRATE_H_
+
+#include "datacontroller.h"
+
+namespace SerialDV
+{
+
+typedef enum
+{
+    DVRateNone,
+    DVRate3600x2400, //!< D-Star
+    DVRate3600x2450, //!< DMR, dPMR, YSF V/D type 1
+    DVRate7200x4400,
+    DVRate7100x4400,
+    DVRate2400,
+    DVRate2450,      //!< YSF V/D type 2 (does not use FEC in AMBE codec)
+    DVRate4400,
+    DVRateCount
+} DVRate;
+
+/** D-Star AMBE silence frame (3600x2400 rate) */
+const unsigned char DV_DSTAR_SILENCE_FRAME[9] = {0x9E, 0x8D, 0x32, 0x88, 0x26, 0x1A, 0x3F, 0x61, 0xE8};
+
+/** Everything that depends on the rate to build packets. The AMBE packet headers are
+ * complete with the big endian length field and the CHAND number of bits so that they are
+ * copied as is. The AMBE3003 header has the channel field at index 4 to set.
+ */
+struct DVRateInfo
+{
+    unsigned char nbMbeBits;        //!< 0 if the rate is not supported
+    unsigned char nbMbeBytes;
+    const unsigned char *ratep;     //!< RATEP request packet
+    unsigned char dv3000AmbeHeader[DV3000_AMBE_HEADER_LEN];
+    unsigned char dv3003AmbeHeader[DV3003_AMBE_HEADER_LEN];
+};
+
+/** Fills in the rate information from the number of bits of the AMBE frame at compile time */
+template<unsigned char NbMbeBits>
+constexpr DVRateInfo makeRateInfo(const unsigned char *ratep)
+{
+    return DVRateInfo {
+        NbMbeBits,
+        (unsigned char) ((NbMbeBits + 7) / 8),
+        ratep,
+        {
+            DV3000_START_BYTE,
+            (unsigned char) (((DV3000_AMBE_HEADER_LEN - DV3000_HEADER_LEN + (NbMbeBits + 7) / 8) >> 8) & 0xFF),
+            (unsigned char) ((DV3000_AMBE_HEADER_LEN - DV3000_HEADER_LEN + (NbMbeBits + 7) / 8) & 0xFF),
+            DV3000_TYPE_AMBE,
+            DV3000_FIELD_CHAND,
+            NbMbeBits
+        },
+        {
+            DV3000_START_BYTE,
+            (unsigned char) (((DV3003_AMBE_HEADER_LEN - DV3000_HEADER_LEN + (NbMbeBits + 7) / 8) >> 8) & 0xFF),
+            (unsigned char) ((DV3003_AMBE_HEADER_LEN - DV3000_HEADER_LEN + (NbMbeBits + 7) / 8) & 0xFF),
+            DV3000_TYPE_AMBE,
+            DV3000_CONTROL_CHANNEL0,
+            DV3000_FIELD_CHAND,
+            NbMbeBits
+        }
+    };
+}
+
+/** Rate information indexed by DVRate */
+constexpr DVRateInfo DV_RATE_INFO[DVRateCount] = {
+    makeRateInfo<0>(0),                                // DVRateNone
+    makeRateInfo<72>(DV3000_REQ_3600X2400_RATEP),      // DVRate3600x2400
+    makeRateInfo<72>(DV3000_REQ_3600X2450_RATEP),      // DVRate3600x2450
+    makeRateInfo<144>(DV3000_REQ_7200X4400_3_RATEP),   // DVRate7200x4400 AMBE 3000 version
+    makeRateInfo<0>(0),                                // DVRate7100x4400 not supported
+    makeRateInfo<0>(0),                                // DVRate2400 not supported
+    makeRateInfo<49>(DV3000_REQ_2450_RATEP),           // DVRate2450
+    makeRateInfo<88>(DV3000_REQ_4400_RATEP)            // DVRate4400
+};
+
+static_assert(DV_RATE_INFO[DVRate3600x2400].nbMbeBytes == 9, "3600x2400 frames are 9 bytes");
+static_assert(DV_RATE_INFO[DVRate7200x4400].nbMbeBytes == MBE_FRAME_MAX_LENGTH_BYTES, "7200x4400 frames are 18 bytes");
+static_assert(DV_RATE_INFO[DVRate2450].nbMbeBytes == 7, "2450 frames are 7 bytes");
+static_assert(DV_RATE_INFO[DVRate3600x2400].dv3000AmbeHeader[2] == 0x0BU, "DV3000 AMBE header length");
+static_assert(DV_RATE_INFO[DVRate3600x2400].dv3003AmbeHeader[2] == 0x0CU, "DV3003 AMBE header length");
+
+/** Returns the rate information or that of DVRateNone if the rate is out of range */
+inline const DVRateInfo& getRateInfo(DVRate rate)
+{
+    return DV_RATE_INFO[(unsigned int) rate < (unsigned int) DVRateCount ? rate : DVRateNone];
+}
+
+} // namespace SerialDV
+
+#endif /* DVRATE_H_ */
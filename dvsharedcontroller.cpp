@@ -0,0 +1,381 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+#include "dvsharedcontroller.h"
+
+namespace SerialDV
+{
+
+void DVSharedController::RequestList::append(Request *request)
+{
+    request->next = 0;
+
+    if (tail) {
+        tail->next = request;
+    } else {
+        head = request;
+    }
+
+    tail = request;
+    count++;
+}
+
+DVSharedController::Request *DVSharedController::RequestList::take()
+{
+    Request *request = head;
+
+    if (request)
+    {
+        head = request->next;
+
+        if (!head) {
+            tail = 0;
+        }
+
+        count--;
+    }
+
+    return request;
+}
+
+DVSharedController::DVSharedController(DVController& controller) :
+        m_controller(controller),
+        m_started(false),
+        m_stop(false),
+        m_ownerWaiting(false),
+        m_nbInFlight(0)
+{
+    for (unsigned int i = 0; i < DV_SHARED_MAX_SUBMITTERS; i++) {
+        m_submitters[i] = 0;
+    }
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+    {
+        m_backlog[channel].clear();
+        m_inFlight[channel].clear();
+    }
+}
+
+DVSharedController::~DVSharedController()
+{
+    stop();
+
+    for (unsigned int i = 0; i < DV_SHARED_MAX_SUBMITTERS; i++) {
+        delete m_submitters[i];
+    }
+}
+
+bool DVSharedController::start()
+{
+    if (m_started) {
+        return false;
+    }
+
+    if (!m_controller.isOpen() || m_controller.isStreaming())
+    {
+        fprintf(stderr, "DVSharedController::start: device is not open or is streaming\n");
+        return false;
+    }
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+    {
+        m_backlog[channel].clear();
+        m_inFlight[channel].clear();
+    }
+
+    m_nbInFlight = 0;
+    m_stop = false;
+    m_started = true;
+    m_ownerThread = std::thread(&DVSharedController::owner, this);
+    return true;
+}
+
+void DVSharedController::stop()
+{
+    if (!m_started) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_ownerMutex);
+        m_stop = true;
+    }
+
+    m_ownerWakeup.notify_one();
+    m_ownerThread.join();
+    m_started = false;
+}
+
+int DVSharedController::addSubmitter()
+{
+    std::lock_guard<std::mutex> lock(m_submittersMutex);
+
+    for (unsigned int i = 0; i < DV_SHARED_MAX_SUBMITTERS; i++)
+    {
+        if (m_submitters[i]) {
+            continue;
+        }
+
+        Submitter *submitter = new Submitter();
+        submitter->waiting = false;
+        submitter->nbFree = DV_SHARED_SUBMITTER_SLOTS;
+
+        for (unsigned int slot = 0; slot < DV_SHARED_SUBMITTER_SLOTS; slot++)
+        {
+            submitter->requests[slot].submitter = submitter;
+            submitter->requests[slot].index = slot;
+            submitter->freeSlots[slot] = slot;
+        }
+
+        m_submitters[i] = submitter;
+        return i;
+    }
+
+    fprintf(stderr, "DVSharedController::addSubmitter: too many submitters\n");
+    return -1;
+}
+
+bool DVSharedController::removeSubmitter(int submitterId)
+{
+    Submitter *submitter = getSubmitter(submitterId);
+
+    if (!submitter || (submitter->nbFree != DV_SHARED_SUBMITTER_SLOTS)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_submittersMutex);
+    m_submitters[submitterId] = 0;
+    delete submitter;
+    return true;
+}
+
+bool DVSharedController::submitEncode(int submitterId, const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    Request *request = takeRequest(getSubmitter(submitterId), channel);
+
+    if (!request) {
+        return false;
+    }
+
+    request->encode = true;
+    request->rate = rate;
+    request->gain = gain;
+    request->channel = channel;
+    request->audioFrame = 0;
+    request->mbeFrame = mbeFrame;
+    request->completion.tag = tag;
+    ::memcpy(request->audio, audioFrame, MBE_AUDIO_BLOCK_BYTES);
+
+    push(request);
+    return true;
+}
+
+bool DVSharedController::submitDecode(int submitterId, short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel)
+{
+    Request *request = takeRequest(getSubmitter(submitterId), channel);
+
+    if (!request) {
+        return false;
+    }
+
+    request->encode = false;
+    request->rate = rate;
+    request->gain = gain;
+    request->channel = channel;
+    request->audioFrame = audioFrame;
+    request->mbeFrame = 0;
+    request->completion.tag = tag;
+    ::memcpy(request->mbe, mbeFrame, DVController::getNbMbeBytes(rate));
+
+    push(request);
+    return true;
+}
+
+bool DVSharedController::popCompletion(int submitterId, DVCompletion& completion, unsigned int timeoutUs)
+{
+    Submitter *submitter = getSubmitter(submitterId);
+    Request *request;
+
+    if (!submitter) {
+        return false;
+    }
+
+    if (!submitter->completions.pop(request))
+    {
+        if (timeoutUs == 0) {
+            return false;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(submitter->mutex);
+            submitter->waiting = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst); // against the completion push of the owner thread
+            submitter->wakeup.wait_for(lock, std::chrono::microseconds(timeoutUs), [submitter] { return !submitter->completions.empty(); });
+            submitter->waiting = false;
+        }
+
+        if (!submitter->completions.pop(request)) {
+            return false;
+        }
+    }
+
+    completion = request->completion;
+    submitter->freeSlots[submitter->nbFree++] = request->index;
+    return true;
+}
+
+unsigned int DVSharedController::getNbOutstanding(int submitterId) const
+{
+    Submitter *submitter = getSubmitter(submitterId);
+    return submitter ? DV_SHARED_SUBMITTER_SLOTS - submitter->nbFree : 0;
+}
+
+DVSharedController::Submitter *DVSharedController::getSubmitter(int submitterId) const
+{
+    if ((submitterId < 0) || (submitterId >= (int) DV_SHARED_MAX_SUBMITTERS)) {
+        return 0;
+    }
+
+    return m_submitters[submitterId];
+}
+
+DVSharedController::Request *DVSharedController::takeRequest(Submitter *submitter, unsigned int channel)
+{
+    if (!submitter || !m_started || (channel >= m_controller.getNbChannels()) || (submitter->nbFree == 0)) {
+        return 0;
+    }
+
+    return &submitter->requests[submitter->freeSlots[--submitter->nbFree]];
+}
+
+void DVSharedController::push(Request *request)
+{
+    m_requests.push(request);
+    std::atomic_thread_fence(std::memory_order_seq_cst); // against the emptiness check of the owner thread
+
+    if (m_ownerWaiting.load(std::memory_order_relaxed))
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_ownerMutex); // the owner is either before its check or waiting
+        }
+
+        m_ownerWakeup.notify_one();
+    }
+}
+
+void DVSharedController::owner()
+{
+    DVCompletion completion;
+
+    while (true)
+    {
+        Request *request;
+
+        while ((request = m_requests.pop()) != 0) {
+            m_backlog[request->channel].append(request);
+        }
+
+        for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+            submitBacklog(channel);
+        }
+
+        if (m_nbInFlight != 0)
+        {
+            if (m_controller.pollCompletion(completion))
+            {
+                Request *sent = m_inFlight[completion.channel].take();
+                m_nbInFlight--;
+                complete(sent, completion.ok);
+            }
+            else // the controller gave up on everything in flight
+            {
+                for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+                {
+                    while ((request = m_inFlight[channel].take()) != 0) {
+                        complete(request, false);
+                    }
+                }
+
+                m_nbInFlight = 0;
+            }
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_ownerMutex);
+
+        if (m_stop && m_requests.empty()) {
+            break;
+        }
+
+        m_ownerWaiting = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst); // against the request push of the submitters
+        m_ownerWakeup.wait(lock, [this] { return m_stop || !m_requests.empty(); });
+        m_ownerWaiting = false;
+    }
+}
+
+void DVSharedController::submitBacklog(unsigned int channel)
+{
+    RequestList& backlog = m_backlog[channel];
+
+    while (backlog.head && (m_inFlight[channel].count < m_controller.getPipelineDepth()))
+    {
+        Request *request = backlog.take();
+        bool ok;
+
+        if (request->encode) {
+            ok = m_controller.submitEncode(request->audio, request->mbeFrame, request->rate, request->gain, request->index, channel);
+        } else {
+            ok = m_controller.submitDecode(request->audioFrame, request->mbe, request->rate, request->gain, request->index, channel);
+        }
+
+        if (ok)
+        {
+            m_inFlight[channel].append(request);
+            m_nbInFlight++;
+        }
+        else
+        {
+            complete(request, false);
+        }
+    }
+}
+
+void DVSharedController::complete(Request *request, bool ok)
+{
+    Submitter *submitter = request->submitter;
+    request->completion.channel = request->channel;
+    request->completion.encode = request->encode;
+    request->completion.ok = ok;
+    submitter->completions.push(request); // never full as it has room for all the requests of the submitter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (submitter->waiting.load(std::memory_order_relaxed))
+    {
+        {
+            std::lock_guard<std::mutex> lock(submitter->mutex);
+        }
+
+        submitter->wakeup.notify_one();
+    }
+}
+
+} // namespace SerialDV
@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVSHAREDCONTROLLER_H_
+#define DVSHAREDCONTROLLER_H_
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "dvcontroller.h"
+#include "dvmpscqueue.h"
+
+namespace SerialDV
+{
+
+const unsigned int DV_SHARED_MAX_SUBMITTERS = 64U; //!< Submitters of one shared controller
+const unsigned int DV_SHARED_SUBMITTER_SLOTS = 16U; //!< Requests a submitter may have outstanding
+
+/** Front-end sharing one device between many threads. Each thread registers as a submitter
+ * and queues encode and decode requests that are passed to an owner thread through a lock-free
+ * multiple producers single consumer queue. The owner thread alone drives the device with the
+ * pipelined methods of the controller and returns each completion to the queue of its submitter.
+ * Submitting never takes a lock so that threads do not convoy behind one another. A lock is only
+ * taken to wake up a thread that is waiting.
+ *
+ * A submitter is used from one thread at a time. Input frames are copied at submission so that
+ * the caller can reuse its buffers at once. Output buffers must remain valid until the completion
+ * is popped. The device controller is not owned and must not be used directly while started.
+ */
+class DVSharedController
+{
+public:
+    DVSharedController(DVController& controller);
+    ~DVSharedController();
+
+    /** Starts the owner thread. Returns false if the device is not open or is streaming */
+    bool start();
+
+    /** Stops the owner thread once the requests submitted are completed */
+    void stop();
+    bool isStarted() const { return m_started; }
+
+    /** Registers a submitter. Returns its identifier or -1 if there are too many */
+    int addSubmitter();
+
+    /** Unregisters a submitter. Returns false if it still has requests outstanding */
+    bool removeSubmitter(int submitterId);
+
+    /** Queues a request of the submitter. Returns false if it has DV_SHARED_SUBMITTER_SLOTS
+     * requests outstanding, the channel does not exist or the owner thread is not started.
+     */
+    bool submitEncode(int submitterId, const short *audioFrame, unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+    bool submitDecode(int submitterId, short *audioFrame, const unsigned char *mbeFrame, DVRate rate, int gain, unsigned int tag, unsigned int channel = 0);
+
+    /** Pops the next completion of the submitter waiting at most timeoutUs microseconds for it.
+     * Completions of requests on the same channel come in submission order. The tag is the one
+     * given at submission. Returns false if there is none.
+     */
+    bool popCompletion(int submitterId, DVCompletion& completion, unsigned int timeoutUs = 0);
+
+    /** Requests of the submitter submitted and not popped */
+    unsigned int getNbOutstanding(int submitterId) const;
+
+private:
+    struct Submitter;
+
+    struct Request
+    {
+        std::atomic<Request*> mpscNext; //!< Link in the submission queue
+        Request *next;                  //!< Link in the channel lists of the owner thread
+        Submitter *submitter;
+        unsigned int index;             //!< Slot index in the submitter
+        bool encode;
+        DVRate rate;
+        int gain;
+        unsigned int channel;
+        short *audioFrame;              //!< Decoder output
+        unsigned char *mbeFrame;        //!< Encoder output
+        short audio[MBE_AUDIO_BLOCK_SIZE];
+        unsigned char mbe[MBE_FRAME_MAX_LENGTH_BYTES];
+        DVCompletion completion;
+    };
+
+    struct Submitter
+    {
+        Request requests[DV_SHARED_SUBMITTER_SLOTS];
+        unsigned int freeSlots[DV_SHARED_SUBMITTER_SLOTS]; //!< Stack of the requests available
+        unsigned int nbFree;
+        DVSPSCQueue<Request*, DV_SHARED_SUBMITTER_SLOTS + 1> completions; //!< Owner thread to submitter
+        std::atomic<bool> waiting;                                        //!< Tells the owner thread to wake up the submitter
+        std::mutex mutex;                                                 //!< Only taken to wait for or signal completions
+        std::condition_variable wakeup;
+    };
+
+    /** FIFO of requests linked by their next member */
+    struct RequestList
+    {
+        Request *head;
+        Request *tail;
+        unsigned int count;
+
+        void clear() { head = 0; tail = 0; count = 0; }
+        void append(Request *request);
+        Request *take();
+    };
+
+    DVController& m_controller;
+    Submitter *m_submitters[DV_SHARED_MAX_SUBMITTERS];
+    std::mutex m_submittersMutex;                  //!< Protects submitter registration
+    DVMPSCQueue<Request> m_requests;               //!< Submitters to owner thread
+    std::atomic<bool> m_started;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_ownerWaiting;              //!< Tells submitters to wake up the owner thread
+    std::thread m_ownerThread;
+    std::mutex m_ownerMutex;                       //!< Only taken to wait for or signal requests
+    std::condition_variable m_ownerWakeup;
+    RequestList m_backlog[DV3000_MAX_CHANNELS];    //!< Requests waiting for room in the channel pipeline
+    RequestList m_inFlight[DV3000_MAX_CHANNELS];   //!< Requests sent to the device in sending order
+    unsigned int m_nbInFlight;
+
+    Submitter *getSubmitter(int submitterId) const;
+    Request *takeRequest(Submitter *submitter, unsigned int channel);
+    void push(Request *request);
+    void owner();
+    void submitBacklog(unsigned int channel);
+    void complete(Request *request, bool ok);
+};
+
+} // namespace SerialDV
+
+#endif /* DVSHAREDCONTROLLER_H_ */
@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVSPSCQUEUE_H_
+#define DVSPSCQUEUE_H_
+
+#include <atomic>
+
+namespace SerialDV
+{
+
+const unsigned int DV_CACHE_LINE_SIZE = 64U;
+
+/** Bounded lock-free queue with a single producer thread and a single consumer thread.
+ * It holds at most N - 1 items. Head and tail indexes are kept a cache line apart so that
+ * the producer and the consumer do not invalidate each other on every operation.
+ * Padding is used rather than alignas() so that objects holding a queue can be allocated
+ * with new in C++11.
+ */
+template<typename T, unsigned int N>
+class DVSPSCQueue
+{
+public:
+    DVSPSCQueue() : m_head(0), m_tail(0) {}
+
+    /** Producer side. Returns false if the queue is full */
+    bool push(const T& item)
+    {
+        unsigned int tail = m_tail.load(std::memory_order_relaxed);
+        unsigned int next = (tail + 1) % N;
+
+        if (next == m_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        m_items[tail] = item;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side. Returns false if the queue is empty */
+    bool pop(T& item)
+    {
+        unsigned int head = m_head.load(std::memory_order_relaxed);
+
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = m_items[head];
+        m_head.store((head + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side. Oldest item left in place or 0 if the queue is empty */
+    const T *front() const
+    {
+        unsigned int head = m_head.load(std::memory_order_relaxed);
+        return head == m_tail.load(std::memory_order_acquire) ? 0 : &m_items[head];
+    }
+
+    bool empty() const { return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire); }
+
+    /** Empties the queue. Neither the producer nor the consumer must be running */
+    void clear()
+    {
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<unsigned int> m_head; //!< Next item to pop written by the consumer
+    char m_headPadding[DV_CACHE_LINE_SIZE];
+    std::atomic<unsigned int> m_tail; //!< Next slot to push written by the producer
+    char m_tailPadding[DV_CACHE_LINE_SIZE];
+    T m_items[N];
+};
+
+} // namespace SerialDV
+
+#endif /* DVSPSCQUEUE_H_ */
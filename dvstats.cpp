@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "dvstats.h"
+
+namespace SerialDV
+{
+
+DVLatencyHistogram::DVLatencyHistogram() :
+        m_max(0)
+{
+}
+
+unsigned int DVLatencyHistogram::getBucket(uint32_t us)
+{
+    if (us < DV_LATENCY_SUB_BUCKETS) {
+        return us;
+    }
+
+    // the bits below the most significant one select the linear bucket in its power of two
+    unsigned int shift = 31 - __builtin_clz(us) - DV_LATENCY_SUB_BITS;
+    return DV_LATENCY_SUB_BUCKETS * (shift + 1) + ((us >> shift) & (DV_LATENCY_SUB_BUCKETS - 1));
+}
+
+uint32_t DVLatencyHistogram::getBucketUpperBound(unsigned int bucket)
+{
+    if (bucket < DV_LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    unsigned int shift = bucket / DV_LATENCY_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t) (DV_LATENCY_SUB_BUCKETS + bucket % DV_LATENCY_SUB_BUCKETS) << shift;
+    return (uint32_t) (lower + (1ULL << shift) - 1);
+}
+
+void DVLatencyHistogram::add(uint32_t us)
+{
+    m_buckets[getBucket(us)].add(1);
+    m_count.add(1);
+    m_sum.add(us);
+
+    if (us > m_max.load(std::memory_order_relaxed)) {
+        m_max.store(us, std::memory_order_relaxed);
+    }
+}
+
+void DVLatencyHistogram::reset()
+{
+    for (unsigned int bucket = 0; bucket < DV_LATENCY_BUCKETS; bucket++) {
+        m_buckets[bucket].reset();
+    }
+
+    m_count.reset();
+    m_sum.reset();
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint32_t DVLatencyHistogram::getPercentile(double percent) const
+{
+    uint64_t count = 0;
+
+    for (unsigned int bucket = 0; bucket < DV_LATENCY_BUCKETS; bucket++) {
+        count += m_buckets[bucket].get();
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) ((percent / 100.0) * count + 0.5);
+    uint64_t cumulated = 0;
+    uint32_t max = getMax();
+
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (unsigned int bucket = 0; bucket < DV_LATENCY_BUCKETS; bucket++)
+    {
+        cumulated += m_buckets[bucket].get();
+
+        if (cumulated >= rank)
+        {
+            uint32_t upper = getBucketUpperBound(bucket);
+            return upper < max ? upper : max;
+        }
+    }
+
+    return max;
+}
+
+void DVOperationStats::reset()
+{
+    nbCompleted.reset();
+    nbFailed.reset();
+    firstByteTime.reset();
+    payloadTime.reset();
+    latency.reset();
+}
+
+uint64_t DVChannelStats::getNbInFlight() const
+{
+    // the counters are not read as a snapshot: a completion may be seen before its submission
+    uint64_t done = nbCompleted.get() + nbFailed.get();
+    uint64_t submitted = nbSubmitted.get();
+    return submitted > done ? submitted - done : 0;
+}
+
+void DVChannelStats::reset()
+{
+    nbSubmitted.reset();
+    nbCompleted.reset();
+    nbFailed.reset();
+    nbRateChanges.reset();
+    nbGainChanges.reset();
+    latency.reset();
+}
+
+void DVControllerStats::reset()
+{
+    for (unsigned int operation = 0; operation < DVOperationCount; operation++) {
+        operations[operation].reset();
+    }
+
+    writeTime.reset();
+    nbWrites.reset();
+    nbBytesWritten.reset();
+    nbReads.reset();
+    nbBytesRead.reset();
+    nbPackets.reset();
+    nbTimeouts.reset();
+    nbMismatches.reset();
+    nbUnexpected.reset();
+    nbResyncs.reset();
+    nbBytesFlushed.reset();
+    nbResets.reset();
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+        channels[channel].reset();
+    }
+}
+
+void DVSchedulerStats::reset()
+{
+    nbScheduled.reset();
+    nbCompleted.reset();
+    nbFailed.reset();
+    nbDroppedAdmission.reset();
+    nbDroppedDispatch.reset();
+    nbSilenced.reset();
+    nbLate.reset();
+    slack.reset();
+}
+
+void DVDecodeCacheStats::reset()
+{
+    nbHits.reset();
+    nbMisses.reset();
+    nbInsertions.reset();
+    nbEvictions.reset();
+}
+
+} // namespace SerialDV
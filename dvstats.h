@@ -0,0 +1,190 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVSTATS_H_
+#define DVSTATS_H_
+
+#include <stdint.h>
+#include <atomic>
+
+#include "datacontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int DV_LATENCY_SUB_BITS = 4U;                            //!< Each power of two of microseconds is split in 2^4 linear buckets
+const unsigned int DV_LATENCY_SUB_BUCKETS = 1U << DV_LATENCY_SUB_BITS;
+const unsigned int DV_LATENCY_BUCKETS = DV_LATENCY_SUB_BUCKETS * (33U - DV_LATENCY_SUB_BITS); //!< 0 to 15 us then 16 buckets per octave up to 2^32-1
+
+typedef enum
+{
+    DVOperationEncode,
+    DVOperationDecode,
+    DVOperationControl, //!< RATEP and GAIN requests
+    DVOperationCount
+} DVOperation;
+
+/** Counter written by the controller thread only and readable at any time from other threads.
+ * Being single writer it does not need a locked read-modify-write.
+ */
+class DVCounter
+{
+public:
+    DVCounter() : m_value(0) {}
+
+    void add(uint64_t value) { m_value.store(m_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); }
+    void reset() { m_value.store(0, std::memory_order_relaxed); }
+    uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value;
+};
+
+/** Histogram of durations in microseconds with log-linear buckets as in HDR histograms: one
+ * bucket per microsecond up to 15 us then 16 buckets per power of two so that a bucket is at most
+ * 1/16 of its lower bound wide (e.g. 1 ms from 16 to 32 ms). Percentiles are returned as the upper
+ * bound of the bucket they fall in (at most the maximum seen).
+ */
+class DVLatencyHistogram
+{
+public:
+    DVLatencyHistogram();
+
+    void add(uint32_t us);
+    void reset();
+
+    uint64_t getCount() const { return m_count.get(); }
+    uint64_t getSum() const { return m_sum.get(); }
+    uint32_t getMax() const { return m_max.load(std::memory_order_relaxed); }
+    /** Number of durations in the bucket which holds up to getBucketUpperBound(bucket) us */
+    uint64_t getBucketCount(unsigned int bucket) const { return bucket < DV_LATENCY_BUCKETS ? m_buckets[bucket].get() : 0; }
+    uint32_t getPercentile(double percent) const;
+    uint32_t getP50() const { return getPercentile(50.0); }
+    uint32_t getP99() const { return getPercentile(99.0); }
+
+    /** Bucket holding a duration of us microseconds */
+    static unsigned int getBucket(uint32_t us);
+    /** Largest duration in microseconds held by the bucket */
+    static uint32_t getBucketUpperBound(unsigned int bucket);
+
+private:
+    DVCounter m_buckets[DV_LATENCY_BUCKETS];
+    DVCounter m_count;
+    DVCounter m_sum;
+    std::atomic<uint32_t> m_max;
+};
+
+/** Statistics of one type of request. Times are taken from the end of the write that
+ * carried the request to the first byte of the reply and from there to its last byte.
+ * The latency covers the whole transaction from submission to completion.
+ */
+struct DVOperationStats
+{
+    DVCounter nbCompleted;              //!< Replies matching the request
+    DVCounter nbFailed;                 //!< Timeouts and mismatched replies
+    DVLatencyHistogram firstByteTime;   //!< Write end to first byte of the reply
+    DVLatencyHistogram payloadTime;     //!< First to last byte of the reply
+    DVLatencyHistogram latency;         //!< Submission to completion
+
+    void reset();
+};
+
+/** Statistics of one vocoder channel. The encode and decode frames in flight are the frames
+ * submitted less the frames completed and failed.
+ */
+struct DVChannelStats
+{
+    DVCounter nbSubmitted;              //!< Encode and decode frames sent to the channel
+    DVCounter nbCompleted;              //!< Frames answered successfully
+    DVCounter nbFailed;                 //!< Frames not answered or discarded
+    DVCounter nbRateChanges;            //!< Rate configurations sent
+    DVCounter nbGainChanges;            //!< Gain configurations sent
+    DVLatencyHistogram latency;         //!< Submission to completion of the frames
+
+    uint64_t getNbInFlight() const;
+    void reset();
+};
+
+/** Statistics of a DVController. All members can be read from any thread while the
+ * controller runs. Values read together are not a consistent snapshot.
+ */
+struct DVControllerStats
+{
+    DVOperationStats operations[DVOperationCount];
+    DVLatencyHistogram writeTime;       //!< Duration of the writes to the device
+    DVCounter nbWrites;
+    DVCounter nbBytesWritten;
+    DVCounter nbReads;                  //!< Poll iterations waiting for reply bytes
+    DVCounter nbBytesRead;
+    DVCounter nbPackets;                //!< Complete packets received
+    DVCounter nbTimeouts;               //!< No complete reply in time
+    DVCounter nbMismatches;             //!< Reply of another type than expected
+    DVCounter nbUnexpected;             //!< Reply with no pending request on its channel
+    DVCounter nbResyncs;                //!< Recoveries after losing track of the replies
+    DVCounter nbBytesFlushed;           //!< Stale bytes discarded by the recoveries
+    DVCounter nbResets;                 //!< Chip resets done by the recoveries
+    DVChannelStats channels[DV3000_MAX_CHANNELS];
+
+    void reset();
+};
+
+/** Statistics of a DVFrameScheduler. Frames are dropped when admitted if they cannot
+ * complete before their deadline at the current service time or when they are about to be
+ * sent if frames of higher priority have been sent before them in the meantime.
+ */
+struct DVSchedulerStats
+{
+    DVCounter nbScheduled;              //!< Frames given to the scheduler
+    DVCounter nbCompleted;              //!< Frames processed by the device successfully
+    DVCounter nbFailed;                 //!< Frames sent to the device that failed
+    DVCounter nbDroppedAdmission;       //!< Frames dropped when scheduled
+    DVCounter nbDroppedDispatch;        //!< Frames dropped when about to be sent
+    DVCounter nbSilenced;               //!< Dropped frames replaced by silence
+    DVCounter nbLate;                   //!< Frames completed after their deadline
+    DVLatencyHistogram slack;           //!< Time left before the deadline at completion
+
+    void reset();
+};
+
+/** Counters of a DVDecodeCache */
+struct DVDecodeCacheStats
+{
+    DVCounter nbHits;                   //!< Frames answered from the cache
+    DVCounter nbMisses;                 //!< Frames decoded by the device
+    DVCounter nbInsertions;             //!< Decoded frames stored
+    DVCounter nbEvictions;              //!< Least recently used frames dropped to stay within the memory limit
+
+    void reset();
+};
+
+/** Timing of one completed transaction given to the DVController transaction callback */
+struct DVTransaction
+{
+    DVOperation operation;
+    unsigned int channel;
+    unsigned int tag;       //!< Tag given at submission (0 for control requests)
+    bool ok;
+    uint32_t writeUs;       //!< Duration of the write that carried the request
+    uint32_t firstByteUs;   //!< Write end to first byte of the reply
+    uint32_t payloadUs;     //!< First to last byte of the reply
+    uint32_t latencyUs;     //!< Submission to completion
+};
+
+typedef void (*DVTransactionCallback)(const DVTransaction& transaction, void *context);
+
+} // namespace SerialDV
+
+#endif /* DVSTATS_H_ */
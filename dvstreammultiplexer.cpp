@@ -0,0 +1,398 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <algorithm>
+#include <time.h>
+
+#include "dvstreammultiplexer.h"
+
+namespace SerialDV
+{
+
+DVStreamMultiplexer::DVStreamMultiplexer(DVController& controller) :
+        m_controller(controller),
+        m_nbGroups(0)
+{
+}
+
+DVStreamMultiplexer::~DVStreamMultiplexer()
+{
+}
+
+int DVStreamMultiplexer::openStream(DVRate rate, int gain)
+{
+    unsigned int nbChannels = m_controller.getNbChannels();
+
+    if (!m_controller.isOpen() || (nbChannels == 0))
+    {
+        fprintf(stderr, "DVStreamMultiplexer::openStream: device is not open\n");
+        return -1;
+    }
+
+    unsigned int nbStreams[DV3000_MAX_CHANNELS] = {0};
+    unsigned int nbSameRate[DV3000_MAX_CHANNELS] = {0};
+
+    for (unsigned int i = 0; i < m_streams.size(); i++)
+    {
+        if (m_streams[i].used && (m_streams[i].channel < nbChannels))
+        {
+            nbStreams[m_streams[i].channel]++;
+
+            if (m_streams[i].rate == rate) {
+                nbSameRate[m_streams[i].channel]++;
+            }
+        }
+    }
+
+    // least loaded channel among those already carrying this rate else least loaded channel
+    int bestChannel = -1;
+
+    for (unsigned int channel = 0; channel < nbChannels; channel++)
+    {
+        if ((nbSameRate[channel] > 0) && ((bestChannel < 0) || (nbStreams[channel] < nbStreams[bestChannel]))) {
+            bestChannel = channel;
+        }
+    }
+
+    if (bestChannel < 0)
+    {
+        bestChannel = 0;
+
+        for (unsigned int channel = 1; channel < nbChannels; channel++)
+        {
+            if (nbStreams[channel] < nbStreams[bestChannel]) {
+                bestChannel = channel;
+            }
+        }
+    }
+
+    unsigned int streamId = 0;
+
+    while ((streamId < m_streams.size()) && m_streams[streamId].used) {
+        streamId++;
+    }
+
+    if (streamId == m_streams.size()) {
+        m_streams.push_back(Stream());
+    }
+
+    Stream& stream = m_streams[streamId];
+    stream.used = true;
+    stream.channel = bestChannel;
+    stream.rate = rate;
+    stream.gain = gain;
+    stream.queued = false;
+    stream.phase = 0;
+
+    return streamId;
+}
+
+void DVStreamMultiplexer::closeStream(int streamId)
+{
+    if ((streamId >= 0) && ((unsigned int) streamId < m_streams.size())) {
+        m_streams[streamId].used = false;
+    }
+}
+
+bool DVStreamMultiplexer::setStreamConfig(int streamId, DVRate rate, int gain)
+{
+    if ((streamId < 0) || ((unsigned int) streamId >= m_streams.size()) || !m_streams[streamId].used) {
+        return false;
+    }
+
+    Stream& stream = m_streams[streamId];
+
+    // frames pushed from now on must not overtake the frames queued with the previous configuration
+    if (stream.queued && ((rate != stream.rate) || (gain != stream.gain)))
+    {
+        stream.queued = false;
+        stream.phase++;
+    }
+
+    stream.rate = rate;
+    stream.gain = gain;
+    return true;
+}
+
+bool DVStreamMultiplexer::getStreamChannel(int streamId, unsigned int& channel) const
+{
+    if ((streamId < 0) || ((unsigned int) streamId >= m_streams.size()) || !m_streams[streamId].used) {
+        return false;
+    }
+
+    channel = m_streams[streamId].channel;
+    return true;
+}
+
+bool DVStreamMultiplexer::pushEncode(int streamId, const short *audioFrame, unsigned char *mbeFrame, unsigned int tag, uint64_t deadlineUs)
+{
+    Frame frame;
+    frame.encode = true;
+    frame.audioIn = audioFrame;
+    frame.audioOut = 0;
+    frame.mbeIn = 0;
+    frame.mbeOut = mbeFrame;
+    frame.tag = tag;
+    frame.deadlineUs = deadlineUs;
+    return push(streamId, frame);
+}
+
+bool DVStreamMultiplexer::pushDecode(int streamId, short *audioFrame, const unsigned char *mbeFrame, unsigned int tag, uint64_t deadlineUs)
+{
+    Frame frame;
+    frame.encode = false;
+    frame.audioIn = 0;
+    frame.audioOut = audioFrame;
+    frame.mbeIn = mbeFrame;
+    frame.mbeOut = 0;
+    frame.tag = tag;
+    frame.deadlineUs = deadlineUs;
+    return push(streamId, frame);
+}
+
+bool DVStreamMultiplexer::push(int streamId, const Frame& frame)
+{
+    if ((streamId < 0) || ((unsigned int) streamId >= m_streams.size()) || !m_streams[streamId].used)
+    {
+        fprintf(stderr, "DVStreamMultiplexer::push: invalid stream %d\n", streamId);
+        return false;
+    }
+
+    Stream& stream = m_streams[streamId];
+    stream.queued = true;
+    m_queues[stream.channel].push_back(frame);
+    Frame& queued = m_queues[stream.channel].back();
+    queued.streamId = streamId;
+    queued.rate = stream.rate;
+    queued.gain = stream.gain;
+    queued.groupDeadlineUs = 0;
+    queued.first = false;
+    queued.phase = stream.phase;
+    queued.order = m_queues[stream.channel].size() - 1;
+
+    if (queued.deadlineUs == 0) {
+        queued.deadlineUs = nowUs() + DV_STREAM_FRAME_PERIOD_US;
+    }
+
+    return true;
+}
+
+void DVStreamMultiplexer::reserve(unsigned int nbFramesPerChannel)
+{
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++)
+    {
+        m_queues[channel].reserve(nbFramesPerChannel);
+        m_inFlight[channel].reserve(nbFramesPerChannel);
+    }
+}
+
+unsigned int DVStreamMultiplexer::getNbQueued() const
+{
+    unsigned int nbQueued = 0;
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+        nbQueued += m_queues[channel].size();
+    }
+
+    return nbQueued;
+}
+
+bool DVStreamMultiplexer::sameConfig(const Frame& a, const Frame& b)
+{
+    return (a.encode == b.encode) && (a.rate == b.rate) && (a.gain == b.gain);
+}
+
+bool DVStreamMultiplexer::sendOrder(const Frame& a, const Frame& b)
+{
+    if (a.phase != b.phase) {
+        return a.phase < b.phase;
+    }
+    if (a.first != b.first) {
+        return a.first;
+    }
+    if (a.groupDeadlineUs != b.groupDeadlineUs) {
+        return a.groupDeadlineUs < b.groupDeadlineUs;
+    }
+    // same group deadline: keep frames at the same rate together then the same direction and gain
+    if (a.rate != b.rate) {
+        return a.rate < b.rate;
+    }
+    if (a.encode != b.encode) {
+        return a.encode;
+    }
+    if (a.gain != b.gain) {
+        return a.gain < b.gain;
+    }
+
+    // push order within a group so that the frames of a stream stay in sequence
+    return a.order < b.order;
+}
+
+void DVStreamMultiplexer::sortQueue(unsigned int channel)
+{
+    std::vector<Frame>& queue = m_queues[channel];
+    DVRate currentRate = m_controller.getChannelRate(channel);
+    int currentGainIn = m_controller.getChannelGainIn(channel);
+    int currentGainOut = m_controller.getChannelGainOut(channel);
+
+    for (unsigned int i = 0; i < queue.size(); i++)
+    {
+        Frame& frame = queue[i];
+        frame.first = (frame.rate == currentRate) && (frame.gain == (frame.encode ? currentGainIn : currentGainOut));
+        frame.groupDeadlineUs = frame.deadlineUs;
+
+        for (unsigned int j = 0; j < queue.size(); j++)
+        {
+            if (sameConfig(frame, queue[j]) && (queue[j].phase == frame.phase) && (queue[j].deadlineUs < frame.groupDeadlineUs)) {
+                frame.groupDeadlineUs = queue[j].deadlineUs;
+            }
+        }
+    }
+
+    std::sort(queue.begin(), queue.end(), sendOrder); // total order: no stable sort buffer to allocate
+}
+
+void DVStreamMultiplexer::complete(const Frame& frame, bool ok, bool late, DVStreamCallback callback, void *context)
+{
+    if (callback)
+    {
+        DVStreamCompletion completion;
+        completion.streamId = frame.streamId;
+        completion.tag = frame.tag;
+        completion.encode = frame.encode;
+        completion.ok = ok;
+        completion.late = late;
+        callback(completion, context);
+    }
+}
+
+unsigned int DVStreamMultiplexer::process(DVStreamCallback callback, void *context)
+{
+    unsigned int nbChannels = m_controller.getNbChannels();
+    unsigned int next[DV3000_MAX_CHANNELS] = {0};
+    unsigned int nbOk = 0;
+
+    for (unsigned int channel = 0; channel < nbChannels; channel++)
+    {
+        sortQueue(channel);
+        m_inFlight[channel].swap(m_queues[channel]);
+        m_queues[channel].clear();
+
+        for (unsigned int i = 0; i < m_inFlight[channel].size(); i++)
+        {
+            if ((i == 0) ? !m_inFlight[channel][i].first : !sameConfig(m_inFlight[channel][i], m_inFlight[channel][i - 1])) {
+                m_nbGroups++;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < m_streams.size(); i++)
+    {
+        m_streams[i].queued = false;
+        m_streams[i].phase = 0;
+    }
+
+    bool remaining = true;
+
+    while (remaining || (m_controller.getNbInFlight() > 0))
+    {
+        remaining = false;
+        bool submitted = false;
+
+        // one frame per channel at a time so that the channels of the device work in parallel
+        for (unsigned int channel = 0; channel < nbChannels; channel++)
+        {
+            std::vector<Frame>& frames = m_inFlight[channel];
+
+            while (next[channel] < frames.size())
+            {
+                Frame& frame = frames[next[channel]];
+
+                if (nowUs() > frame.deadlineUs)
+                {
+                    complete(frame, false, true, callback, context);
+                    next[channel]++;
+                    continue;
+                }
+
+                if (m_controller.getNbInFlight(channel) >= m_controller.getPipelineDepth()) {
+                    break;
+                }
+
+                bool ok = frame.encode ?
+                        m_controller.submitEncode(frame.audioIn, frame.mbeOut, frame.rate, frame.gain, next[channel], channel) :
+                        m_controller.submitDecode(frame.audioOut, frame.mbeIn, frame.rate, frame.gain, next[channel], channel);
+
+                if (!ok) {
+                    complete(frame, false, false, callback, context);
+                } else {
+                    submitted = true;
+                }
+
+                next[channel]++;
+                break;
+            }
+
+            if (next[channel] < frames.size()) {
+                remaining = true;
+            }
+        }
+
+        if (submitted && remaining) {
+            continue;
+        }
+
+        DVCompletion completion;
+
+        if (m_controller.pollCompletion(completion))
+        {
+            if ((completion.channel < nbChannels) && (completion.tag < m_inFlight[completion.channel].size()))
+            {
+                complete(m_inFlight[completion.channel][completion.tag], completion.ok, false, callback, context);
+
+                if (completion.ok) {
+                    nbOk++;
+                }
+            }
+        }
+        else if (!submitted && remaining && (m_controller.getNbInFlight() == 0))
+        {
+            // nothing in flight and nothing can be sent: should not happen
+            break;
+        }
+    }
+
+    for (unsigned int channel = 0; channel < nbChannels; channel++)
+    {
+        for (unsigned int i = next[channel]; i < m_inFlight[channel].size(); i++) {
+            complete(m_inFlight[channel][i], false, false, callback, context);
+        }
+
+        m_inFlight[channel].clear();
+    }
+
+    return nbOk;
+}
+
+uint64_t DVStreamMultiplexer::nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+} // namespace SerialDV
@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DVSTREAMMULTIPLEXER_H_
+#define DVSTREAMMULTIPLEXER_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include "dvcontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int DV_STREAM_FRAME_PERIOD_US = 20000U; //!< Default time a frame has to complete once pushed
+
+/** Result of a frame pushed to the multiplexer */
+struct DVStreamCompletion
+{
+    int streamId;
+    unsigned int tag;  //!< Tag given when the frame was pushed
+    bool encode;
+    bool ok;
+    bool late;         //!< Not sent because its deadline had passed
+};
+
+typedef void (*DVStreamCallback)(const DVStreamCompletion& completion, void *context);
+
+/** Multiplexes many logical streams on the channels of one device. Each stream has its own
+ * rate and gain and is bound to a channel for its lifetime so that the vocoder state follows it.
+ * Streams are bound preferably to a channel already carrying streams of the same rate to
+ * avoid RATEP changes. At each processing cycle the frames queued on a channel are grouped
+ * by configuration starting with the current one of the channel, the groups being ordered by
+ * earliest deadline, so that a configuration change is sent at most once per group. Within a
+ * group frames keep their push order. The frames of a stream are never sent out of push order:
+ * those pushed after a configuration change of the stream are only grouped with the frames
+ * pushed after at least as many changes of their own stream and are sent after the others.
+ *
+ * The device controller is not owned and must not be used directly meanwhile. All methods are
+ * called from the same thread.
+ */
+class DVStreamMultiplexer
+{
+public:
+    DVStreamMultiplexer(DVController& controller);
+    ~DVStreamMultiplexer();
+
+    /** Opens a stream with the given configuration. Returns its identifier or -1 if the device is not open */
+    int openStream(DVRate rate, int gain = 0);
+    void closeStream(int streamId);
+
+    /** Changes the configuration of a stream. It remains on the same channel. Frames already
+     * queued keep the previous configuration and are sent before the ones pushed afterwards.
+     */
+    bool setStreamConfig(int streamId, DVRate rate, int gain);
+
+    /** Channel the stream is bound to */
+    bool getStreamChannel(int streamId, unsigned int& channel) const;
+
+    /** Queues a frame of the stream for the next cycle. Buffers must remain valid until its completion.
+     * The deadline is the time limit to send the frame (0 for DV_STREAM_FRAME_PERIOD_US from now).
+     */
+    bool pushEncode(int streamId, const short *audioFrame, unsigned char *mbeFrame, unsigned int tag, uint64_t deadlineUs = 0);
+    bool pushDecode(int streamId, short *audioFrame, const unsigned char *mbeFrame, unsigned int tag, uint64_t deadlineUs = 0);
+
+    /** Sends all the queued frames and waits for their replies calling the callback for each one.
+     * Returns the number of frames successfully processed.
+     */
+    unsigned int process(DVStreamCallback callback, void *context);
+
+    /** Number of frames queued for the next cycle */
+    unsigned int getNbQueued() const;
+
+    /** Preallocates the queues of each channel so that pushing up to this number of frames
+     * per channel and cycle does not allocate.
+     */
+    void reserve(unsigned int nbFramesPerChannel);
+
+    /** Number of configuration groups sent since the creation i.e. the most configuration changes they may cost */
+    uint64_t getNbGroups() const { return m_nbGroups; }
+
+    /** Current time in microseconds on the clock used for the deadlines */
+    static uint64_t nowUs();
+
+private:
+    struct Stream
+    {
+        bool used;
+        unsigned int channel;
+        DVRate rate;
+        int gain;
+        bool queued;        //!< Frames pushed since the last cycle or configuration change
+        unsigned int phase; //!< Configuration changes with frames queued since the last cycle
+    };
+
+    struct Frame
+    {
+        int streamId;
+        unsigned int tag;
+        bool encode;
+        DVRate rate;
+        int gain;
+        const short *audioIn;
+        short *audioOut;
+        const unsigned char *mbeIn;
+        unsigned char *mbeOut;
+        uint64_t deadlineUs;
+        uint64_t groupDeadlineUs; //!< Earliest deadline of the frames with the same configuration and phase on the channel
+        bool first;               //!< Same configuration as the channel currently has
+        unsigned int phase;       //!< Phase of its stream when pushed: sent after the frames of the lower phases
+        unsigned int order;       //!< Position in the queue when pushed to keep the push order within a group
+    };
+
+    DVController& m_controller;
+    std::vector<Stream> m_streams;
+    std::vector<Frame> m_queues[DV3000_MAX_CHANNELS]; //!< Frames queued per channel
+    std::vector<Frame> m_inFlight[DV3000_MAX_CHANNELS]; //!< Frames of the cycle per channel in sending order
+    uint64_t m_nbGroups;
+
+    bool push(int streamId, const Frame& frame);
+    void sortQueue(unsigned int channel);
+    void complete(const Frame& frame, bool ok, bool late, DVStreamCallback callback, void *context);
+
+    static bool sameConfig(const Frame& a, const Frame& b);
+    static bool sendOrder(const Frame& a, const Frame& b);
+};
+
+} // namespace SerialDV
+
+#endif /* DVSTREAMMULTIPLEXER_H_ */
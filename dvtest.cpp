@@ -24,30 +24,74 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <fcntl.h>
-#include <math.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 #include "dvcontroller.h"
+#include "dvdevicepool.h"
+#include "dvambefile.h"
+#include "samplesresampler.h"
+#include "dvdecodecache.h"
+#include "dvstats.h"
+#include "dvmetricsexporter.h"
 
 int exitflag;
 
+static const unsigned int BULK_CHUNK_FRAMES = 256U;   //!< Frames per channel encoded then decoded in one go in bulk mode
+static const unsigned int BULK_PIPELINE_DEPTH = 8U;   //!< Frames in flight per channel in bulk mode
+static const unsigned int STREAM_CHUNK_FRAMES = 64U;  //!< Frames read at most at once in encode and decode modes
+static const unsigned int STREAM_PIPELINE_DEPTH = 8U; //!< Frames in flight in encode and decode modes
+static const unsigned int PACED_FRAME_PERIOD_US = 20000U; //!< One frame per stream every 20 ms in paced mode
+static const unsigned int PACED_RING_FRAMES = 16U;     //!< Frames of a paced stream between encoding and decoded output at most
+static const unsigned int PACED_DRAIN_US = 1000000U;   //!< Time left to the frames in flight at the end of the paced mode
+
+typedef enum
+{
+    ModeLoop,   //!< Audio to AMBE to audio
+    ModeEncode, //!< Audio to AMBE file
+    ModeDecode  //!< AMBE file to audio
+} TestMode;
+
 static void usage ();
 static void sigfun (int sig);
+static bool runBulk(SerialDV::DVDevicePool& pool, int in_file_fd, int out_file_fd, SerialDV::DVRate rate, int gain);
+static bool runStream(SerialDV::DVController& controller, TestMode mode, int in_file_fd, int out_file_fd, SerialDV::DVRate rate,
+    SerialDV::SamplesResampler& resampler);
+static bool runPaced(SerialDV::DVController& controller, const std::string& device, unsigned int nbStreams, int in_file_fd, int out_file_fd,
+    SerialDV::DVRate rate, SerialDV::SamplesResampler& resampler);
+static void setHostGain(SerialDV::DVController& controller, float gain);
 
 void usage()
 {
     fprintf(stderr, "\n");
     fprintf(stderr, "Usage:\n");
     fprintf(stderr, "  dvtest [options] Encode/decode test loop\n");
+    fprintf(stderr, "  dvtest -m encode [options] Encode audio to an AMBE file\n");
+    fprintf(stderr, "  dvtest -m decode [options] Decode an AMBE file to audio\n");
     fprintf(stderr, "  dvtest -h        Show help\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Input/Output options:\n");
     fprintf(stderr, "  -i <device>   Audio input device or file with 8 kS/s S16LE audio samples (default is /dev/audio, - for piped stdin)\n");
+    fprintf(stderr, "                AMBE file in decode mode\n");
     fprintf(stderr, "  -o <device>   Audio output device or file with 8 kS/s S16LE audio samples (default is /dev/audio, - for stdout)\n");
+    fprintf(stderr, "                AMBE file in encode mode\n");
+    fprintf(stderr, "  -m <mode>     loop (default), encode or decode\n");
     fprintf(stderr, "  -D <device>   Use DVSI AMBE3000 based device for AMBE decoding (e.g. ThumbDV)\n");
     fprintf(stderr, "                Device name is the corresponding TTY USB device e.g /dev/ttyUSB0\n");
+    fprintf(stderr, "  -s <speed>    Serial link speed in bauds (default 460800)\n");
+    fprintf(stderr, "  -b            Bulk mode: input and output files are memory mapped and processed with the pipelined API.\n");
+    fprintf(stderr, "                With several -D options the input is split across all devices and channels.\n");
+    fprintf(stderr, "  -p <streams>  Paced mode: the encode/decode loop is run in real time for this number of streams\n");
+    fprintf(stderr, "                each fed with one frame of the input every 20 ms. The input is read first.\n");
+    fprintf(stderr, "                The decoded audio of the first stream goes to the output.\n");
+    fprintf(stderr, "  -M <port>     Serve the device metrics in the Prometheus format on http://host:port/metrics\n");
+    fprintf(stderr, "  -S <host:port> Push the device metrics to this statsd server every 10 seconds\n");
     fprintf(stderr, "Decoder options:\n");
-    fprintf(stderr, "  -f <num>      Format index\n");
+    fprintf(stderr, "  -f <num>      Format index (in decode mode taken from the AMBE file)\n");
     fprintf(stderr, "     0:         None (does nothing - default)\n");
     fprintf(stderr, "     1:         3600x2400 (e.g. D-Star)\n");
     fprintf(stderr, "     2:         3600x2450 (e.g. DMR)\n");
@@ -56,7 +100,9 @@ void usage()
     fprintf(stderr, "     5:         2400 no FEC\n");
     fprintf(stderr, "     6:         2450 no FEC\n");
     fprintf(stderr, "     7:         4400 no FEC\n");
-    fprintf(stderr, "  -g <num>      linear gain applied to output (decoder - default 1.0)\n");
+    fprintf(stderr, "  -g <num>      linear gain applied to output by the host (decoder - default 1.0)\n");
+    fprintf(stderr, "  -r <rate>     output sample rate 8000 (default), 16000 or 48000 (not in bulk mode)\n");
+    fprintf(stderr, "  -c <kB>       cache decoded frames up to this memory in the encode/decode loop (default none)\n");
     fprintf(stderr, "\n");
 }
 
@@ -66,6 +112,575 @@ void sigfun(int sig __attribute__((unused)))
     signal(SIGINT, SIG_DFL);
 }
 
+/** Encodes then decodes the frames [first, first + nbFrames) of the input on all the channels
+ * of one device. Each channel takes a contiguous part so that the vocoder state follows the
+ * audio and frames of the channels are interleaved on the link with the pipelined API.
+ */
+static void bulkDevice(SerialDV::DVDevicePool *pool, unsigned int deviceIndex, const short *audioIn, short *audioOut,
+        size_t first, size_t nbFrames, SerialDV::DVRate rate, int gain, size_t *nbFailures)
+{
+    SerialDV::DVController *controller = pool->acquireController(deviceIndex);
+
+    if (!controller) {
+        return;
+    }
+
+    unsigned int nbChannels = controller->getNbChannels();
+    unsigned int nbMbeBytes = SerialDV::DVController::getNbMbeBytes(rate);
+    std::vector<unsigned char> mbeFrames(nbChannels * BULK_CHUNK_FRAMES * SerialDV::MBE_FRAME_MAX_LENGTH_BYTES);
+    size_t position[SerialDV::DV3000_MAX_CHANNELS];
+    size_t end[SerialDV::DV3000_MAX_CHANNELS];
+
+    for (unsigned int channel = 0; channel < nbChannels; channel++)
+    {
+        position[channel] = first + (nbFrames * channel) / nbChannels;
+        end[channel] = first + (nbFrames * (channel + 1)) / nbChannels;
+    }
+
+    controller->setPipelineDepth(BULK_PIPELINE_DEPTH);
+
+    while (exitflag == 0)
+    {
+        unsigned int count[SerialDV::DV3000_MAX_CHANNELS];
+        bool remaining = false;
+
+        for (unsigned int channel = 0; channel < nbChannels; channel++)
+        {
+            count[channel] = std::min((size_t) BULK_CHUNK_FRAMES, end[channel] - position[channel]);
+            remaining = remaining || (count[channel] > 0);
+        }
+
+        if (!remaining) {
+            break;
+        }
+
+        // encode the chunk of each channel to the AMBE buffer then decode it to the output
+        for (int pass = 0; pass < 2; pass++)
+        {
+            unsigned int next[SerialDV::DV3000_MAX_CHANNELS] = {0, 0, 0};
+
+            while (true)
+            {
+                bool submitted = false;
+
+                for (unsigned int channel = 0; channel < nbChannels; channel++)
+                {
+                    if ((next[channel] == count[channel]) || (controller->getNbInFlight(channel) >= BULK_PIPELINE_DEPTH)) {
+                        continue;
+                    }
+
+                    size_t frame = position[channel] + next[channel];
+                    unsigned int tag = channel * BULK_CHUNK_FRAMES + next[channel];
+                    bool ok = (pass == 0) ?
+                        controller->submitEncode(&audioIn[frame * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbeFrames[tag * nbMbeBytes], rate, 0, tag, channel) :
+                        controller->submitDecode(&audioOut[frame * SerialDV::MBE_AUDIO_BLOCK_SIZE], &mbeFrames[tag * nbMbeBytes], rate, gain, tag, channel);
+
+                    if (!ok) {
+                        (*nbFailures)++;
+                    }
+
+                    next[channel]++;
+                    submitted = true;
+                }
+
+                if (submitted) {
+                    continue;
+                }
+
+                SerialDV::DVCompletion completion;
+
+                if (!controller->pollCompletion(completion)) {
+                    break; // all submitted and completed
+                }
+
+                if (!completion.ok) {
+                    (*nbFailures)++;
+                }
+            }
+        }
+
+        for (unsigned int channel = 0; channel < nbChannels; channel++) {
+            position[channel] += count[channel];
+        }
+    }
+
+    pool->releaseController(deviceIndex);
+}
+
+/** Bulk transcoding of a regular input file to a regular output file through memory mappings.
+ * The input is split in as many contiguous shards as devices in the pool. Each device writes
+ * its output frames in place so that the output is in input order.
+ */
+bool runBulk(SerialDV::DVDevicePool& pool, int in_file_fd, int out_file_fd, SerialDV::DVRate rate, int gain)
+{
+    struct stat inStat;
+
+    if ((fstat(in_file_fd, &inStat) != 0) || !S_ISREG(inStat.st_mode))
+    {
+        fprintf(stderr, "Bulk mode needs a regular input file\n");
+        return false;
+    }
+
+    if (SerialDV::DVController::getNbMbeBytes(rate) == 0)
+    {
+        fprintf(stderr, "Bulk mode needs a supported format\n");
+        return false;
+    }
+
+    size_t nbFrames = inStat.st_size / SerialDV::MBE_AUDIO_BLOCK_BYTES;
+    size_t length = nbFrames * SerialDV::MBE_AUDIO_BLOCK_BYTES;
+
+    if (length != (size_t) inStat.st_size) {
+        fprintf(stderr, "Ignoring incomplete audio frame at the end of the input\n");
+    }
+
+    if (nbFrames == 0)
+    {
+        fprintf(stderr, "No input\n");
+        return true;
+    }
+
+    if (ftruncate(out_file_fd, length) != 0)
+    {
+        fprintf(stderr, "Bulk mode needs a regular output file: %s\n", strerror(errno));
+        return false;
+    }
+
+    void *input = mmap(0, length, PROT_READ, MAP_PRIVATE, in_file_fd, 0);
+
+    if (input == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map input: %s\n", strerror(errno));
+        return false;
+    }
+
+    void *output = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, out_file_fd, 0);
+
+    if (output == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map output: %s\n", strerror(errno));
+        munmap(input, length);
+        return false;
+    }
+
+    madvise(input, length, MADV_SEQUENTIAL);
+    madvise(output, length, MADV_SEQUENTIAL);
+
+    unsigned int nbDevices = pool.getNbDevices();
+    std::vector<std::thread> threads;
+    std::vector<size_t> nbFailures(nbDevices, 0);
+
+    for (unsigned int i = 0; i < nbDevices; i++)
+    {
+        size_t first = (nbFrames * i) / nbDevices;
+        size_t last = (nbFrames * (i + 1)) / nbDevices;
+        threads.push_back(std::thread(bulkDevice, &pool, i, (const short *) input, (short *) output,
+            first, last - first, rate, gain, &nbFailures[i]));
+    }
+
+    size_t totalFailures = 0;
+
+    for (unsigned int i = 0; i < nbDevices; i++)
+    {
+        threads[i].join();
+        totalFailures += nbFailures[i];
+    }
+
+    munmap(output, length);
+    munmap(input, length);
+
+    fprintf(stderr, "Processed %lu frames on %u devices with %lu failures\n",
+        (unsigned long) nbFrames, nbDevices, (unsigned long) totalFailures);
+    return totalFailures == 0;
+}
+
+/** Reads up to maxFrames complete frames of frameBytes bytes after the pending bytes already
+ * in the buffer. Waits for at least one complete frame unless the end of input is reached.
+ * Returns the number of complete frames in the buffer.
+ */
+static unsigned int readFrames(int fd, unsigned char *buffer, unsigned int frameBytes, unsigned int maxFrames, unsigned int& pending, bool& eof)
+{
+    while (pending < frameBytes)
+    {
+        int result = read(fd, buffer + pending, frameBytes * maxFrames - pending);
+
+        if ((result < 0) && (errno == EINTR) && (exitflag == 0)) {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            eof = true;
+            break;
+        }
+
+        pending += result;
+    }
+
+    return pending / frameBytes;
+}
+
+static bool writeAll(int fd, const unsigned char *buffer, unsigned int length)
+{
+    while (length > 0)
+    {
+        int result = write(fd, buffer, length);
+
+        if ((result < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            fprintf(stderr, "Error writing to output: %s\n", strerror(errno));
+            return false;
+        }
+
+        buffer += result;
+        length -= result;
+    }
+
+    return true;
+}
+
+/** One way streaming: audio to AMBE file or AMBE file to audio. Chunks of frames are read
+ * as they come and run through the pipelined batch methods so that the device is only loaded
+ * with the half of the loopback that is needed.
+ */
+bool runStream(SerialDV::DVController& controller, TestMode mode, int in_file_fd, int out_file_fd, SerialDV::DVRate rate,
+    SerialDV::SamplesResampler& resampler)
+{
+    bool encode = (mode == ModeEncode);
+
+    if (encode)
+    {
+        if (!SerialDV::DVAmbeFile::writeHeader(out_file_fd, rate)) {
+            return false;
+        }
+    }
+    else
+    {
+        SerialDV::DVRate fileRate;
+
+        if (!SerialDV::DVAmbeFile::readHeader(in_file_fd, fileRate)) {
+            return false;
+        }
+
+        if ((rate != SerialDV::DVRateNone) && (rate != fileRate)) {
+            fprintf(stderr, "Format %d given but the input has format %d. Using the input format\n", (int) rate, (int) fileRate);
+        }
+
+        rate = fileRate;
+    }
+
+    unsigned int nbMbeBytes = SerialDV::DVController::getNbMbeBytes(rate);
+    unsigned int inFrameBytes = encode ? SerialDV::MBE_AUDIO_BLOCK_BYTES : nbMbeBytes;
+    std::vector<short> audio(STREAM_CHUNK_FRAMES * SerialDV::MBE_AUDIO_BLOCK_SIZE);
+    std::vector<unsigned char> mbe(STREAM_CHUNK_FRAMES * SerialDV::MBE_FRAME_MAX_LENGTH_BYTES);
+    std::vector<short> resampled(STREAM_CHUNK_FRAMES * SerialDV::MBE_AUDIO_BLOCK_SIZE * resampler.getFactor());
+    unsigned char *input = encode ? (unsigned char *) audio.data() : mbe.data();
+    unsigned int pending = 0;
+    bool eof = false;
+    uint64_t nbFrames = 0;
+
+    controller.setPipelineDepth(STREAM_PIPELINE_DEPTH);
+
+    while ((exitflag == 0) && !eof)
+    {
+        unsigned int count = readFrames(in_file_fd, input, inFrameBytes, STREAM_CHUNK_FRAMES, pending, eof);
+
+        if (count == 0) {
+            break;
+        }
+
+        unsigned int done = encode ?
+            controller.encodeBatch(audio.data(), count, mbe.data(), rate, 0) :
+            controller.decodeBatch(audio.data(), count, mbe.data(), rate, 0);
+        bool written;
+
+        if (encode)
+        {
+            written = writeAll(out_file_fd, mbe.data(), done * nbMbeBytes);
+        }
+        else
+        {
+            resampler.process(audio.data(), done * SerialDV::MBE_AUDIO_BLOCK_SIZE, resampled.data());
+            written = writeAll(out_file_fd, (const unsigned char *) resampled.data(), done * SerialDV::MBE_AUDIO_BLOCK_BYTES * resampler.getFactor());
+        }
+
+        nbFrames += done;
+
+        if (done != count)
+        {
+            fprintf(stderr, "%s failure. Terminating\n", encode ? "Encoding" : "Decoding");
+            return false;
+        }
+
+        if (!written) {
+            return false;
+        }
+
+        // keep the incomplete frame for the next chunk
+        pending -= count * inFrameBytes;
+        memmove(input, input + count * inFrameBytes, pending);
+    }
+
+    if (pending != 0) {
+        fprintf(stderr, "Incomplete %s frame at the end of the input\n", encode ? "audio" : "AMBE");
+    }
+
+    fprintf(stderr, "%s %lu frames\n", encode ? "Encoded" : "Decoded", (unsigned long) nbFrames);
+    return true;
+}
+
+/** One stream of the paced mode. The frames of a stream are pushed for encoding at each tick then
+ * for decoding as soon as encoded. They stay in the ring from their tick to their decoded output.
+ */
+struct PacedStream
+{
+    short audio[PACED_RING_FRAMES][SerialDV::MBE_AUDIO_BLOCK_SIZE];
+    unsigned char mbe[PACED_RING_FRAMES][SerialDV::MBE_FRAME_MAX_LENGTH_BYTES];
+    uint64_t tickUs[PACED_RING_FRAMES];   //!< Time the frame was due
+    unsigned int nbPushed;                //!< Frames pushed for encoding
+    unsigned int nbInFlight;              //!< Frames pushed and not yet decoded
+    unsigned int nbFrames;                //!< Frames decoded
+    unsigned int nbMisses;                //!< Frames decoded after the next frame was due
+    unsigned int nbOverruns;              //!< Frames skipped because the ring or the device queue was full
+    unsigned int nbFailures;              //!< Frames that failed to encode or decode
+    uint64_t lastOutputUs;                //!< Time of the last decoded frame
+    SerialDV::DVLatencyHistogram latency; //!< Tick to decoded frame
+    SerialDV::DVLatencyHistogram jitter;  //!< Deviation of the time between decoded frames from the frame period
+
+    PacedStream() :
+        nbPushed(0), nbInFlight(0), nbFrames(0), nbMisses(0), nbOverruns(0), nbFailures(0), lastOutputUs(0)
+    {}
+};
+
+static uint64_t monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/** Reads the latency timer of an FTDI USB serial device from sysfs. It must be 1 ms as explained
+ * in the Readme for the device to keep up with 20 ms streams. Returns false if it is higher.
+ */
+static bool checkLatencyTimer(const std::string& device)
+{
+    std::string name = device.substr(device.find_last_of('/') + 1);
+
+    if (name.compare(0, 6, "ttyUSB") != 0) {
+        return true; // not an USB serial device
+    }
+
+    std::string path = "/sys/bus/usb-serial/devices/" + name + "/latency_timer";
+    FILE *file = fopen(path.c_str(), "r");
+    int latencyTimer = -1;
+
+    if (file)
+    {
+        if (fscanf(file, "%d", &latencyTimer) != 1) {
+            latencyTimer = -1;
+        }
+
+        fclose(file);
+    }
+
+    if (latencyTimer < 0)
+    {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        return true;
+    }
+
+    if (latencyTimer > 1)
+    {
+        fprintf(stderr, "The latency timer of %s is %d ms. Set it to 1 ms with: echo 1 | sudo tee %s\n", name.c_str(), latencyTimer, path.c_str());
+        return false;
+    }
+
+    fprintf(stderr, "The latency timer of %s is %d ms\n", name.c_str(), latencyTimer);
+    return true;
+}
+
+/** Handles a completion of the paced mode: an encoded frame is pushed for decoding at once and
+ * a decoded frame ends its journey in the ring.
+ */
+static void pacedCompletion(SerialDV::DVController& controller, std::vector<PacedStream>& streams, const SerialDV::DVCompletion& completion,
+    int out_file_fd, SerialDV::DVRate rate, SerialDV::SamplesResampler& resampler, short *resampled)
+{
+    PacedStream& stream = streams[completion.tag / PACED_RING_FRAMES];
+    unsigned int slot = completion.tag % PACED_RING_FRAMES;
+
+    if (completion.encode && completion.ok)
+    {
+        if (controller.pushDecode(stream.audio[slot], stream.mbe[slot], rate, 0, completion.tag, completion.channel)) {
+            return;
+        }
+
+        stream.nbOverruns++;
+        stream.nbInFlight--;
+        return;
+    }
+
+    stream.nbInFlight--;
+
+    if (!completion.ok)
+    {
+        stream.nbFailures++;
+        return;
+    }
+
+    uint64_t now = monotonicUs();
+    uint64_t latency = now - stream.tickUs[slot];
+    stream.latency.add(latency);
+    stream.nbFrames++;
+
+    if (latency > PACED_FRAME_PERIOD_US) {
+        stream.nbMisses++;
+    }
+
+    if (stream.lastOutputUs != 0)
+    {
+        uint64_t interval = now - stream.lastOutputUs;
+        stream.jitter.add(interval > PACED_FRAME_PERIOD_US ? interval - PACED_FRAME_PERIOD_US : PACED_FRAME_PERIOD_US - interval);
+    }
+
+    stream.lastOutputUs = now;
+
+    if (&stream == &streams[0])
+    {
+        resampler.process(stream.audio[slot], SerialDV::MBE_AUDIO_BLOCK_SIZE, resampled);
+        writeAll(out_file_fd, (const unsigned char *) resampled, SerialDV::MBE_AUDIO_BLOCK_BYTES * resampler.getFactor());
+    }
+}
+
+/** Real time encode/decode loop on nbStreams streams. At each 20 ms tick taken from an absolute
+ * deadline timer one frame of each stream is pushed for encoding on the channels in turn. The time
+ * between ticks is spent handling the completions. Prints the timer lateness, the deadline misses,
+ * the latency from the tick to the decoded frame and the jitter of the decoded frames per stream.
+ */
+bool runPaced(SerialDV::DVController& controller, const std::string& device, unsigned int nbStreams, int in_file_fd, int out_file_fd,
+    SerialDV::DVRate rate, SerialDV::SamplesResampler& resampler)
+{
+    if (SerialDV::DVController::getNbMbeBytes(rate) == 0)
+    {
+        fprintf(stderr, "Paced mode needs a supported format\n");
+        return false;
+    }
+
+    std::vector<short> input;
+    short frame[SerialDV::MBE_AUDIO_BLOCK_SIZE];
+    unsigned int pending = 0;
+    bool eof = false;
+
+    while ((exitflag == 0) && (readFrames(in_file_fd, (unsigned char *) frame, SerialDV::MBE_AUDIO_BLOCK_BYTES, 1, pending, eof) == 1))
+    {
+        input.insert(input.end(), frame, frame + SerialDV::MBE_AUDIO_BLOCK_SIZE);
+        pending = 0;
+    }
+
+    unsigned int nbTicks = input.size() / SerialDV::MBE_AUDIO_BLOCK_SIZE;
+    unsigned int nbChannels = controller.getNbChannels();
+    std::vector<PacedStream> streams(nbStreams);
+    std::vector<short> resampled(SerialDV::MBE_AUDIO_BLOCK_SIZE * resampler.getFactor());
+    SerialDV::DVLatencyHistogram lateness; // timer wake up after the tick
+    SerialDV::DVCompletion completion;
+
+    checkLatencyTimer(device);
+    controller.setPipelineDepth(SerialDV::DV_PIPELINE_MAX_DEPTH);
+
+    if (!controller.startStreaming()) {
+        return false;
+    }
+
+    fprintf(stderr, "Pacing %u frames on %u streams over %u channels\n", nbTicks, nbStreams, nbChannels);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t tickUs = deadline.tv_sec * 1000000ULL + deadline.tv_nsec / 1000;
+
+    for (unsigned int tick = 0; (tick < nbTicks) && (exitflag == 0); tick++)
+    {
+        while ((clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0) == EINTR) && (exitflag == 0)) {
+        }
+
+        lateness.add(monotonicUs() - tickUs);
+
+        for (unsigned int i = 0; i < nbStreams; i++)
+        {
+            PacedStream& stream = streams[i];
+            unsigned int slot = stream.nbPushed % PACED_RING_FRAMES;
+            unsigned int channel = i % nbChannels;
+
+            if ((stream.nbInFlight < PACED_RING_FRAMES)
+             && controller.pushEncode(&input[tick * SerialDV::MBE_AUDIO_BLOCK_SIZE], stream.mbe[slot], rate, 0, i * PACED_RING_FRAMES + slot, channel))
+            {
+                stream.tickUs[slot] = tickUs;
+                stream.nbPushed++;
+                stream.nbInFlight++;
+            }
+            else
+            {
+                stream.nbOverruns++;
+            }
+        }
+
+        tickUs += PACED_FRAME_PERIOD_US;
+        deadline.tv_sec = tickUs / 1000000ULL;
+        deadline.tv_nsec = (tickUs % 1000000ULL) * 1000;
+
+        // handle the completions until the next tick and leave the last bit to the timer
+        uint64_t now;
+
+        while (((now = monotonicUs()) + 1000 < tickUs) && controller.popCompletion(completion, tickUs - now - 1000)) {
+            pacedCompletion(controller, streams, completion, out_file_fd, rate, resampler, resampled.data());
+        }
+    }
+
+    uint64_t drainEnd = monotonicUs() + PACED_DRAIN_US;
+
+    while ((controller.getNbInFlight() != 0) && (monotonicUs() < drainEnd))
+    {
+        if (controller.popCompletion(completion, 1000)) {
+            pacedCompletion(controller, streams, completion, out_file_fd, rate, resampler, resampled.data());
+        }
+    }
+
+    controller.stopStreaming();
+
+    while (controller.popCompletion(completion)) {
+        pacedCompletion(controller, streams, completion, out_file_fd, rate, resampler, resampled.data());
+    }
+
+    fprintf(stderr, "Timer lateness (us): p50 %u p99 %u max %u\n", lateness.getP50(), lateness.getP99(), lateness.getMax());
+    unsigned int totalMisses = 0, totalLost = 0;
+
+    for (unsigned int i = 0; i < nbStreams; i++)
+    {
+        const PacedStream& stream = streams[i];
+        fprintf(stderr, "Stream %u channel %u: %u frames %u misses %u overruns %u failures latency (us) p50 %u p99 %u max %u jitter (us) p50 %u p99 %u max %u\n",
+            i, i % nbChannels, stream.nbFrames, stream.nbMisses, stream.nbOverruns, stream.nbFailures,
+            stream.latency.getP50(), stream.latency.getP99(), stream.latency.getMax(),
+            stream.jitter.getP50(), stream.jitter.getP99(), stream.jitter.getMax());
+        totalMisses += stream.nbMisses;
+        totalLost += stream.nbOverruns + stream.nbFailures + stream.nbInFlight;
+    }
+
+    const SerialDV::DVOperationStats& encodeStats = controller.getStats().operations[SerialDV::DVOperationEncode];
+    fprintf(stderr, "Encode write to first reply byte (us): p50 %u p99 %u max %u\n",
+        encodeStats.firstByteTime.getP50(), encodeStats.firstByteTime.getP99(), encodeStats.firstByteTime.getMax());
+    fprintf(stderr, "%u streams: %u deadline misses %u frames lost\n", nbStreams, totalMisses, totalLost);
+    return (totalMisses == 0) && (totalLost == 0);
+}
+
+void setHostGain(SerialDV::DVController& controller, float gain)
+{
+    for (unsigned int channel = 0; channel < controller.getNbChannels(); channel++) {
+        controller.setHostGain(channel, gain);
+    }
+}
+
 int main(int argc, char **argv)
 {
     int c;
@@ -77,9 +692,17 @@ int main(int argc, char **argv)
     int  in_file_fd = -1;
     char out_file[1024];
     int  out_file_fd = -1;
-    std::string dvSerialDevice;
+    std::vector<std::string> dvSerialDevices;
+    bool bulk = false;
+    unsigned int nbPacedStreams = 0;
+    unsigned int metricsPort = 0;
+    std::string statsdServer;
+    TestMode mode = ModeLoop;
     SerialDV::DVRate dvRate = SerialDV::DVRateNone;
     float  gainLin = 1.0f;
+    unsigned int outputRate = SerialDV::SAMPLES_INPUT_RATE;
+    unsigned int cacheKBytes = 0;
+    int serialSpeed = SerialDV::SERIAL_460800;
 
     // Catch Ctrl-C and SIGTERM
     struct sigaction sigact;
@@ -88,7 +711,7 @@ int main(int argc, char **argv)
     sigact.sa_flags = SA_RESETHAND;
 
     while ((c = getopt(argc, argv,
-            "hi:o:f:D:g:")) != -1)
+            "hi:o:f:D:g:r:c:s:bm:p:M:S:")) != -1)
     {
         opterr = 0;
         switch (c)
@@ -105,7 +728,25 @@ int main(int argc, char **argv)
             out_file[1023] = '\0';
             break;
         case 'D':
-            dvSerialDevice = std::string(optarg);
+            dvSerialDevices.push_back(std::string(optarg));
+            break;
+        case 'b':
+            bulk = true;
+            break;
+        case 'm':
+            if (strcmp(optarg, "encode") == 0) {
+                mode = ModeEncode;
+            } else if (strcmp(optarg, "decode") == 0) {
+                mode = ModeDecode;
+            } else if (strcmp(optarg, "loop") == 0) {
+                mode = ModeLoop;
+            } else {
+                usage();
+                exit(0);
+            }
+            break;
+        case 's':
+            sscanf(optarg, "%d", &serialSpeed);
             break;
         case 'f':
             int formatNum;
@@ -122,12 +763,53 @@ int main(int argc, char **argv)
                 gainLin = 0.0f;
             }
             break;
+        case 'r':
+            sscanf(optarg, "%u", &outputRate);
+            break;
+        case 'c':
+            sscanf(optarg, "%u", &cacheKBytes);
+            break;
+        case 'p':
+            sscanf(optarg, "%u", &nbPacedStreams);
+            break;
+        case 'M':
+            sscanf(optarg, "%u", &metricsPort);
+            break;
+        case 'S':
+            statsdServer = optarg;
+            break;
         default:
             usage();
             exit(0);
         }
     }
 
+    SerialDV::SamplesResampler resampler;
+
+    if (!resampler.setOutputRate(outputRate))
+    {
+        fprintf(stderr, "Unsupported output rate %u. Aborting\n", outputRate);
+        return 0;
+    }
+
+    if ((outputRate != SerialDV::SAMPLES_INPUT_RATE) && (bulk || (mode == ModeEncode)))
+    {
+        fprintf(stderr, "The output rate only applies to decoded audio out of bulk mode. Aborting\n");
+        return 0;
+    }
+
+    if (bulk && (mode != ModeLoop))
+    {
+        fprintf(stderr, "Bulk mode is for the encode/decode loop only. Aborting\n");
+        return 0;
+    }
+
+    if ((nbPacedStreams != 0) && (bulk || (mode != ModeLoop)))
+    {
+        fprintf(stderr, "Paced mode is for the encode/decode loop only. Aborting\n");
+        return 0;
+    }
+
     if (strncmp(in_file, (const char *) "-", 1) == 0)
     {
         in_file_fd = STDIN_FILENO;
@@ -153,7 +835,7 @@ int main(int argc, char **argv)
     }
     else
     {
-        out_file_fd = open(out_file, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+        out_file_fd = open(out_file, (bulk ? O_RDWR : O_WRONLY)|O_CREAT|O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
     }
 
     if (out_file_fd > -1)
@@ -167,35 +849,104 @@ int main(int argc, char **argv)
     }
 
     SerialDV::DVController dvController;
+    SerialDV::DVDevicePool dvDevicePool;
     short dvAudioSamples[SerialDV::MBE_AUDIO_BLOCK_SIZE];
+    short dvOutputSamples[SerialDV::MBE_AUDIO_BLOCK_SIZE * SerialDV::SAMPLES_RESAMPLER_MAX_FACTOR];
+    unsigned int dvOutputBytes = SerialDV::MBE_AUDIO_BLOCK_BYTES * resampler.getFactor();
     unsigned char dvMbeSamples[SerialDV::MBE_FRAME_MAX_LENGTH_BYTES];
 
-    if (!dvSerialDevice.empty())
+    if (dvSerialDevices.empty())
     {
-        if (dvController.open(dvSerialDevice))
-        {
-            fprintf(stderr, "Opened DV serial device %s\n", dvSerialDevice.c_str());
-        }
-        else
+        fprintf(stderr, "No DV serial device specified. Aborting\n");
+        return 0;
+    }
+    else if (bulk)
+    {
+        if (dvDevicePool.open(dvSerialDevices, (SerialDV::SERIAL_SPEED) serialSpeed) == 0)
         {
-            fprintf(stderr, "Failed to open DV serial device %s. Aborting\n", dvSerialDevice.c_str());
+            fprintf(stderr, "Failed to open any DV serial device. Aborting\n");
             return 0;
         }
+
+        fprintf(stderr, "Opened %u DV serial devices out of %u\n", dvDevicePool.getNbDevices(), (unsigned int) dvSerialDevices.size());
+    }
+    else if (dvController.open(dvSerialDevices[0], (SerialDV::SERIAL_SPEED) serialSpeed))
+    {
+        fprintf(stderr, "Opened DV serial device %s\n", dvSerialDevices[0].c_str());
     }
     else
     {
-        fprintf(stderr, "No DV serial device specified. Aborting\n");
+        fprintf(stderr, "Failed to open DV serial device %s. Aborting\n", dvSerialDevices[0].c_str());
         return 0;
     }
 
-    int gain = (int) (log10f(gainLin)*10.0f);
+    // the decoder gain of the chip stays at 0 dB and the gain is applied while converting the samples
+    if (bulk)
+    {
+        for (unsigned int i = 0; i < dvDevicePool.getNbDevices(); i++)
+        {
+            setHostGain(*dvDevicePool.acquireController(i), gainLin);
+            dvDevicePool.releaseController(i);
+        }
+    }
+    else
+    {
+        setHostGain(dvController, gainLin);
+    }
+
+    SerialDV::DVDecodeCache decodeCache(cacheKBytes * 1024U);
+
+    if (cacheKBytes != 0)
+    {
+        decodeCache.seedDStarSilence();
+        dvController.setDecodeCache(&decodeCache);
+    }
+
+    SerialDV::DVMetricsExporter metricsExporter;
+
+    if (bulk)
+    {
+        for (unsigned int i = 0; i < dvDevicePool.getNbDevices(); i++)
+        {
+            metricsExporter.addController(dvDevicePool.acquireController(i), dvDevicePool.getDeviceName(i));
+            dvDevicePool.releaseController(i);
+        }
+    }
+    else
+    {
+        metricsExporter.addController(&dvController, dvSerialDevices[0]);
+    }
+
+    if (metricsPort != 0)
+    {
+        if (metricsExporter.startHttp(metricsPort)) {
+            fprintf(stderr, "Serving metrics on port %u\n", metricsPort);
+        }
+    }
+
+    if (!statsdServer.empty())
+    {
+        std::string::size_type colon = statsdServer.rfind(':');
+
+        if ((colon == std::string::npos) || !metricsExporter.startStatsd(statsdServer.substr(0, colon), atoi(statsdServer.c_str() + colon + 1))) {
+            fprintf(stderr, "Cannot push metrics to statsd server %s\n", statsdServer.c_str());
+        }
+    }
 
     fprintf(stderr, "Start of process\n");
 
     struct timeval tvstart, tvend;
     gettimeofday(&tvstart, 0);
 
-    while (exitflag == 0)
+    if (bulk) {
+        runBulk(dvDevicePool, in_file_fd, out_file_fd, dvRate, 0);
+    } else if (mode != ModeLoop) {
+        runStream(dvController, mode, in_file_fd, out_file_fd, dvRate, resampler);
+    } else if (nbPacedStreams != 0) {
+        runPaced(dvController, dvSerialDevices[0], nbPacedStreams, in_file_fd, out_file_fd, dvRate, resampler);
+    }
+
+    while (!bulk && (mode == ModeLoop) && (nbPacedStreams == 0) && (exitflag == 0))
     {
         int result = read(in_file_fd, (void *) dvAudioSamples, SerialDV::MBE_AUDIO_BLOCK_BYTES);
 
@@ -216,21 +967,22 @@ int main(int argc, char **argv)
             break;
         }
 
-        if (!dvController.decode(dvAudioSamples, dvMbeSamples, dvRate, gain))
+        if (!dvController.decode(dvAudioSamples, dvMbeSamples, dvRate))
         {
             fprintf(stderr, "Decoding failure. Terminating\n");
             break;
         }
 
-        result = write(out_file_fd, (const void *) dvAudioSamples, SerialDV::MBE_AUDIO_BLOCK_BYTES);
+        resampler.process(dvAudioSamples, SerialDV::MBE_AUDIO_BLOCK_SIZE, dvOutputSamples);
+        result = write(out_file_fd, (const void *) dvOutputSamples, dvOutputBytes);
 
         if (result == -1)
         {
             fprintf(stderr, "Error writing to output\n");
         }
-        else if (result != SerialDV::MBE_AUDIO_BLOCK_BYTES)
+        else if (result != (int) dvOutputBytes)
         {
-            fprintf(stderr, "Written %d out of %d audio samples\n", result/2, SerialDV::MBE_AUDIO_BLOCK_SIZE);
+            fprintf(stderr, "Written %d out of %u audio samples\n", result/2, dvOutputBytes/2);
         }
     }
 
@@ -243,7 +995,15 @@ int main(int argc, char **argv)
     uint64_t ms = tvdiff.tv_sec*1000000 + tvdiff.tv_usec;
     fprintf(stderr, "Done in %f seconds\n", ms / 1e6);
 
+    if (cacheKBytes != 0)
+    {
+        fprintf(stderr, "Decode cache: %lu hits %lu misses %u frames\n",
+            (unsigned long) decodeCache.getStats().nbHits.get(), (unsigned long) decodeCache.getStats().nbMisses.get(), decodeCache.getNbEntries());
+    }
+
+    metricsExporter.stop();
     dvController.close();
+    dvDevicePool.close();
 
     if ((out_file_fd > -1) && (out_file_fd != STDOUT_FILENO)) {
         close(out_file_fd);
@@ -0,0 +1,507 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "mockdatacontroller.h"
+
+namespace SerialDV
+{
+
+MockDataController::MockDataController() :
+        m_open(false),
+        m_replyHead(0),
+        m_replyCount(0),
+        m_inputLength(0),
+        m_busyUntilUs(0),
+        m_linkFreeUs(0)
+{
+}
+
+MockDataController::~MockDataController()
+{
+}
+
+bool MockDataController::open(const MockDeviceConfig& config)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_config = config;
+    m_random.seed(config.seed);
+    m_replyHead = 0;
+    m_replyCount = 0;
+    m_inputLength = 0;
+    m_busyUntilUs = 0;
+    m_linkFreeUs = 0;
+
+    for (unsigned int channel = 0; channel < DV3000_MAX_CHANNELS; channel++) {
+        m_nbMbeBits[channel] = 72;
+    }
+
+    m_open = true;
+    fprintf(stderr, "MockDataController::open: %s delay: %u us jitter: %u us chunk: %u baud: %u drop: %f\n",
+            config.multiChannel ? "AMBE3003" : "AMBE3000", config.delayUs, config.jitterUs, config.chunkBytes, config.baudRate, config.dropRate);
+    return true;
+}
+
+void MockDataController::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_open = false;
+    m_replyCount = 0;
+    m_inputLength = 0;
+    m_replyReady.notify_all();
+}
+
+bool MockDataController::setSpeed(unsigned int speed)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_config.baudRate = speed;
+    return true;
+}
+
+int MockDataController::write(const unsigned char* buffer, unsigned int lengthInBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) {
+        return -1;
+    }
+
+    uint64_t now = nowUs();
+    unsigned int consumed = 0;
+
+    while (consumed < lengthInBytes)
+    {
+        unsigned int length = std::min(lengthInBytes - consumed, (unsigned int) sizeof(m_input) - m_inputLength);
+        ::memcpy(&m_input[m_inputLength], &buffer[consumed], length);
+        m_inputLength += length;
+        consumed += length;
+
+        unsigned int start = 0;
+
+        while (start < m_inputLength)
+        {
+            if (m_input[start] != DV3000_START_BYTE)
+            {
+                start++;
+                continue;
+            }
+
+            if (m_inputLength - start < DV3000_HEADER_LEN) {
+                break;
+            }
+
+            unsigned int packetLength = DV3000_HEADER_LEN + m_input[start + 1] * 256 + m_input[start + 2];
+
+            if (packetLength > BUFFER_LENGTH)
+            {
+                start++;
+                continue;
+            }
+
+            if (m_inputLength - start < packetLength) {
+                break;
+            }
+
+            // the packet has been transmitted when its last byte is through
+            processPacket(&m_input[start], packetLength, now + getTransferUs(consumed - (m_inputLength - start - packetLength)));
+            start += packetLength;
+        }
+
+        ::memmove(m_input, &m_input[start], m_inputLength - start);
+        m_inputLength -= start;
+    }
+
+    m_replyReady.notify_all();
+    return lengthInBytes;
+}
+
+int MockDataController::readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t deadline = nowUs() + timeoutUs;
+
+    while (true)
+    {
+        if (!m_open) {
+            return -1;
+        }
+
+        uint64_t now = nowUs();
+        int length = readReady(buffer, lengthInBytes, now);
+
+        if ((length > 0) || (now >= deadline)) {
+            return length;
+        }
+
+        uint64_t wakeUp = deadline;
+
+        if (m_replyCount != 0)
+        {
+            const Reply& reply = m_replies[m_replyHead];
+            uint64_t nextByteUs = reply.readyUs + getTransferUs(reply.offset);
+
+            if (nextByteUs < wakeUp) {
+                wakeUp = nextByteUs;
+            }
+        }
+
+        m_replyReady.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::microseconds(wakeUp)));
+    }
+}
+
+int MockDataController::read(unsigned char* buffer, unsigned int lengthInBytes)
+{
+    int length = readAvailable(buffer, lengthInBytes, 0);
+
+    if (length <= 0) {
+        return length;
+    }
+
+    unsigned int offset = length;
+
+    while (offset < lengthInBytes)
+    {
+        length = readAvailable(&buffer[offset], lengthInBytes - offset, 1000000);
+
+        if (length <= 0)
+        {
+            fprintf(stderr, "MockDataController::read: timeout after %u bytes\n", offset);
+            return -1;
+        }
+
+        offset += length;
+    }
+
+    return offset;
+}
+
+int MockDataController::readReady(unsigned char* buffer, unsigned int lengthInBytes, uint64_t now)
+{
+    unsigned int limit = ((m_config.chunkBytes != 0) && (m_config.chunkBytes < lengthInBytes)) ? m_config.chunkBytes : lengthInBytes;
+    unsigned int length = 0;
+
+    while ((m_replyCount != 0) && (length < limit))
+    {
+        Reply& reply = m_replies[m_replyHead];
+        unsigned int available = getAvailable(reply, now);
+        unsigned int copied = std::min(available, limit - length);
+
+        ::memcpy(&buffer[length], &reply.data[reply.offset], copied);
+        reply.offset += copied;
+        length += copied;
+
+        if (reply.offset < reply.length) {
+            break; // rest of the reply not transmitted or not wanted yet
+        }
+
+        m_replyHead = (m_replyHead + 1) % MOCK_MAX_REPLIES;
+        m_replyCount--;
+    }
+
+    return length;
+}
+
+void MockDataController::processPacket(const unsigned char *packet, unsigned int length, uint64_t arrivalUs)
+{
+    if (m_replyCount == MOCK_MAX_REPLIES)
+    {
+        fprintf(stderr, "MockDataController::processPacket: reply queue full\n");
+        return;
+    }
+
+    Reply& reply = m_replies[(m_replyHead + m_replyCount) % MOCK_MAX_REPLIES];
+    unsigned char *out = reply.data;
+    unsigned int offset = DV3000_HEADER_LEN;
+    unsigned int replyLength = DV3000_HEADER_LEN;
+    unsigned int channel = 0;
+    bool channelField = false;
+
+    if (m_config.multiChannel
+     && (offset < length)
+     && (packet[offset] >= DV3000_CONTROL_CHANNEL0)
+     && (packet[offset] < DV3000_CONTROL_CHANNEL0 + DV3000_MAX_CHANNELS))
+    {
+        channel = packet[offset] - DV3000_CONTROL_CHANNEL0;
+        channelField = true;
+        offset++;
+    }
+
+    if (offset >= length) {
+        return;
+    }
+
+    if (channelField) {
+        out[replyLength++] = DV3000_CONTROL_CHANNEL0 + channel;
+    }
+
+    if (packet[3] == DV3000_TYPE_CONTROL)
+    {
+        out[3] = DV3000_TYPE_CONTROL;
+
+        if (channelField) {
+            out[replyLength++] = 0x00U; // channel status
+        }
+
+        // one reply packet answers all the fields of the control packet
+        while (offset < length)
+        {
+            unsigned char field = packet[offset];
+
+            if (field == DV3000_CONTROL_PRODID)
+            {
+                const char *name = m_config.multiChannel ? "AMBE3003" : "AMBE3000R";
+                out[replyLength++] = DV3000_CONTROL_PRODID;
+                ::memcpy(&out[replyLength], name, strlen(name) + 1);
+                replyLength += strlen(name) + 1;
+                offset++;
+            }
+            else if (field == DV3000_CONTROL_RATEP)
+            {
+                if (offset + DV3000_REQ_RATEP_LEN - DV3000_HEADER_LEN > length) {
+                    return;
+                }
+
+                m_nbMbeBits[channel] = getNbMbeBits(&packet[offset + 1]);
+                out[replyLength++] = DV3000_CONTROL_RATEP;
+                out[replyLength++] = 0x00U;
+                offset += DV3000_REQ_RATEP_LEN - DV3000_HEADER_LEN;
+            }
+            else if (field == DV3000_CONTROL_GAIN)
+            {
+                if (offset + 3 > length) {
+                    return;
+                }
+
+                out[replyLength++] = DV3000_CONTROL_GAIN;
+                out[replyLength++] = 0x00U;
+                offset += 3;
+            }
+            else if (field == DV3000_CONTROL_RESET)
+            {
+                for (unsigned int i = 0; i < DV3000_MAX_CHANNELS; i++) {
+                    m_nbMbeBits[i] = 72;
+                }
+
+                replyLength = DV3000_HEADER_LEN; // the chip answers READY without channel
+                out[replyLength++] = DV3000_CONTROL_READY;
+                break;
+            }
+            else // other fields are acknowledged and end the parsing
+            {
+                out[replyLength++] = field;
+                out[replyLength++] = 0x00U;
+                break;
+            }
+        }
+    }
+    else if (packet[3] == DV3000_TYPE_AUDIO) // encode
+    {
+        if ((packet[offset] != DV3000_FIELD_SPEECHD) || (offset + 2 + MBE_AUDIO_BLOCK_BYTES > length)) {
+            return;
+        }
+
+        const unsigned char *samples = &packet[offset + 2];
+        unsigned int nbBytes = (m_nbMbeBits[channel] + 7) / 8;
+        unsigned int sum = 0;
+
+        for (unsigned int i = 0; i < MBE_AUDIO_BLOCK_BYTES; i++) {
+            sum += samples[i];
+        }
+
+        out[3] = DV3000_TYPE_AMBE;
+        out[replyLength++] = DV3000_FIELD_CHAND;
+        out[replyLength++] = m_nbMbeBits[channel];
+
+        for (unsigned int i = 0; i < nbBytes; i++) {
+            out[replyLength++] = (sum + i) & 0xFFU;
+        }
+    }
+    else if (packet[3] == DV3000_TYPE_AMBE) // decode
+    {
+        if ((packet[offset] != DV3000_FIELD_CHAND) || (offset + 2 > length)) {
+            return;
+        }
+
+        const unsigned char *ambe = &packet[offset + 2];
+        unsigned int nbBytes = (packet[offset + 1] + 7) / 8;
+
+        if ((nbBytes == 0) || (offset + 2 + nbBytes > length)) {
+            return;
+        }
+
+        out[3] = DV3000_TYPE_AUDIO;
+        out[replyLength++] = DV3000_FIELD_SPEECHD;
+        out[replyLength++] = MBE_AUDIO_BLOCK_SIZE;
+
+        for (unsigned int i = 0; i < MBE_AUDIO_BLOCK_SIZE; i++) // big endian samples repeating the AMBE bytes
+        {
+            out[replyLength++] = 0x00U;
+            out[replyLength++] = ambe[i % nbBytes];
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    pushReply(replyLength, arrivalUs);
+}
+
+void MockDataController::pushReply(unsigned int length, uint64_t arrivalUs)
+{
+    Reply& reply = m_replies[(m_replyHead + m_replyCount) % MOCK_MAX_REPLIES];
+    reply.data[0] = DV3000_START_BYTE;
+    reply.data[1] = ((length - DV3000_HEADER_LEN) >> 8) & 0xFFU;
+    reply.data[2] = (length - DV3000_HEADER_LEN) & 0xFFU;
+    reply.length = length;
+    reply.offset = 0;
+
+    // packets are processed one after the other then replies are transmitted one after the other
+    uint64_t processingUs = m_config.delayUs;
+
+    if (m_config.jitterUs != 0) {
+        processingUs += m_random() % (m_config.jitterUs + 1);
+    }
+
+    m_busyUntilUs = std::max(arrivalUs, m_busyUntilUs) + processingUs;
+
+    if ((m_config.dropRate > 0.0) && ((double) m_random() / m_random.max() < m_config.dropRate)) {
+        return;
+    }
+
+    reply.readyUs = std::max(m_busyUntilUs, m_linkFreeUs);
+    m_linkFreeUs = reply.readyUs + getTransferUs(length);
+    m_replyCount++;
+}
+
+unsigned int MockDataController::getAvailable(const Reply& reply, uint64_t now) const
+{
+    if (now < reply.readyUs) {
+        return 0;
+    }
+
+    unsigned int transmitted = reply.length;
+
+    if (m_config.baudRate != 0)
+    {
+        uint64_t nbBytes = 1 + ((now - reply.readyUs) * m_config.baudRate) / 10000000ULL; // 10 bits per byte
+
+        if (nbBytes < transmitted) {
+            transmitted = nbBytes;
+        }
+    }
+
+    return transmitted > reply.offset ? transmitted - reply.offset : 0;
+}
+
+unsigned int MockDataController::getTransferUs(unsigned int nbBytes) const
+{
+    if (m_config.baudRate == 0) {
+        return 0;
+    }
+
+    return (nbBytes * 10000000ULL) / m_config.baudRate;
+}
+
+unsigned char MockDataController::getNbMbeBits(const unsigned char *ratep)
+{
+    static const struct {
+        const unsigned char *ratep;
+        unsigned char nbBits;
+    } rates[] = {
+        {DV3000_REQ_3600X2400_RATEP, 72},
+        {DV3000_REQ_3600X2450_RATEP, 72},
+        {DV3000_REQ_7200X4400_1_RATEP, 144},
+        {DV3000_REQ_7200X4400_2_RATEP, 144},
+        {DV3000_REQ_7200X4400_3_RATEP, 144},
+        {DV3000_REQ_2450_RATEP, 49},
+        {DV3000_REQ_4400_RATEP, 88}
+    };
+
+    for (unsigned int i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        if (::memcmp(ratep, &rates[i].ratep[DV3000_HEADER_LEN + 1], DV3000_REQ_RATEP_LEN - DV3000_HEADER_LEN - 1) == 0) {
+            return rates[i].nbBits;
+        }
+    }
+
+    return 72;
+}
+
+bool MockDataController::parseDeviceName(const std::string& device, MockDeviceConfig& config)
+{
+    if (device.compare(0, 7, "mock://") != 0) {
+        return false;
+    }
+
+    config = MockDeviceConfig();
+    std::string::size_type query = device.find('?', 7);
+    std::string model = device.substr(7, query == std::string::npos ? std::string::npos : query - 7);
+
+    if (model == "dv3003") {
+        config.multiChannel = true;
+    } else if (!model.empty() && (model != "dv3000")) {
+        fprintf(stderr, "MockDataController::parseDeviceName: unknown model %s\n", model.c_str());
+    }
+
+    while (query != std::string::npos)
+    {
+        std::string::size_type next = device.find('&', query + 1);
+        std::string option = device.substr(query + 1, next == std::string::npos ? std::string::npos : next - query - 1);
+        std::string::size_type equal = option.find('=');
+        query = next;
+
+        if (equal == std::string::npos)
+        {
+            fprintf(stderr, "MockDataController::parseDeviceName: ignoring option %s\n", option.c_str());
+            continue;
+        }
+
+        std::string key = option.substr(0, equal);
+        const char *value = option.c_str() + equal + 1;
+
+        if (key == "delay") {
+            config.delayUs = strtoul(value, 0, 10);
+        } else if (key == "jitter") {
+            config.jitterUs = strtoul(value, 0, 10);
+        } else if (key == "chunk") {
+            config.chunkBytes = strtoul(value, 0, 10);
+        } else if (key == "baud") {
+            config.baudRate = strtoul(value, 0, 10);
+        } else if (key == "drop") {
+            config.dropRate = strtod(value, 0);
+        } else if (key == "seed") {
+            config.seed = strtoul(value, 0, 10);
+        } else {
+            fprintf(stderr, "MockDataController::parseDeviceName: ignoring option %s\n", option.c_str());
+        }
+    }
+
+    return true;
+}
+
+uint64_t MockDataController::nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace SerialDV
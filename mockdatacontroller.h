@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MOCKDATACONTROLLER_H_
+#define MOCKDATACONTROLLER_H_
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <stdint.h>
+
+#include "datacontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int MOCK_MAX_REPLIES = 128U; //!< Replies the mock device can hold before dropping them
+
+/** Behaviour of the mock device */
+struct MockDeviceConfig
+{
+    bool multiChannel;       //!< Identifies as an AMBE3003 with 3 channels instead of an AMBE3000
+    unsigned int delayUs;    //!< Processing time of a packet
+    unsigned int jitterUs;   //!< Random extra processing time from 0 to this value
+    unsigned int chunkBytes; //!< Maximum number of bytes returned by a read (0 for no limit)
+    unsigned int baudRate;   //!< Simulated link speed in bauds (0 for an infinitely fast link)
+    double dropRate;         //!< Probability that a reply is never sent
+    unsigned int seed;       //!< Seed of the random generator for reproducible runs
+
+    MockDeviceConfig() :
+        multiChannel(false),
+        delayUs(0),
+        jitterUs(0),
+        chunkBytes(0),
+        baudRate(0),
+        dropRate(0.0),
+        seed(1)
+    {}
+};
+
+/** Software model of an AMBE3000 or AMBE3003 chip speaking the packet protocol in process.
+ * It answers PRODID, RATEP, GAIN, reset (READY), audio and AMBE packets one after the other
+ * (several control fields in one packet get one reply)
+ * after the configured processing time. The encoder output is derived from the audio samples
+ * and the decoder output repeats the AMBE frame bytes so that data paths can be checked.
+ *
+ * It is opened by DVController for device names of the form:
+ * mock://[dv3000|dv3003][?delay=us&jitter=us&chunk=bytes&baud=bauds&drop=probability&seed=n]
+ */
+class MockDataController : public DataController {
+public:
+    MockDataController();
+    virtual ~MockDataController();
+
+    bool open(const MockDeviceConfig& config);
+
+    virtual int  read(unsigned char* buffer, unsigned int lengthInBytes);
+    virtual int  readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs);
+    virtual int  write(const unsigned char* buffer, unsigned int lengthInBytes);
+    virtual bool setSpeed(unsigned int speed);
+    virtual unsigned int getSpeed() const { return m_config.baudRate; }
+
+    virtual void close();
+
+    /** Parses a mock:// device name. Returns false if the name is not a mock device name */
+    static bool parseDeviceName(const std::string& device, MockDeviceConfig& config);
+
+private:
+    struct Reply
+    {
+        uint64_t readyUs;    //!< Time the first byte is available
+        unsigned int length;
+        unsigned int offset; //!< Bytes already read
+        unsigned char data[DV3000_HEADER_LEN + 3 + MBE_AUDIO_BLOCK_BYTES];
+    };
+
+    MockDeviceConfig m_config;
+    bool m_open;
+    std::mutex m_mutex;
+    std::condition_variable m_replyReady;
+    std::mt19937 m_random;
+    Reply m_replies[MOCK_MAX_REPLIES]; //!< FIFO of replies
+    unsigned int m_replyHead;
+    unsigned int m_replyCount;
+    unsigned char m_input[BUFFER_LENGTH * 2]; //!< Bytes written not forming a complete packet yet
+    unsigned int m_inputLength;
+    uint64_t m_busyUntilUs;                    //!< End of processing of the last packet
+    uint64_t m_linkFreeUs;                     //!< End of transmission of the last reply
+    unsigned char m_nbMbeBits[DV3000_MAX_CHANNELS];
+
+    /** Builds the reply to one complete packet */
+    void processPacket(const unsigned char *packet, unsigned int length, uint64_t arrivalUs);
+
+    /** Queues the reply built in the next free slot after the processing time of the chip */
+    void pushReply(unsigned int length, uint64_t arrivalUs);
+
+    /** Number of bytes of the reply transmitted at this time */
+    unsigned int getAvailable(const Reply& reply, uint64_t now) const;
+    unsigned int getTransferUs(unsigned int nbBytes) const;
+    int readReady(unsigned char* buffer, unsigned int lengthInBytes, uint64_t now);
+
+    static unsigned char getNbMbeBits(const unsigned char *ratep);
+    static uint64_t nowUs();
+};
+
+} // namespace SerialDV
+
+#endif /* MOCKDATACONTROLLER_H_ */
@@ -0,0 +1,264 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SERIALDV_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SERIALDV_NEON
+#endif
+
+#include "samplesconverter.h"
+
+namespace SerialDV
+{
+
+static void swapScalar(void *dst, const void *src, unsigned int nbSamples)
+{
+    const uint8_t *p = (const uint8_t *) src;
+    uint8_t *q = (uint8_t *) dst;
+
+    for (unsigned int i = 0; i < nbSamples; i++, p += 2U, q += 2U)
+    {
+        uint8_t b0 = p[0U];
+        q[0U] = p[1U];
+        q[1U] = b0;
+    }
+}
+
+static void copySamples(void *dst, const void *src, unsigned int nbSamples)
+{
+    if (dst != src) {
+        ::memmove(dst, src, nbSamples * 2U);
+    }
+}
+
+static inline short scaleSample(int sample, float gain)
+{
+    int scaled = (int) (sample * gain);
+    return scaled > 32767 ? 32767 : scaled < -32768 ? -32768 : scaled;
+}
+
+static void swapGainScalar(short *dst, const void *src, unsigned int nbSamples, float gain)
+{
+    const uint8_t *p = (const uint8_t *) src;
+
+    for (unsigned int i = 0; i < nbSamples; i++, p += 2U) {
+        dst[i] = scaleSample((int16_t) ((p[0U] << 8) | p[1U]), gain);
+    }
+}
+
+static void copyGainScalar(short *dst, const void *src, unsigned int nbSamples, float gain)
+{
+    const short *p = (const short *) src;
+
+    for (unsigned int i = 0; i < nbSamples; i++) {
+        dst[i] = scaleSample(p[i], gain);
+    }
+}
+
+#if defined(SERIALDV_X86)
+
+__attribute__((target("ssse3")))
+static void swapSSSE3(void *dst, const void *src, unsigned int nbSamples)
+{
+    const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    const uint8_t *p = (const uint8_t *) src;
+    uint8_t *q = (uint8_t *) dst;
+    unsigned int i = 0;
+
+    for (; i + 8U <= nbSamples; i += 8U, p += 16U, q += 16U)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        _mm_storeu_si128((__m128i *) q, _mm_shuffle_epi8(v, mask));
+    }
+
+    swapScalar(q, p, nbSamples - i);
+}
+
+__attribute__((target("avx2")))
+static void swapAVX2(void *dst, const void *src, unsigned int nbSamples)
+{
+    const __m256i mask = _mm256_set_epi8(
+            14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+            14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    const uint8_t *p = (const uint8_t *) src;
+    uint8_t *q = (uint8_t *) dst;
+    unsigned int i = 0;
+
+    for (; i + 16U <= nbSamples; i += 16U, p += 32U, q += 32U)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        _mm256_storeu_si256((__m256i *) q, _mm256_shuffle_epi8(v, mask));
+    }
+
+    swapSSSE3(q, p, nbSamples - i);
+}
+
+// samples are widened in place of the unpacked halves so that packing back keeps their order
+__attribute__((target("ssse3")))
+static void swapGainSSSE3(short *dst, const void *src, unsigned int nbSamples, float gain)
+{
+    const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    const __m128 g = _mm_set1_ps(gain);
+    const uint8_t *p = (const uint8_t *) src;
+    unsigned int i = 0;
+
+    for (; i + 8U <= nbSamples; i += 8U, p += 16U)
+    {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p), mask);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+        hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+        _mm_storeu_si128((__m128i *) &dst[i], _mm_packs_epi32(lo, hi));
+    }
+
+    swapGainScalar(&dst[i], p, nbSamples - i, gain);
+}
+
+__attribute__((target("avx2")))
+static void swapGainAVX2(short *dst, const void *src, unsigned int nbSamples, float gain)
+{
+    const __m256i mask = _mm256_set_epi8(
+            14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+            14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    const __m256 g = _mm256_set1_ps(gain);
+    const uint8_t *p = (const uint8_t *) src;
+    unsigned int i = 0;
+
+    for (; i + 16U <= nbSamples; i += 16U, p += 32U)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) p), mask);
+        __m256i lo = _mm256_srai_epi32(_mm256_unpacklo_epi16(v, v), 16);
+        __m256i hi = _mm256_srai_epi32(_mm256_unpackhi_epi16(v, v), 16);
+        lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), g));
+        hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), g));
+        _mm256_storeu_si256((__m256i *) &dst[i], _mm256_packs_epi32(lo, hi));
+    }
+
+    swapGainSSSE3(&dst[i], p, nbSamples - i, gain);
+}
+
+#elif defined(SERIALDV_NEON)
+
+static void swapNEON(void *dst, const void *src, unsigned int nbSamples)
+{
+    const uint8_t *p = (const uint8_t *) src;
+    uint8_t *q = (uint8_t *) dst;
+    unsigned int i = 0;
+
+    for (; i + 8U <= nbSamples; i += 8U, p += 16U, q += 16U) {
+        vst1q_u8(q, vrev16q_u8(vld1q_u8(p)));
+    }
+
+    swapScalar(q, p, nbSamples - i);
+}
+
+static void swapGainNEON(short *dst, const void *src, unsigned int nbSamples, float gain)
+{
+    const uint8_t *p = (const uint8_t *) src;
+    unsigned int i = 0;
+
+    for (; i + 8U <= nbSamples; i += 8U, p += 16U)
+    {
+        int16x8_t v = vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8(p)));
+        int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), gain));
+        int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), gain));
+        vst1q_s16(&dst[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+
+    swapGainScalar(&dst[i], p, nbSamples - i, gain);
+}
+
+#endif
+
+void SamplesConverter::toFloat(float *dst, const short *src, unsigned int nbSamples, float gain)
+{
+    const float scale = gain / 32768.0f;
+
+    for (unsigned int i = 0; i < nbSamples; i++) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+SamplesConverter::SwapFunction SamplesConverter::select(const char *& implementation)
+{
+    short number = 0x1;
+
+    if (((char *) &number)[0] != 1) // big endian host: samples are already in packet order
+    {
+        implementation = "copy";
+        return copySamples;
+    }
+
+#if defined(SERIALDV_X86)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        implementation = "avx2";
+        return swapAVX2;
+    }
+
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        implementation = "ssse3";
+        return swapSSSE3;
+    }
+#elif defined(SERIALDV_NEON)
+    implementation = "neon";
+    return swapNEON;
+#endif
+
+    implementation = "scalar";
+    return swapScalar;
+}
+
+SamplesConverter::SwapGainFunction SamplesConverter::selectGain()
+{
+    short number = 0x1;
+
+    if (((char *) &number)[0] != 1) {
+        return copyGainScalar;
+    }
+
+#if defined(SERIALDV_X86)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return swapGainAVX2;
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        return swapGainSSSE3;
+    }
+#elif defined(SERIALDV_NEON)
+    return swapGainNEON;
+#endif
+
+    return swapGainScalar;
+}
+
+const char *SamplesConverter::m_implementation = "scalar";
+SamplesConverter::SwapFunction SamplesConverter::m_swap = SamplesConverter::select(SamplesConverter::m_implementation);
+SamplesConverter::SwapGainFunction SamplesConverter::m_swapGain = SamplesConverter::selectGain();
+
+} // namespace SerialDV
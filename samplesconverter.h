@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SAMPLESCONVERTER_H_
+#define SAMPLESCONVERTER_H_
+
+namespace SerialDV
+{
+
+const float SAMPLES_GAIN_MAX = 256.0f; //!< Largest host gain (+48 dB) so that scaled samples fit in 32 bits
+
+/** Conversion of 16 bit audio samples between host byte order and the big endian byte order of
+ * the AMBE3000 packets. On little endian hosts this is a byte swap done with SSSE3, AVX2 or NEON
+ * when the processor supports it (detected at run time) or with a scalar loop otherwise.
+ * A gain can be applied in the same pass when converting from the packets.
+ * Source and destination may be the same buffer for an in place conversion.
+ */
+class SamplesConverter
+{
+public:
+    /** Host order samples to big endian bytes */
+    static void toBigEndian(unsigned char *dst, const short *src, unsigned int nbSamples)
+    {
+        m_swap(dst, src, nbSamples);
+    }
+
+    /** Big endian bytes to host order samples */
+    static void fromBigEndian(short *dst, const unsigned char *src, unsigned int nbSamples)
+    {
+        m_swap(dst, src, nbSamples);
+    }
+
+    /** Big endian bytes to host order samples scaled by a linear gain in the same pass. The gain
+     * is clamped to [0, SAMPLES_GAIN_MAX], scaled samples are truncated towards zero and saturated.
+     */
+    static void fromBigEndian(short *dst, const unsigned char *src, unsigned int nbSamples, float gain)
+    {
+        m_swapGain(dst, src, nbSamples, gain < 0.0f ? 0.0f : gain > SAMPLES_GAIN_MAX ? SAMPLES_GAIN_MAX : gain);
+    }
+
+    /** Host order samples to floating point samples in [-1.0, 1.0) scaled by a linear gain */
+    static void toFloat(float *dst, const short *src, unsigned int nbSamples, float gain = 1.0f);
+
+    /** Name of the implementation selected for this processor e.g. "avx2" */
+    static const char *getImplementation() { return m_implementation; }
+
+private:
+    typedef void (*SwapFunction)(void *dst, const void *src, unsigned int nbSamples);
+    typedef void (*SwapGainFunction)(short *dst, const void *src, unsigned int nbSamples, float gain);
+
+    static SwapFunction m_swap;
+    static SwapGainFunction m_swapGain;
+    static const char *m_implementation;
+
+    static SwapFunction select(const char *& implementation);
+    static SwapGainFunction selectGain();
+};
+
+} // namespace SerialDV
+
+#endif /* SAMPLESCONVERTER_H_ */
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+
+#include "samplesresampler.h"
+
+namespace SerialDV
+{
+
+SamplesResampler::SamplesResampler(unsigned int outputRate) :
+        m_factor(1)
+{
+    if (!setOutputRate(outputRate)) {
+        setOutputRate(SAMPLES_INPUT_RATE);
+    }
+}
+
+bool SamplesResampler::setOutputRate(unsigned int outputRate)
+{
+    if ((outputRate != SAMPLES_INPUT_RATE) && (outputRate != 2U * SAMPLES_INPUT_RATE) && (outputRate != 6U * SAMPLES_INPUT_RATE)) {
+        return false;
+    }
+
+    m_factor = outputRate / SAMPLES_INPUT_RATE;
+
+    // prototype low pass at the output rate cut a little under the 4 kHz input Nyquist frequency
+    unsigned int length = m_factor * SAMPLES_RESAMPLER_TAPS;
+    double cutoff = 0.45 / m_factor;
+    double center = (length - 1) / 2.0;
+
+    for (unsigned int phase = 0; phase < m_factor; phase++)
+    {
+        double sum = 0.0;
+
+        for (unsigned int tap = 0; tap < SAMPLES_RESAMPLER_TAPS; tap++)
+        {
+            unsigned int n = phase + tap * m_factor;
+            double x = n - center;
+            double sinc = x == 0.0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+            double window = 0.42 - 0.5 * cos(2.0 * M_PI * n / (length - 1)) + 0.08 * cos(4.0 * M_PI * n / (length - 1));
+            m_coefficients[phase][SAMPLES_RESAMPLER_TAPS - 1 - tap] = sinc * window;
+            sum += sinc * window;
+        }
+
+        // unity gain at DC on every phase
+        for (unsigned int tap = 0; tap < SAMPLES_RESAMPLER_TAPS; tap++) {
+            m_coefficients[phase][tap] /= sum;
+        }
+    }
+
+    reset();
+    return true;
+}
+
+void SamplesResampler::reset()
+{
+    for (unsigned int i = 0; i < SAMPLES_RESAMPLER_TAPS - 1; i++) {
+        m_history[i] = 0.0f;
+    }
+}
+
+void SamplesResampler::process(const short *in, unsigned int nbSamples, float *out, float gain)
+{
+    while (nbSamples != 0)
+    {
+        unsigned int count = nbSamples < MBE_AUDIO_BLOCK_SIZE ? nbSamples : MBE_AUDIO_BLOCK_SIZE;
+        processBlock(in, count, out, gain / 32768.0f); // full scale to [-1.0, 1.0)
+        in += count;
+        out += count * m_factor;
+        nbSamples -= count;
+    }
+}
+
+void SamplesResampler::process(const short *in, unsigned int nbSamples, short *out, float gain)
+{
+    float block[MBE_AUDIO_BLOCK_SIZE * SAMPLES_RESAMPLER_MAX_FACTOR];
+
+    while (nbSamples != 0)
+    {
+        unsigned int count = nbSamples < MBE_AUDIO_BLOCK_SIZE ? nbSamples : MBE_AUDIO_BLOCK_SIZE;
+        processBlock(in, count, block, gain);
+
+        for (unsigned int i = 0; i < count * m_factor; i++) {
+            out[i] = block[i] > 32767.0f ? 32767 : block[i] < -32768.0f ? -32768 : (short) lrintf(block[i]);
+        }
+
+        in += count;
+        out += count * m_factor;
+        nbSamples -= count;
+    }
+}
+
+void SamplesResampler::processBlock(const short *in, unsigned int nbSamples, float *out, float scale)
+{
+    float *samples = &m_history[SAMPLES_RESAMPLER_TAPS - 1];
+
+    // the history holds the unscaled input so that a gain change or the other output type does not
+    // leave the previous scale in the filter
+    for (unsigned int i = 0; i < nbSamples; i++) {
+        samples[i] = in[i];
+    }
+
+    if (m_factor == 1)
+    {
+        for (unsigned int i = 0; i < nbSamples; i++) {
+            out[i] = samples[i] * scale;
+        }
+    }
+    else
+    {
+        for (unsigned int i = 0; i < nbSamples; i++)
+        {
+            const float *window = &m_history[i]; // the taps end at the current sample
+
+            for (unsigned int phase = 0; phase < m_factor; phase++)
+            {
+                const float *coefficients = m_coefficients[phase];
+                float acc = 0.0f;
+
+                for (unsigned int tap = 0; tap < SAMPLES_RESAMPLER_TAPS; tap++) {
+                    acc += coefficients[tap] * window[tap];
+                }
+
+                out[i * m_factor + phase] = acc * scale;
+            }
+        }
+    }
+
+    // keep the last inputs as the history of the next block
+    ::memmove(m_history, &m_history[nbSamples], (SAMPLES_RESAMPLER_TAPS - 1) * sizeof(float));
+}
+
+} // namespace SerialDV
@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SAMPLESRESAMPLER_H_
+#define SAMPLESRESAMPLER_H_
+
+#include "dvcontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int SAMPLES_INPUT_RATE = 8000U;        //!< Sample rate of the vocoder audio
+const unsigned int SAMPLES_RESAMPLER_MAX_FACTOR = 6U; //!< Up to 48 kS/s
+const unsigned int SAMPLES_RESAMPLER_TAPS = 16U;      //!< Filter taps per output phase
+
+/** Interpolates the 8 kS/s vocoder audio of one stream to 16 or 48 kS/s with a polyphase
+ * windowed sinc low pass filter. The filter history is kept from one call to the next so that
+ * frames of a stream are resampled back to back without discontinuities. There is one resampler
+ * per stream. The output is delayed by SAMPLES_RESAMPLER_TAPS / 2 input samples.
+ */
+class SamplesResampler
+{
+public:
+    /** Output rate is 8000 (no resampling), 16000 or 48000 */
+    SamplesResampler(unsigned int outputRate = 48000U);
+
+    /** Changes the output rate and resets the history. Returns false if the rate is not supported */
+    bool setOutputRate(unsigned int outputRate);
+    unsigned int getOutputRate() const { return m_factor * SAMPLES_INPUT_RATE; }
+
+    /** Output samples per input sample */
+    unsigned int getFactor() const { return m_factor; }
+
+    /** Clears the history e.g. at the start of a new stream */
+    void reset();
+
+    /** Resamples nbSamples input samples to nbSamples * getFactor() output samples scaled by a
+     * linear gain. Floating point samples are in [-1.0, 1.0) and 16 bit samples are saturated.
+     */
+    void process(const short *in, unsigned int nbSamples, float *out, float gain = 1.0f);
+    void process(const short *in, unsigned int nbSamples, short *out, float gain = 1.0f);
+
+private:
+    unsigned int m_factor;
+    float m_coefficients[SAMPLES_RESAMPLER_MAX_FACTOR][SAMPLES_RESAMPLER_TAPS]; //!< Per phase, reversed to run forward over the history
+    float m_history[SAMPLES_RESAMPLER_TAPS - 1 + MBE_AUDIO_BLOCK_SIZE];        //!< Last inputs followed by the block being processed
+
+    /** Interpolates up to MBE_AUDIO_BLOCK_SIZE full scale samples and multiplies the output by scale */
+    void processBlock(const short *in, unsigned int nbSamples, float *out, float scale);
+};
+
+} // namespace SerialDV
+
+#endif /* SAMPLESRESAMPLER_H_ */
@@ -25,6 +25,8 @@
 #include <winioctl.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 
 #else
 
@@ -33,10 +35,35 @@
 #include <linux/serial.h>
 #include <cerrno>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <termios.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/uio.h>
 #include <cassert>
 
+// struct termios2 of the kernel headers cannot be included along with termios.h.
+// This is the layout of the architectures using the generic definitions.
+#if defined(TCGETS2) && (defined(__x86_64__) || defined(__i386__) || defined(__arm__) || defined(__aarch64__))
+#define SERIALDV_TERMIOS2
+
+struct termios2 {
+    unsigned int  c_iflag;
+    unsigned int  c_oflag;
+    unsigned int  c_cflag;
+    unsigned int  c_lflag;
+    unsigned char c_line;
+    unsigned char c_cc[19];
+    unsigned int  c_ispeed;
+    unsigned int  c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
 #endif
 
 namespace SerialDV
@@ -45,19 +72,22 @@ namespace SerialDV
 #if defined(__WINDOWS__)
 
 SerialDataController::SerialDataController() :
+m_speed(SERIAL_NONE),
 m_handle(INVALID_HANDLE_VALUE),
+m_completionPort(NULL),
 m_readOverlapped(),
 m_writeOverlapped(),
-m_readBuffer(NULL),
-m_readLength(0U),
+m_ring(NULL),
+m_ringHead(0U),
+m_ringTail(0U),
 m_readPending(false)
 {
-    m_readBuffer = new unsigned char[BUFFER_LENGTH];
+    m_ring = new unsigned char[SERIAL_RING_LENGTH];
 }
 
 SerialDataController::~SerialDataController()
 {
-    delete[] m_readBuffer;
+    delete[] m_ring;
 }
 
 bool SerialDataController::open(const std::string& device, SERIAL_SPEED speed)
@@ -115,9 +145,11 @@ bool SerialDataController::open(const std::string& device, SERIAL_SPEED speed)
         return false;
     }
 
+    // A read completes at once with the bytes already received or with the first bytes to come
+    // or empty after SERIAL_READ_WAIT_MS. This way one read can stay posted on the whole ring.
     timeouts.ReadIntervalTimeout = MAXDWORD;
-    timeouts.ReadTotalTimeoutMultiplier = 0UL;
-    timeouts.ReadTotalTimeoutConstant = 0UL;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = SERIAL_READ_WAIT_MS;
 
     if (!::SetCommTimeouts(m_handle, &timeouts))
     {
@@ -145,102 +177,177 @@ bool SerialDataController::open(const std::string& device, SERIAL_SPEED speed)
 
     ::ClearCommError(m_handle, &errCode, NULL);
 
+    m_completionPort = ::CreateIoCompletionPort(m_handle, NULL, 0, 1);
+    if (m_completionPort == NULL)
+    {
+        fprintf(stderr, "Cannot create the completion port for %s, err=%04lx\n", m_device.c_str(), ::GetLastError());
+        ::CloseHandle(m_handle);
+        return false;
+    }
+
     ::memset(&m_readOverlapped, 0x00U, sizeof(OVERLAPPED));
     ::memset(&m_writeOverlapped, 0x00U, sizeof(OVERLAPPED));
 
-    m_readOverlapped.hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
-    m_writeOverlapped.hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+    // The low order bit set on the event keeps the write completions out of the port. Writes wait on the event.
+    m_writeOverlapped.hEvent = (HANDLE) ((ULONG_PTR) ::CreateEvent(NULL, TRUE, FALSE, NULL) | 1U);
 
-    m_readLength = 0U;
+    m_ringHead = 0U;
+    m_ringTail = 0U;
     m_readPending = false;
-    ::memset(m_readBuffer, 0x00U, BUFFER_LENGTH);
+
+    if (!postRead())
+    {
+        close();
+        return false;
+    }
 
     return true;
 }
 
-int SerialDataController::read(unsigned char* buffer, unsigned int length)
+bool SerialDataController::postRead()
 {
-    assert(m_handle != INVALID_HANDLE_VALUE);
-    assert(buffer != NULL);
+    unsigned int offset = m_ringHead % SERIAL_RING_LENGTH;
+    unsigned int length = std::min(SERIAL_RING_LENGTH - (m_ringHead - m_ringTail), SERIAL_RING_LENGTH - offset);
 
-    unsigned int ptr = 0U;
+    if (m_readPending || (length == 0U)) {
+        return true; // already posted or no room until the caller takes some bytes
+    }
 
-    while (ptr < length)
+    ::memset(&m_readOverlapped, 0x00U, sizeof(OVERLAPPED));
+
+    // a read done at once is also completed through the port
+    if (!::ReadFile(m_handle, m_ring + offset, length, NULL, &m_readOverlapped))
     {
-        int ret = readNonblock(buffer + ptr, length - ptr);
-        if (ret < 0)
-        {
-            return ret;
-        }
-        else if (ret == 0)
-        {
-            if (ptr == 0U)
-            return 0;
-        }
-        else
+        DWORD error = ::GetLastError();
+
+        if (error != ERROR_IO_PENDING)
         {
-            ptr += ret;
+            fprintf(stderr, "SerialDataController::postRead: Error from ReadFile: %04lx\n", error);
+            return false;
         }
     }
 
-    return int(length);
+    m_readPending = true;
+    return true;
 }
 
-int SerialDataController::readNonblock(unsigned char* buffer, unsigned int length)
+int SerialDataController::waitRead(DWORD timeoutMs)
 {
-    assert(m_handle != INVALID_HANDLE_VALUE);
-    assert(buffer != NULL);
+    if (!postRead()) {
+        return -1;
+    }
 
-    if (length > BUFFER_LENGTH)
-    length = BUFFER_LENGTH;
+    if (!m_readPending) {
+        return 0; // ring full
+    }
+
+    DWORD bytes = 0UL;
+    ULONG_PTR key = 0;
+    LPOVERLAPPED overlapped = NULL;
+    BOOL res = ::GetQueuedCompletionStatus(m_completionPort, &bytes, &key, &overlapped, timeoutMs);
 
-    if (m_readPending && length != m_readLength)
+    if (overlapped == NULL)
     {
-        ::CancelIo(m_handle);
-        m_readPending = false;
+        DWORD error = ::GetLastError();
+
+        if (error == WAIT_TIMEOUT) {
+            return 0;
+        }
+
+        fprintf(stderr, "SerialDataController::waitRead: Error from GetQueuedCompletionStatus: %04lx\n", error);
+        return -1;
     }
 
-    m_readLength = length;
+    m_readPending = false;
+
+    if (!res)
+    {
+        fprintf(stderr, "SerialDataController::waitRead: Error from ReadFile: %04lx\n", ::GetLastError());
+        return -1;
+    }
+
+    m_ringHead += bytes;
+
+    // post the next read before the bytes are parsed
+    if (!postRead()) {
+        return -1;
+    }
+
+    return int(bytes);
+}
+
+unsigned int SerialDataController::takeRing(unsigned char* buffer, unsigned int length)
+{
+    unsigned int count = std::min(length, m_ringHead - m_ringTail);
+    unsigned int offset = m_ringTail % SERIAL_RING_LENGTH;
+    unsigned int first = std::min(count, SERIAL_RING_LENGTH - offset);
+
+    ::memcpy(buffer, m_ring + offset, first);
+    ::memcpy(buffer + first, m_ring, count - first);
+    m_ringTail += count;
+
+    postRead(); // a full ring has room again. An error shows at the next wait.
+    return count;
+}
+
+int SerialDataController::read(unsigned char* buffer, unsigned int length)
+{
+    assert(m_handle != INVALID_HANDLE_VALUE);
+    assert(buffer != NULL);
 
     if (length == 0U)
     return 0;
 
-    if (!m_readPending)
+    if (m_ringHead == m_ringTail)
     {
-        DWORD bytes = 0UL;
-        BOOL res = ::ReadFile(m_handle, m_readBuffer, m_readLength, &bytes, &m_readOverlapped);
-        if (res)
-        {
-            ::memcpy(buffer, m_readBuffer, bytes);
-            return int(bytes);
+        int ret = waitRead(0UL);
+
+        if (ret <= 0) {
+            return ret;
         }
+    }
 
-        DWORD error = ::GetLastError();
-        if (error != ERROR_IO_PENDING)
-        {
-            fprintf(stderr, "Error from ReadFile: %04lx\n", error);
+    unsigned int ptr = takeRing(buffer, length);
+
+    while (ptr < length)
+    {
+        if (waitRead(INFINITE) < 0) {
             return -1;
         }
 
-        m_readPending = true;
+        ptr += takeRing(buffer + ptr, length - ptr);
     }
 
-    BOOL res = HasOverlappedIoCompleted(&m_readOverlapped);
-    if (!res)
+    return int(length);
+}
+
+int SerialDataController::readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs)
+{
+    assert(m_handle != INVALID_HANDLE_VALUE);
+    assert(buffer != NULL);
+
+    if (lengthInBytes == 0U)
     return 0;
 
-    DWORD bytes = 0UL;
-    res = ::GetOverlappedResult(m_handle, &m_readOverlapped, &bytes, TRUE);
-    if (!res)
+    DWORD timeoutMs = (timeoutUs + 999U) / 1000U;
+    DWORD start = ::GetTickCount();
+
+    // an empty completion of the posted read is not the end of the wait
+    while (m_ringHead == m_ringTail)
     {
-        fprintf(stderr, "Error from GetOverlappedResult (ReadFile): %04lx\n", ::GetLastError());
-        return -1;
-    }
+        DWORD elapsed = ::GetTickCount() - start;
+        int ret = waitRead(elapsed < timeoutMs ? timeoutMs - elapsed : 0UL);
 
-    ::memcpy(buffer, m_readBuffer, bytes);
-    m_readPending = false;
+        if (ret < 0) {
+            return -1;
+        }
 
-    return int(bytes);
+        if ((ret == 0) && (elapsed >= timeoutMs)) {
+            return 0;
+        }
+    }
+
+    return int(takeRing(buffer, lengthInBytes));
 }
 
 int SerialDataController::write(const unsigned char* buffer, unsigned int length)
@@ -280,15 +387,50 @@ int SerialDataController::write(const unsigned char* buffer, unsigned int length
     return int(length);
 }
 
+bool SerialDataController::setSpeed(unsigned int speed)
+{
+    assert(m_handle != INVALID_HANDLE_VALUE);
+
+    DCB dcb;
+    if (::GetCommState(m_handle, &dcb) == 0)
+    {
+        fprintf(stderr, "Cannot get the attributes for %s, err=%04lx\n", m_device.c_str(), ::GetLastError());
+        return false;
+    }
+
+    dcb.BaudRate = DWORD(speed);
+
+    if (::SetCommState(m_handle, &dcb) == 0)
+    {
+        fprintf(stderr, "Cannot set speed %u for %s, err=%04lx\n", speed, m_device.c_str(), ::GetLastError());
+        return false;
+    }
+
+    m_speed = (SERIAL_SPEED) speed;
+    return true;
+}
+
 void SerialDataController::close()
 {
     assert(m_handle != INVALID_HANDLE_VALUE);
 
+    if (m_readPending)
+    {
+        DWORD bytes = 0UL;
+        ::CancelIo(m_handle);
+        ::GetOverlappedResult(m_handle, &m_readOverlapped, &bytes, TRUE); // the ring is not written to anymore
+        m_readPending = false;
+    }
+
     ::CloseHandle(m_handle);
     m_handle = INVALID_HANDLE_VALUE;
 
-    ::CloseHandle(m_readOverlapped.hEvent);
-    ::CloseHandle(m_writeOverlapped.hEvent);
+    ::CloseHandle(m_completionPort);
+    m_completionPort = NULL;
+
+    ::CloseHandle((HANDLE) ((ULONG_PTR) m_writeOverlapped.hEvent & ~((ULONG_PTR) 1U)));
+    m_ringHead = 0U;
+    m_ringTail = 0U;
 }
 
 #else
@@ -368,60 +510,166 @@ bool SerialDataController::open(const std::string& device, SERIAL_SPEED speed)
     termios.c_cc[VMIN] = 0;
     termios.c_cc[VTIME] = 10;
 
+    bool customSpeed;
+
+    if (!setTermiosSpeed(termios, customSpeed))
+    {
+        fprintf(stderr, "SerialDataController::open: Unsupported serial port speed - %d\n", int(m_speed));
+        ::close(m_fd);
+        return false;
+    }
+
+    if (::tcsetattr(m_fd, TCSANOW, &termios) < 0)
+    {
+        fprintf(stderr, "SerialDataController::open: Cannot set the attributes for %s\n", m_device.c_str());
+        ::close(m_fd);
+        return false;
+    }
+
+    if (customSpeed && !setCustomSpeed())
+    {
+        ::close(m_fd);
+        return false;
+    }
+
+    fprintf(stderr, "SerialDataController::open: opened %s at speed %d\n",  m_device.c_str(), int(m_speed));
+
+    return true;
+}
+
+bool SerialDataController::setSpeed(unsigned int speed)
+{
+    assert(m_fd != -1);
+
+    termios termios;
+
+    if (::tcgetattr(m_fd, &termios) < 0)
+    {
+        fprintf(stderr, "SerialDataController::setSpeed: Cannot get the attributes for %s\n", m_device.c_str());
+        return false;
+    }
+
+    SERIAL_SPEED previousSpeed = m_speed;
+    m_speed = (SERIAL_SPEED) speed;
+    bool customSpeed;
+
+    if (!setTermiosSpeed(termios, customSpeed))
+    {
+        fprintf(stderr, "SerialDataController::setSpeed: Unsupported serial port speed - %u\n", speed);
+        m_speed = previousSpeed;
+        return false;
+    }
+
+    // let pending output go at the previous speed
+    if (::tcsetattr(m_fd, TCSADRAIN, &termios) < 0)
+    {
+        fprintf(stderr, "SerialDataController::setSpeed: Cannot set the attributes for %s\n", m_device.c_str());
+        m_speed = previousSpeed;
+        return false;
+    }
+
+    if (customSpeed && !setCustomSpeed())
+    {
+        m_speed = previousSpeed;
+        return false;
+    }
+
+    fprintf(stderr, "SerialDataController::setSpeed: %s now at speed %d\n",  m_device.c_str(), int(m_speed));
+    return true;
+}
+
+bool SerialDataController::setTermiosSpeed(termios& termios, bool& customSpeed)
+{
+    speed_t speed;
+    customSpeed = false;
+
     switch (m_speed)
     {
     case SERIAL_1200:
-        ::cfsetospeed(&termios, B1200);
-        ::cfsetispeed(&termios, B1200);
+        speed = B1200;
         break;
     case SERIAL_2400:
-        ::cfsetospeed(&termios, B2400);
-        ::cfsetispeed(&termios, B2400);
+        speed = B2400;
         break;
     case SERIAL_4800:
-        ::cfsetospeed(&termios, B4800);
-        ::cfsetispeed(&termios, B4800);
+        speed = B4800;
         break;
     case SERIAL_9600:
-        ::cfsetospeed(&termios, B9600);
-        ::cfsetispeed(&termios, B9600);
+        speed = B9600;
         break;
     case SERIAL_19200:
-        ::cfsetospeed(&termios, B19200);
-        ::cfsetispeed(&termios, B19200);
+        speed = B19200;
         break;
     case SERIAL_38400:
-        ::cfsetospeed(&termios, B38400);
-        ::cfsetispeed(&termios, B38400);
+        speed = B38400;
         break;
     case SERIAL_115200:
-        ::cfsetospeed(&termios, B115200);
-        ::cfsetispeed(&termios, B115200);
+        speed = B115200;
         break;
     case SERIAL_230400:
-        ::cfsetospeed(&termios, B230400);
-        ::cfsetispeed(&termios, B230400);
+        speed = B230400;
         break;
     case SERIAL_460800:
-        ::cfsetospeed(&termios, B460800);
-        ::cfsetispeed(&termios, B460800);
+        speed = B460800;
+        break;
+    case SERIAL_921600:
+        speed = B921600;
+        break;
+    case SERIAL_1000000:
+        speed = B1000000;
+        break;
+    case SERIAL_1500000:
+        speed = B1500000;
+        break;
+    case SERIAL_2000000:
+        speed = B2000000;
+        break;
+    case SERIAL_3000000:
+        speed = B3000000;
         break;
     default:
-        fprintf(stderr, "SerialDataController::open: Unsupported serial port speed - %d\n", int(m_speed));
-        ::close(m_fd);
-        return false;
+        if (m_speed <= SERIAL_NONE) {
+            return false;
+        }
+
+        // placeholder until the actual speed is set with setCustomSpeed()
+        speed = B38400;
+        customSpeed = true;
+        break;
     }
 
-    if (::tcsetattr(m_fd, TCSANOW, &termios) < 0)
+    ::cfsetospeed(&termios, speed);
+    ::cfsetispeed(&termios, speed);
+    return true;
+}
+
+bool SerialDataController::setCustomSpeed()
+{
+#if defined(SERIALDV_TERMIOS2)
+    struct termios2 tio2;
+
+    if (::ioctl(m_fd, TCGETS2, &tio2) < 0)
     {
-        fprintf(stderr, "SerialDataController::open: Cannot set the attributes for %s\n", m_device.c_str());
-        ::close(m_fd);
+        fprintf(stderr, "SerialDataController::setCustomSpeed: ioctl: Cannot get termios2\n");
         return false;
     }
 
-    fprintf(stderr, "SerialDataController::open: opened %s at speed %d\n",  m_device.c_str(), int(m_speed));
+    tio2.c_cflag &= ~CBAUD;
+    tio2.c_cflag |= BOTHER;
+    tio2.c_ispeed = (unsigned int) m_speed;
+    tio2.c_ospeed = (unsigned int) m_speed;
+
+    if (::ioctl(m_fd, TCSETS2, &tio2) < 0)
+    {
+        fprintf(stderr, "SerialDataController::setCustomSpeed: ioctl: Cannot set speed %d\n", int(m_speed));
+        return false;
+    }
 
     return true;
+#else
+    fprintf(stderr, "SerialDataController::setCustomSpeed: custom speeds are not supported on this system\n");
+    return false;
+#endif
 }
 
 int SerialDataController::read(unsigned char* buffer, unsigned int lengthInBytes)
@@ -488,31 +736,150 @@ int SerialDataController::read(unsigned char* buffer, unsigned int lengthInBytes
     return lengthInBytes;
 }
 
+int SerialDataController::readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs)
+{
+    assert(buffer != 0);
+    assert(m_fd != -1);
+
+    if (lengthInBytes == 0U)
+        return 0;
+
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    struct timespec ts;
+    ts.tv_sec = timeoutUs / 1000000U;
+    ts.tv_nsec = (timeoutUs % 1000000U) * 1000U;
+
+    int n = ::ppoll(&pfd, 1, &ts, 0);
+
+    if (n < 0)
+    {
+        if (errno == EINTR) {
+            return 0;
+        }
+
+        fprintf(stderr, "SerialDataController::readAvailable: Error from ppoll(), errno=%d\n", errno);
+        return -1;
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    ssize_t len = ::read(m_fd, buffer, lengthInBytes);
+
+    if (len < 0)
+    {
+        if (errno == EAGAIN) {
+            return 0;
+        }
+
+        fprintf(stderr, "SerialDataController::readAvailable: Error from read(), errno=%d\n", errno);
+        return -1;
+    }
+
+    return (int) len;
+}
+
 int SerialDataController::write(const unsigned char* buffer, unsigned int lengthInBytes)
 {
     assert(buffer != 0);
+
+    DataBuffer part;
+    part.data = buffer;
+    part.length = lengthInBytes;
+    return writeGather(&part, 1);
+}
+
+int SerialDataController::writeGather(const DataBuffer* buffers, unsigned int nbBuffers)
+{
     assert(m_fd != -1);
+    assert(nbBuffers <= DATA_MAX_BUFFERS);
+
+    struct iovec iovecs[DATA_MAX_BUFFERS];
+    unsigned int lengthInBytes = 0U;
+    unsigned int nbIovecs = 0U;
+
+    for (unsigned int i = 0; i < nbBuffers; i++)
+    {
+        if (buffers[i].length == 0U) {
+            continue;
+        }
+
+        iovecs[nbIovecs].iov_base = (void *) buffers[i].data;
+        iovecs[nbIovecs].iov_len = buffers[i].length;
+        lengthInBytes += buffers[i].length;
+        nbIovecs++;
+    }
 
     if (lengthInBytes == 0U)
         return 0;
 
+    // allow for the transmission time at 10 bits per byte when the output buffer is full
+    unsigned int speed = m_speed == SERIAL_NONE ? (unsigned int) SERIAL_9600 : (unsigned int) m_speed;
+    struct timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t deadlineMs = now.tv_sec * 1000ULL + now.tv_nsec / 1000000 + (lengthInBytes * 10000ULL) / speed + SERIAL_WRITE_MARGIN_MS;
     unsigned int ptr = 0U;
+    struct iovec *iov = iovecs;
 
     while (ptr < lengthInBytes)
     {
-        ssize_t n = ::write(m_fd, buffer + ptr, lengthInBytes - ptr);
+        ssize_t n = ::writev(m_fd, iov, nbIovecs);
 
         if (n < 0)
         {
+            if (errno == EINTR) {
+                continue;
+            }
+
             if (errno != EAGAIN)
             {
-                fprintf(stderr, "SerialDataController::write: Error returned from write(), errno=%d", errno);
+                fprintf(stderr, "SerialDataController::writeGather: Error returned from writev(), errno=%d\n", errno);
                 return -1;
             }
+
+            // output buffer full: wait for room instead of spinning
+            ::clock_gettime(CLOCK_MONOTONIC, &now);
+            uint64_t nowMs = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+
+            if (nowMs >= deadlineMs)
+            {
+                fprintf(stderr, "SerialDataController::writeGather: timeout after %u bytes out of %u\n", ptr, lengthInBytes);
+                return -1;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = m_fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+
+            if ((::poll(&pfd, 1, (int) (deadlineMs - nowMs)) < 0) && (errno != EINTR))
+            {
+                fprintf(stderr, "SerialDataController::writeGather: Error returned from poll(), errno=%d\n", errno);
+                return -1;
+            }
+
+            continue;
+        }
+
+        ptr += n;
+
+        // skip what has been written
+        while ((nbIovecs > 0) && ((size_t) n >= iov->iov_len))
+        {
+            n -= iov->iov_len;
+            iov++;
+            nbIovecs--;
         }
 
-        if (n > 0) {
-            ptr += n;
+        if (nbIovecs > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
         }
     }
 
@@ -19,60 +19,23 @@
 
 #if defined(__WINDOWS__)
 #include <windows.h>
+#else
+struct termios;
 #endif
 
 #include <string>
 
+#include "datacontroller.h"
+
 namespace SerialDV
 {
 
-const unsigned char DV3000_START_BYTE   = 0x61U;
-
-const unsigned char DV3000_TYPE_CONTROL = 0x00U;
-const unsigned char DV3000_TYPE_AMBE    = 0x01U;
-const unsigned char DV3000_TYPE_AUDIO   = 0x02U;
-
-const unsigned char DV3000_CONTROL_RATEP  = 0x0AU;
-const unsigned char DV3000_CONTROL_GAIN   = 0x4BU;
-const unsigned char DV3000_CONTROL_PRODID = 0x30U;
-const unsigned char DV3000_CONTROL_READY  = 0x39U;
-
-const unsigned char DV3000_REQ_PRODID[] = {DV3000_START_BYTE, 0x00U, 0x01U, DV3000_TYPE_CONTROL, DV3000_CONTROL_PRODID};
-const unsigned int DV3000_REQ_PRODID_LEN = 5U;
-
-const unsigned char DV3000_REQ_3600X2400_RATEP[]   = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x01U, 0x30U, 0x07U, 0x63U, 0x40U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x48U};
-const unsigned char DV3000_REQ_3600X2450_RATEP[]   = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x31U, 0x07U, 0x54U, 0x24U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x6FU, 0x48U};
-
-const unsigned char DV3000_REQ_7200X4400_1_RATEP[] = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x00U, 0x58U, 0x08U, 0x87U, 0x30U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x44U, 0x90U};
-const unsigned char DV3000_REQ_7200X4400_2_RATEP[] = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x02U, 0x58U, 0x07U, 0x65U, 0x00U, 0x09U, 0x1EU, 0x0CU, 0x41U, 0x27U, 0x73U, 0x90U};
-const unsigned char DV3000_REQ_7200X4400_3_RATEP[] = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x58U, 0x09U, 0x86U, 0x80U, 0x20U, 0x00U, 0x00U, 0x00U, 0x00U, 0x73U, 0x90U};
-
-const unsigned char DV3000_REQ_2450_RATEP[]        = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x31U, 0x07U, 0x54U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x70U, 0x31U};
-const unsigned char DV3000_REQ_4400_RATEP[]        = {DV3000_START_BYTE, 0x00U, 0x0DU, DV3000_TYPE_CONTROL, DV3000_CONTROL_RATEP, 0x04U, 0x58U, 0x09U, 0x86U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x44U, 0x58U};
-const unsigned int DV3000_REQ_RATEP_LEN = 17U;
-
-const unsigned char DV3000_REQ_GAIN[] = {DV3000_START_BYTE, 0x00U, 0x03U, DV3000_TYPE_CONTROL, DV3000_CONTROL_GAIN}; // followed by 1 byte input gain and 1 byte output gain
-const unsigned int DV3000_REQ_GAIN_LEN = 5U;
-
-const unsigned char DV3000_AUDIO_HEADER[] = {DV3000_START_BYTE, 0x01U, 0x42U, DV3000_TYPE_AUDIO, 0x00U, 0xA0U};
-const unsigned char DV3000_AUDIO_HEADER_LEN = 6U;
-
-const unsigned char DV3000_AMBE_HEADER[] = {DV3000_START_BYTE, 0x00U, 0x0BU, DV3000_TYPE_AMBE, 0x01U, 0x48U};
-const unsigned char DV3000_AMBE_HEADER_LEN  = 6U;
-
-const unsigned int DV3000_HEADER_LEN = 4U;
-
-#ifdef __WINDOWS__
-const unsigned int BUFFER_LENGTH = 1000U;
-#else
-const unsigned int BUFFER_LENGTH = 400U;
+const unsigned int SERIAL_WRITE_MARGIN_MS = 500U; //!< Time allowed beyond the transmission time for a write to complete
+#if defined(__WINDOWS__)
+const unsigned int SERIAL_RING_LENGTH = 16384U; //!< Receive ring filled by the posted reads (power of two)
+const DWORD SERIAL_READ_WAIT_MS = 100UL;        //!< A posted read with nothing received completes empty after this time and is posted again
 #endif
 
-const unsigned int MBE_AUDIO_BLOCK_SIZE  = 160U;
-const unsigned int MBE_AUDIO_BLOCK_BYTES = MBE_AUDIO_BLOCK_SIZE * 2U;
-
-const unsigned int MBE_FRAME_MAX_LENGTH_BYTES = 18U;
-
 enum SERIAL_SPEED {
 	SERIAL_NONE   = 0,
     SERIAL_1200   = 1200,
@@ -84,37 +47,67 @@ enum SERIAL_SPEED {
     SERIAL_76800  = 76800,
     SERIAL_115200 = 115200,
     SERIAL_230400 = 230400,
-    SERIAL_460800 = 460800
+    SERIAL_460800 = 460800,
+    SERIAL_921600 = 921600,
+    SERIAL_1000000 = 1000000,
+    SERIAL_1500000 = 1500000,
+    SERIAL_2000000 = 2000000,
+    SERIAL_3000000 = 3000000,
+    SERIAL_MAX    = 0x7FFFFFFF //!< Other values are custom speeds in bauds
 };
 
-class SerialDataController {
+class SerialDataController : public DataController {
 public:
     SerialDataController();
-    ~SerialDataController();
+    virtual ~SerialDataController();
 
+    /** Opens the device at the given speed. Speeds which are not in the SERIAL_SPEED list
+     * can be used by casting the speed in bauds. They are set with termios2 on Linux.
+     */
     bool open(const std::string& device, SERIAL_SPEED speed);
 
-    int  read(unsigned char* buffer, unsigned int lengthInBytes);
-    int  write(const unsigned char* buffer, unsigned int lengthInBytes);
+    /** Changes the speed of an opened device once pending output is sent */
+    virtual bool setSpeed(unsigned int speed);
+    virtual unsigned int getSpeed() const { return m_speed; }
+#if !defined(__WINDOWS__)
+    virtual int getFd() const { return m_fd; }
+#endif
 
-    void close();
+    virtual int  read(unsigned char* buffer, unsigned int lengthInBytes);
+    virtual int  readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs);
+    virtual int  write(const unsigned char* buffer, unsigned int lengthInBytes);
+#if !defined(__WINDOWS__)
+    virtual int  writeGather(const DataBuffer* buffers, unsigned int nbBuffers);
+#endif
+
+    virtual void close();
 
 private:
     std::string    m_device;
     SERIAL_SPEED   m_speed;
 #if defined(__WINDOWS__)
     HANDLE         m_handle;
+    HANDLE         m_completionPort;   //!< Completions of the reads posted into the ring
     OVERLAPPED     m_readOverlapped;
     OVERLAPPED     m_writeOverlapped;
-    unsigned char* m_readBuffer;
-    unsigned int   m_readLength;
-    bool           m_readPending;
+    unsigned char* m_ring;             //!< SERIAL_RING_LENGTH bytes received and not taken yet
+    unsigned int   m_ringHead;         //!< Bytes received since opening (wraps)
+    unsigned int   m_ringTail;         //!< Bytes taken by the caller since opening (wraps)
+    bool           m_readPending;      //!< A read is posted into the free part of the ring
 #else
     int            m_fd;
 #endif
 
 #if defined(__WINDOWS__)
-    int readNonblock(unsigned char* buffer, unsigned int length);
+    /** Posts a read on the contiguous free part of the ring unless one is pending or the ring is full */
+    bool postRead();
+    /** Waits for the posted read to complete and posts the next one. Returns the number of bytes received, 0 on timeout or -1 on error */
+    int  waitRead(DWORD timeoutMs);
+    /** Copies up to length received bytes out of the ring */
+    unsigned int takeRing(unsigned char* buffer, unsigned int length);
+#else
+    bool setTermiosSpeed(::termios& termios, bool& customSpeed);
+    bool setCustomSpeed();
 #endif
 };
 
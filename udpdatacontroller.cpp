@@ -0,0 +1,405 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "udpdatacontroller.h"
+#include "serialdatacontroller.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#if !defined(__WINDOWS__)
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#endif
+
+namespace SerialDV
+{
+
+bool UDPDataController::parseDeviceName(const std::string& device, std::string& host, unsigned int& port)
+{
+    const std::string prefix("udp://");
+
+    if (device.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+
+    std::string address = device.substr(prefix.size());
+    std::string::size_type colon;
+    port = UDP_DEFAULT_PORT;
+
+    if (!address.empty() && (address[0] == '[')) // [IPv6]:port
+    {
+        std::string::size_type end = address.find(']');
+
+        if (end == std::string::npos) {
+            return false;
+        }
+
+        host = address.substr(1, end - 1);
+        colon = address.find(':', end);
+    }
+    else
+    {
+        colon = address.rfind(':');
+        host = address.substr(0, colon);
+    }
+
+    if (colon != std::string::npos) {
+        port = atoi(address.substr(colon + 1).c_str());
+    }
+
+    return !host.empty() && (port > 0) && (port < 65536);
+}
+
+#if defined(__WINDOWS__)
+
+UDPDataController::UDPDataController() :
+        m_port(0),
+        m_fd(-1)
+{
+}
+
+UDPDataController::~UDPDataController()
+{
+}
+
+bool UDPDataController::open(const std::string& host, unsigned int port)
+{
+    fprintf(stderr, "UDPDataController::open: %s:%u: UDP devices are not supported on Windows\n", host.c_str(), port);
+    return false;
+}
+
+int UDPDataController::read(unsigned char* buffer __attribute__((unused)), unsigned int lengthInBytes __attribute__((unused)))
+{
+    return -1;
+}
+
+int UDPDataController::readAvailable(unsigned char* buffer __attribute__((unused)), unsigned int lengthInBytes __attribute__((unused)), unsigned int timeoutUs __attribute__((unused)))
+{
+    return -1;
+}
+
+int UDPDataController::write(const unsigned char* buffer __attribute__((unused)), unsigned int lengthInBytes __attribute__((unused)))
+{
+    return -1;
+}
+
+void UDPDataController::close()
+{
+}
+
+#else
+
+UDPDataController::UDPDataController() :
+        m_port(0),
+        m_fd(-1)
+{
+}
+
+UDPDataController::~UDPDataController()
+{
+}
+
+bool UDPDataController::open(const std::string& host, unsigned int port)
+{
+    assert(m_fd == -1);
+
+    m_host = host;
+    m_port = port;
+
+    struct addrinfo hints;
+    struct addrinfo *res;
+    char service[16];
+
+    ::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%u", port);
+
+    int err = ::getaddrinfo(host.c_str(), service, &hints, &res);
+
+    if (err != 0)
+    {
+        fprintf(stderr, "UDPDataController::open: cannot resolve %s: %s\n", host.c_str(), gai_strerror(err));
+        return false;
+    }
+
+    for (struct addrinfo *ai = res; ai != 0; ai = ai->ai_next)
+    {
+        m_fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+
+        if (m_fd < 0) {
+            continue;
+        }
+
+        // connected socket: only datagrams from the server are received
+        if (::connect(m_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    ::freeaddrinfo(res);
+
+    if (m_fd < 0)
+    {
+        fprintf(stderr, "UDPDataController::open: cannot connect to %s:%u\n", host.c_str(), port);
+        return false;
+    }
+
+    fprintf(stderr, "UDPDataController::open: opened %s:%u\n", m_host.c_str(), m_port);
+    return true;
+}
+
+int UDPDataController::read(unsigned char* buffer, unsigned int lengthInBytes)
+{
+    return readAvailable(buffer, lengthInBytes, 0);
+}
+
+int UDPDataController::readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs)
+{
+    assert(buffer != 0);
+    assert(m_fd != -1);
+
+    if (lengthInBytes == 0U)
+        return 0;
+
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    struct timespec ts;
+    ts.tv_sec = timeoutUs / 1000000U;
+    ts.tv_nsec = (timeoutUs % 1000000U) * 1000U;
+
+    int n = ::ppoll(&pfd, 1, &ts, 0);
+
+    if (n < 0)
+    {
+        if (errno == EINTR) {
+            return 0;
+        }
+
+        fprintf(stderr, "UDPDataController::readAvailable: Error from ppoll(), errno=%d\n", errno);
+        return -1;
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    // Each datagram lands in its own slot of the buffer then slots are packed together
+    struct mmsghdr msgs[UDP_MAX_DATAGRAMS];
+    struct iovec iovecs[UDP_MAX_DATAGRAMS];
+    unsigned int nbSlots = lengthInBytes / BUFFER_LENGTH;
+
+    if (nbSlots == 0) {
+        nbSlots = 1;
+    } else if (nbSlots > UDP_MAX_DATAGRAMS) {
+        nbSlots = UDP_MAX_DATAGRAMS;
+    }
+
+    unsigned int slotLength = nbSlots == 1 ? lengthInBytes : BUFFER_LENGTH;
+    ::memset(msgs, 0, nbSlots * sizeof(struct mmsghdr));
+
+    for (unsigned int i = 0; i < nbSlots; i++)
+    {
+        iovecs[i].iov_base = buffer + i * slotLength;
+        iovecs[i].iov_len = slotLength;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nbMsgs = ::recvmmsg(m_fd, msgs, nbSlots, MSG_DONTWAIT, 0);
+
+    if (nbMsgs < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            return 0;
+        }
+
+        fprintf(stderr, "UDPDataController::readAvailable: Error from recvmmsg(), errno=%d\n", errno);
+        return -1;
+    }
+
+    unsigned int length = 0;
+
+    for (int i = 0; i < nbMsgs; i++)
+    {
+        if (length != i * slotLength) {
+            ::memmove(buffer + length, buffer + i * slotLength, msgs[i].msg_len);
+        }
+
+        length += msgs[i].msg_len;
+    }
+
+    return length;
+}
+
+int UDPDataController::write(const unsigned char* buffer, unsigned int lengthInBytes)
+{
+    assert(buffer != 0);
+
+    DataBuffer part;
+    part.data = buffer;
+    part.length = lengthInBytes;
+    return writeGather(&part, 1);
+}
+
+int UDPDataController::writeGather(const DataBuffer* buffers, unsigned int nbBuffers)
+{
+    assert(m_fd != -1);
+
+    unsigned int lengthInBytes = 0U;
+
+    for (unsigned int i = 0; i < nbBuffers; i++) {
+        lengthInBytes += buffers[i].length;
+    }
+
+    if (lengthInBytes == 0U)
+        return 0;
+
+    // allow for the transmission time on the serial link of the server when the socket buffer is full
+    struct timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t deadlineMs = now.tv_sec * 1000ULL + now.tv_nsec / 1000000 + (lengthInBytes * 10000ULL) / UDP_LINK_SPEED + SERIAL_WRITE_MARGIN_MS;
+    unsigned int part = 0U;
+    unsigned int offset = 0U; // in the current part
+
+    while (part < nbBuffers)
+    {
+        struct mmsghdr msgs[UDP_MAX_DATAGRAMS];
+        struct iovec iovecs[UDP_MAX_DATAGRAMS];
+        unsigned int nbMsgs = 0;
+        unsigned int msgPart = part;
+        unsigned int msgOffset = offset;
+
+        ::memset(msgs, 0, sizeof(msgs));
+
+        // one datagram per packet as AMBEserver relays each datagram as one packet
+        while ((msgPart < nbBuffers) && (nbMsgs < UDP_MAX_DATAGRAMS))
+        {
+            const unsigned char *buffer = buffers[msgPart].data;
+            unsigned int packetLength = buffers[msgPart].length - msgOffset;
+
+            if (packetLength == 0)
+            {
+                msgPart++;
+                msgOffset = 0;
+                continue;
+            }
+
+            if ((packetLength >= DV3000_HEADER_LEN) && (buffer[msgOffset] == DV3000_START_BYTE))
+            {
+                unsigned int framedLength = DV3000_HEADER_LEN + buffer[msgOffset + 1] * 256 + buffer[msgOffset + 2];
+
+                if (framedLength <= packetLength) {
+                    packetLength = framedLength;
+                }
+            }
+
+            iovecs[nbMsgs].iov_base = (void *) (buffer + msgOffset);
+            iovecs[nbMsgs].iov_len = packetLength;
+            msgs[nbMsgs].msg_hdr.msg_iov = &iovecs[nbMsgs];
+            msgs[nbMsgs].msg_hdr.msg_iovlen = 1;
+            msgOffset += packetLength;
+            nbMsgs++;
+        }
+
+        if (nbMsgs == 0) {
+            break;
+        }
+
+        int sent = ::sendmmsg(m_fd, msgs, nbMsgs, 0);
+
+        if (sent < 0)
+        {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                ::clock_gettime(CLOCK_MONOTONIC, &now);
+                uint64_t nowMs = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+
+                if (nowMs >= deadlineMs)
+                {
+                    fprintf(stderr, "UDPDataController::writeGather: timeout after %u parts out of %u\n", part, nbBuffers);
+                    return -1;
+                }
+
+                struct pollfd pfd;
+                pfd.fd = m_fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+
+                if ((::poll(&pfd, 1, (int) (deadlineMs - nowMs)) < 0) && (errno != EINTR))
+                {
+                    fprintf(stderr, "UDPDataController::writeGather: Error from poll(), errno=%d\n", errno);
+                    return -1;
+                }
+
+                continue;
+            }
+
+            fprintf(stderr, "UDPDataController::writeGather: Error from sendmmsg(), errno=%d\n", errno);
+            return -1;
+        }
+
+        // move past the datagrams sent
+        for (int i = 0; i < sent; i++)
+        {
+            offset += iovecs[i].iov_len;
+
+            while ((part < nbBuffers) && (offset >= buffers[part].length))
+            {
+                offset -= buffers[part].length;
+                part++;
+            }
+        }
+    }
+
+    return lengthInBytes;
+}
+
+void UDPDataController::close()
+{
+    assert(m_fd != -1);
+
+    ::close(m_fd);
+
+    m_host.clear();
+    m_port = 0;
+    m_fd = -1;
+}
+
+#endif // WINDOWS
+
+} // namespace SerialDV
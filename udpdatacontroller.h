@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2016 Edouard Griffiths, F4EXB.                                  //
+//                                                                               //
+// This program is free software; you can redistribute it and/or modify          //
+// it under the terms of the GNU General Public License as published by          //
+// the Free Software Foundation as version 3 of the License, or                  //
+//                                                                               //
+// This program is distributed in the hope that it will be useful,               //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                  //
+// GNU General Public License V3 for more details.                               //
+//                                                                               //
+// You should have received a copy of the GNU General Public License             //
+// along with this program. If not, see <http://www.gnu.org/licenses/>.          //
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef UDPDATACONTROLLER_H_
+#define UDPDATACONTROLLER_H_
+
+#include <string>
+
+#include "datacontroller.h"
+
+namespace SerialDV
+{
+
+const unsigned int UDP_DEFAULT_PORT = 2460U; //!< AMBEserver default port
+const unsigned int UDP_MAX_DATAGRAMS = 32U;  //!< Maximum number of datagrams sent or received in one system call
+const unsigned int UDP_LINK_SPEED = 460800U; //!< Serial speed assumed behind AMBEserver to bound the time a write may wait for room
+
+/** Link to a network attached device served by AMBEserver. Each AMBE3000 packet travels in its
+ * own datagram. Several packets written at once are sent with one sendmmsg() call and all the
+ * datagrams pending on reception are collected with one recvmmsg() call.
+ */
+class UDPDataController : public DataController {
+public:
+    UDPDataController();
+    virtual ~UDPDataController();
+
+    /** Opens the link to host and port e.g. from an udp://host:port string */
+    bool open(const std::string& host, unsigned int port);
+
+    virtual int  read(unsigned char* buffer, unsigned int lengthInBytes);
+    virtual int  readAvailable(unsigned char* buffer, unsigned int lengthInBytes, unsigned int timeoutUs);
+    virtual int  write(const unsigned char* buffer, unsigned int lengthInBytes);
+#if !defined(__WINDOWS__)
+    virtual int  writeGather(const DataBuffer* buffers, unsigned int nbBuffers);
+#endif
+    virtual int  getFd() const { return m_fd; }
+
+    virtual void close();
+
+    /** Splits an udp://host:port device name. The port defaults to UDP_DEFAULT_PORT.
+     * Returns false if the name is not an UDP device name.
+     */
+    static bool parseDeviceName(const std::string& device, std::string& host, unsigned int& port);
+
+private:
+    std::string m_host;
+    unsigned int m_port;
+    int m_fd;
+};
+
+} // namespace SerialDV
+
+#endif /* UDPDATACONTROLLER_H_ */